@@ -6,6 +6,7 @@
 #include <cstdlib>
 #include <cstdint>
 #include <algorithm>
+#include <limits>
 #include "bst.h"
 
 struct KeyError { };
@@ -14,27 +15,25 @@ struct KeyError { };
 * A special kind of node for an AVL tree, which adds the balance as a data member, plus
 * other additional helper functions. You do NOT need to implement any functionality or
 * add additional data members or helper functions.
+*
+* The links come from BasicNode typed as AVLNode*, so no overrides or
+* casts are needed to walk an AVL tree.
 */
 template <typename Key, typename Value>
-class AVLNode : public Node<Key, Value>
+class AVLNode : public BasicNode<Key, Value, AVLNode<Key, Value> >
 {
 public:
     // Constructor/destructor.
     AVLNode(const Key& key, const Value& value, AVLNode<Key, Value>* parent);
-    virtual ~AVLNode();
+    template <typename... Args>
+    AVLNode(AVLNode<Key, Value>* parent, Args&&... args);
+    ~AVLNode();
 
     // Getter/setter for the node's height.
     int8_t getBalance () const;
     void setBalance (int8_t balance);
     void updateBalance(int8_t diff);
 
-    // Getters for parent, left, and right. These need to be redefined since they
-    // return pointers to AVLNodes - not plain Nodes. See the Node class in bst.h
-    // for more information.
-    virtual AVLNode<Key, Value>* getParent() const override;
-    virtual AVLNode<Key, Value>* getLeft() const override;
-    virtual AVLNode<Key, Value>* getRight() const override;
-
 protected:
     int8_t balance_;    // effectively a signed char
 };
@@ -50,7 +49,18 @@ protected:
 */
 template<class Key, class Value>
 AVLNode<Key, Value>::AVLNode(const Key& key, const Value& value, AVLNode<Key, Value> *parent) :
-    Node<Key, Value>(key, value, parent), balance_(0)
+    BasicNode<Key, Value, AVLNode<Key, Value> >(key, value, parent), balance_(0)
+{
+
+}
+
+/**
+* Emplacing constructor, the item is built in place (see BasicNode).
+*/
+template<class Key, class Value>
+template<typename... Args>
+AVLNode<Key, Value>::AVLNode(AVLNode<Key, Value> *parent, Args&&... args) :
+    BasicNode<Key, Value, AVLNode<Key, Value> >(parent, std::forward<Args>(args)...), balance_(0)
 {
 
 }
@@ -91,278 +101,1091 @@ void AVLNode<Key, Value>::updateBalance(int8_t diff)
     balance_ += diff;
 }
 
+/*
+  -----------------------------------------------
+  End implementations for the AVLNode class.
+  -----------------------------------------------
+*/
+
+/**
+* An opt-in compact node for an AVL tree. It has the same interface as
+* AVLNode, but the balance lives in the low bits of the parent pointer
+* instead of its own (padded) field:
+*
+*   AVLTree<int, double, std::less<int>, CompactAVLNode<int, double> >
+*
+* Nodes are 8-byte aligned, so the low three bits of a node address are
+* always zero. Three bits are used rather than two because insertFix and
+* removeFix briefly store -2 and +2 before rotating. The balance is kept
+* as balance + 2 so every value in [-2, 2] fits.
+*/
+template <typename Key, typename Value>
+class alignas(8) CompactAVLNode
+{
+public:
+    CompactAVLNode(const Key& key, const Value& value, CompactAVLNode<Key, Value>* parent);
+    template <typename... Args>
+    CompactAVLNode(CompactAVLNode<Key, Value>* parent, Args&&... args);
+
+    const std::pair<const Key, Value>& getItem() const;
+    std::pair<const Key, Value>& getItem();
+    const Key& getKey() const;
+    const Value& getValue() const;
+    Value& getValue();
+
+    CompactAVLNode<Key, Value>* getParent() const;
+    CompactAVLNode<Key, Value>* getLeft() const;
+    CompactAVLNode<Key, Value>* getRight() const;
+    CompactAVLNode<Key, Value>* getChild(bool right) const;
+
+    void setParent(CompactAVLNode<Key, Value>* parent);
+    void setLeft(CompactAVLNode<Key, Value>* left);
+    void setRight(CompactAVLNode<Key, Value>* right);
+    void setValue(const Value &value);
+
+    int8_t getBalance () const;
+    void setBalance (int8_t balance);
+    void updateBalance(int8_t diff);
+
+protected:
+    static const std::uintptr_t BALANCE_MASK = 7;
+    static const int BALANCE_BIAS = 2;
+
+    std::pair<const Key, Value> item_;
+    std::uintptr_t parentAndBalance_;
+    CompactAVLNode<Key, Value>* left_;
+    CompactAVLNode<Key, Value>* right_;
+};
+
+/*
+  -------------------------------------------------
+  Begin implementations for the CompactAVLNode class.
+  -------------------------------------------------
+*/
+
 /**
-* An overridden function for getting the parent since a static_cast is necessary to make sure
-* that our node is a AVLNode.
+* A new node starts balanced, i.e. with BALANCE_BIAS in the tag bits.
 */
 template<class Key, class Value>
-AVLNode<Key, Value> *AVLNode<Key, Value>::getParent() const
+CompactAVLNode<Key, Value>::CompactAVLNode(const Key& key, const Value& value, CompactAVLNode<Key, Value>* parent) :
+    item_(key, value),
+    parentAndBalance_(reinterpret_cast<std::uintptr_t>(parent) | BALANCE_BIAS),
+    left_(NULL),
+    right_(NULL)
 {
-    return static_cast<AVLNode<Key, Value>*>(this->parent_);
+
 }
 
 /**
-* Overridden for the same reasons as above.
+* Emplacing constructor, the item is built in place (see BasicNode).
 */
 template<class Key, class Value>
-AVLNode<Key, Value> *AVLNode<Key, Value>::getLeft() const
+template<typename... Args>
+CompactAVLNode<Key, Value>::CompactAVLNode(CompactAVLNode<Key, Value>* parent, Args&&... args) :
+    item_(std::forward<Args>(args)...),
+    parentAndBalance_(reinterpret_cast<std::uintptr_t>(parent) | BALANCE_BIAS),
+    left_(NULL),
+    right_(NULL)
 {
-    return static_cast<AVLNode<Key, Value>*>(this->left_);
+
 }
 
 /**
-* Overridden for the same reasons as above.
+* Getters for the item, same as BasicNode.
 */
 template<class Key, class Value>
-AVLNode<Key, Value> *AVLNode<Key, Value>::getRight() const
+const std::pair<const Key, Value>& CompactAVLNode<Key, Value>::getItem() const
 {
-    return static_cast<AVLNode<Key, Value>*>(this->right_);
+    return item_;
 }
 
-/*
-  -----------------------------------------------
-  End implementations for the AVLNode class.
-  -----------------------------------------------
-*/
+template<class Key, class Value>
+std::pair<const Key, Value>& CompactAVLNode<Key, Value>::getItem()
+{
+    return item_;
+}
 
-template <class Key, class Value>
-class AVLTree : public BinarySearchTree<Key, Value>
+template<class Key, class Value>
+const Key& CompactAVLNode<Key, Value>::getKey() const
 {
-public:
-    virtual void insert (const std::pair<const Key, Value> &new_item); // TODO
-    virtual void remove(const Key& key);  // TODO
-    virtual void showBalanceOfAll(); //DEBUG
-protected:
-    virtual void nodeSwap( AVLNode<Key,Value>* n1, AVLNode<Key,Value>* n2);
+    return item_.first;
+}
 
-    // Add helper functions here
-    virtual void insertFix( AVLNode<Key,Value>* p, AVLNode<Key,Value>* n);
-    virtual void removeFix( AVLNode<Key,Value>* n, int diff);
-    //TODO
-    //rotate left
-    virtual void rotateLeft(AVLNode<Key,Value>* n);
-    //rotate right
-    virtual void rotateRight(AVLNode<Key,Value>* n);
+template<class Key, class Value>
+const Value& CompactAVLNode<Key, Value>::getValue() const
+{
+    return item_.second;
+}
 
+template<class Key, class Value>
+Value& CompactAVLNode<Key, Value>::getValue()
+{
+    return item_.second;
+}
 
-};
+template<class Key, class Value>
+void CompactAVLNode<Key, Value>::setValue(const Value& value)
+{
+    item_.second = value;
+}
 
-/*
- * Recall: If key is already in the tree, you should 
- * overwrite the current value with the updated value.
- */
+/**
+* Strips the balance bits off the stored parent pointer.
+*/
 template<class Key, class Value>
-void AVLTree<Key, Value>::insert (const std::pair<const Key, Value> &new_item)
+CompactAVLNode<Key, Value>* CompactAVLNode<Key, Value>::getParent() const
 {
-    // TODO
-    if (this->root_ == nullptr) 
-    {
-        this->root_ = new AVLNode<Key, Value>(new_item.first, new_item.second, nullptr);
-        // this automatically set balance to 0
-        return;
-    }
+    return reinterpret_cast<CompactAVLNode<Key, Value>*>(parentAndBalance_ & ~BALANCE_MASK);
+}
 
-    AVLNode<Key, Value> *temp = static_cast<AVLNode<Key, Value>*>(this->root_);
-    AVLNode<Key, Value> *parent = nullptr;
-    bool isLeft;
+template<class Key, class Value>
+CompactAVLNode<Key, Value>* CompactAVLNode<Key, Value>::getLeft() const
+{
+    return left_;
+}
 
-    while (temp != nullptr) 
-    {
-        parent = temp;
+template<class Key, class Value>
+CompactAVLNode<Key, Value>* CompactAVLNode<Key, Value>::getRight() const
+{
+    return right_;
+}
 
-        if (new_item.first == temp->getKey())
-        {
-            temp->setValue(new_item.second); //found just replace
-            return;
-        }
-        else if (new_item.first < temp->getKey()) 
-        {
-            temp = temp->getLeft();
-            isLeft = true;
-        }
-        else 
-        {
-            temp = temp->getRight();
-            isLeft = false;
-        }
-    }
+template<class Key, class Value>
+CompactAVLNode<Key, Value>* CompactAVLNode<Key, Value>::getChild(bool right) const
+{
+    return right ? right_ : left_;
+}
 
-    if (parent != nullptr) 
-    {
-        AVLNode<Key, Value> *node = new AVLNode<Key, Value>(new_item.first, new_item.second, parent);
+/**
+* Replaces the parent while keeping the balance bits.
+*/
+template<class Key, class Value>
+void CompactAVLNode<Key, Value>::setParent(CompactAVLNode<Key, Value>* parent)
+{
+    parentAndBalance_ = reinterpret_cast<std::uintptr_t>(parent) | (parentAndBalance_ & BALANCE_MASK);
+}
 
-        if (isLeft) // the new node needs to be inserted to the left.
-        {
-            parent->setLeft(node);
-            parent->updateBalance(-1); // now heavier to the left
-            // so if it was 1 -> it would be 0
-        }
-        else 
-        {
-            parent->setRight(node);
-            parent->updateBalance(1);
-            // so if it was -1, -> it would be 0
-        }
+template<class Key, class Value>
+void CompactAVLNode<Key, Value>::setLeft(CompactAVLNode<Key, Value>* left)
+{
+    left_ = left;
+}
 
-        if (parent->getBalance() != 0)
-        {
-            insertFix(parent, node);
-        }
-    }
+template<class Key, class Value>
+void CompactAVLNode<Key, Value>::setRight(CompactAVLNode<Key, Value>* right)
+{
+    right_ = right;
 }
 
+/**
+* The balance is stored biased by BALANCE_BIAS in the tag bits.
+*/
 template<class Key, class Value>
-void AVLTree<Key, Value>::insertFix(AVLNode<Key,Value>* p, AVLNode<Key,Value>* n)
+int8_t CompactAVLNode<Key, Value>::getBalance() const
 {
-    if (p == nullptr || p->getParent() == nullptr)
-        return;
+    return static_cast<int8_t>(static_cast<int>(parentAndBalance_ & BALANCE_MASK) - BALANCE_BIAS);
+}
 
-    AVLNode<Key, Value>* g = p->getParent();
+template<class Key, class Value>
+void CompactAVLNode<Key, Value>::setBalance(int8_t balance)
+{
+    parentAndBalance_ = (parentAndBalance_ & ~BALANCE_MASK) |
+                        static_cast<std::uintptr_t>(balance + BALANCE_BIAS);
+}
 
-    if (p == g->getLeft()) 
-    {
-        g->updateBalance(-1);
+template<class Key, class Value>
+void CompactAVLNode<Key, Value>::updateBalance(int8_t diff)
+{
+    setBalance(static_cast<int8_t>(getBalance() + diff));
+}
 
-        switch (g->getBalance()) 
-        {
-            case 0:
-                return;
-            case -1:
-                insertFix(g, p);
-                break;
-            case -2:
-                if (n == p->getLeft())  
-                //ZIGZIG LEFT LEFT
-                {
-                    rotateRight(g);
-                    p->setBalance(0);
-                    g->setBalance(0);
-                }
-                else // ZIG ZAG LEFT RIGHT
-                {
-                    rotateLeft(p);
-                    rotateRight(g);
-                    int b = n->getBalance();
-                    if (b == -1) 
-                    {
-                        p->setBalance(0);
-                        g->setBalance(1);
-                    }
-                    else if (b == 0) 
-                    {
-                        p->setBalance(0);
-                        g->setBalance(0);
-                    }
-                    else 
-                    { // b is 1
-                        p->setBalance(-1);
-                        g->setBalance(0);
-                    }
+/*
+  -----------------------------------------------
+  End implementations for the CompactAVLNode class.
+  -----------------------------------------------
+*/
 
-                    n->setBalance(0);
-                }
-                break;
-        }
-    }
-    else 
-    {
-        g->updateBalance(1); // flip for right child
+/**
+* An AVL node with 32-bit index links (see BasicIndexedNode in bst.h),
+* for AVL trees stored in a NodeArena:
+*
+*   AVLTree<int, int, std::less<int>, IndexedAVLNode<int, int>, NodeArena<IndexedAVLNode<int, int> > >
+*/
+template <typename Key, typename Value>
+class IndexedAVLNode : public BasicIndexedNode<Key, Value, IndexedAVLNode<Key, Value> >
+{
+public:
+    IndexedAVLNode(const Key& key, const Value& value, IndexedAVLNode<Key, Value>* parent);
+    template <typename... Args>
+    IndexedAVLNode(IndexedAVLNode<Key, Value>* parent, Args&&... args);
 
-        switch (g->getBalance()) 
-        {
-            case 0:
-                return;
-            case 1:
-                insertFix(g, p);
-                break;
-            case 2:
-                if (n == p->getRight()) 
-                { //RIGHT RIGHT ZIG ZIG
-                    rotateLeft(g);
-                    p->setBalance(0);
-                    g->setBalance(0);
-                }
-                else 
-                { // RIGHT LEFT ZIG ZAG
-                    rotateRight(p);
-                    rotateLeft(g);
-                    
-                    int b = n->getBalance();
-                    if (b == 1) 
-                    {
-                        p->setBalance(0);
-                        g->setBalance(-1);
-                    }
-                    else if (b == 0) {
-                        p->setBalance(0);
-                        g->setBalance(0);
-                    }
-                    else 
-                    {  // -1
-                        p->setBalance(1);
-                        g->setBalance(0);
-                    }
+    int8_t getBalance () const;
+    void setBalance (int8_t balance);
+    void updateBalance(int8_t diff);
 
-                    n->setBalance(0);
-                }
-                break;
-        }
-    }
-}
+protected:
+    int8_t balance_;
+};
 
+/*
+  -------------------------------------------------
+  Begin implementations for the IndexedAVLNode class.
+  -------------------------------------------------
+*/
 
 template<class Key, class Value>
-void AVLTree<Key, Value>::rotateLeft(AVLNode<Key,Value>* n) 
+IndexedAVLNode<Key, Value>::IndexedAVLNode(const Key& key, const Value& value, IndexedAVLNode<Key, Value> *parent) :
+    BasicIndexedNode<Key, Value, IndexedAVLNode<Key, Value> >(key, value, parent), balance_(0)
 {
-    if (n == nullptr || n->getRight() == nullptr) return;
 
-    //take a right child then make it parent (OK)
-    //make the original parent the new left child (OK)
+}
 
-    AVLNode<Key, Value> *originalGrandparent = n->getParent();
-    AVLNode<Key, Value> *newParent = n->getRight();
-    AVLNode<Key, Value> *newParentOriginalLeft = n->getRight()->getLeft();
+template<class Key, class Value>
+template<typename... Args>
+IndexedAVLNode<Key, Value>::IndexedAVLNode(IndexedAVLNode<Key, Value> *parent, Args&&... args) :
+    BasicIndexedNode<Key, Value, IndexedAVLNode<Key, Value> >(parent, std::forward<Args>(args)...), balance_(0)
+{
 
-    n->setParent(newParent); // right child is now the parent
-    newParent->setLeft(n);
+}
 
-    n->setRight(newParentOriginalLeft);
-    if (newParentOriginalLeft != nullptr) newParentOriginalLeft->setParent(n);
+template<class Key, class Value>
+int8_t IndexedAVLNode<Key, Value>::getBalance() const
+{
+    return balance_;
+}
 
-    newParent->setParent(originalGrandparent);
-    
-    if (originalGrandparent != nullptr) 
-    {
-        if (originalGrandparent->getRight() == n) 
-            originalGrandparent->setRight(newParent);
-        else
-            originalGrandparent->setLeft(newParent);
-    }
-    else 
-    {
-        this->root_ = newParent;
-    }
+template<class Key, class Value>
+void IndexedAVLNode<Key, Value>::setBalance(int8_t balance)
+{
+    balance_ = balance;
 }
 
 template<class Key, class Value>
-void AVLTree<Key, Value>::rotateRight(AVLNode<Key,Value>* n) 
+void IndexedAVLNode<Key, Value>::updateBalance(int8_t diff)
 {
-    if (n == nullptr || n->getLeft() == nullptr) return;
+    balance_ += diff;
+}
 
-    //take a left child then make it parent
-    //make the original parent the new right child
+/*
+  -----------------------------------------------
+  End implementations for the IndexedAVLNode class.
+  -----------------------------------------------
+*/
 
-    AVLNode<Key, Value> *originalGrandparent = n->getParent();
-    AVLNode<Key, Value> *newParent = n->getLeft();
-    AVLNode<Key, Value> *newParentOriginalRight = n->getLeft()->getRight();
+/**
+* An AVL node with threaded links (see BasicThreadedNode in bst.h), for
+* trees that are scanned in order a lot:
+*
+*   AVLTree<int, int, std::less<int>, ThreadedAVLNode<int, int> >
+*/
+template <typename Key, typename Value>
+class ThreadedAVLNode : public BasicThreadedNode<Key, Value, ThreadedAVLNode<Key, Value> >
+{
+public:
+    ThreadedAVLNode(const Key& key, const Value& value, ThreadedAVLNode<Key, Value>* parent);
+    template <typename... Args>
+    ThreadedAVLNode(ThreadedAVLNode<Key, Value>* parent, Args&&... args);
 
-    n->setParent(newParent);
-    newParent->setRight(n);
+    int8_t getBalance () const;
+    void setBalance (int8_t balance);
+    void updateBalance(int8_t diff);
 
-    n->setLeft(newParentOriginalRight);
+protected:
+    int8_t balance_;
+};
+
+/*
+  -------------------------------------------------
+  Begin implementations for the ThreadedAVLNode class.
+  -------------------------------------------------
+*/
+
+template<class Key, class Value>
+ThreadedAVLNode<Key, Value>::ThreadedAVLNode(const Key& key, const Value& value, ThreadedAVLNode<Key, Value> *parent) :
+    BasicThreadedNode<Key, Value, ThreadedAVLNode<Key, Value> >(key, value, parent), balance_(0)
+{
+
+}
+
+template<class Key, class Value>
+template<typename... Args>
+ThreadedAVLNode<Key, Value>::ThreadedAVLNode(ThreadedAVLNode<Key, Value> *parent, Args&&... args) :
+    BasicThreadedNode<Key, Value, ThreadedAVLNode<Key, Value> >(parent, std::forward<Args>(args)...), balance_(0)
+{
+
+}
+
+template<class Key, class Value>
+int8_t ThreadedAVLNode<Key, Value>::getBalance() const
+{
+    return balance_;
+}
+
+template<class Key, class Value>
+void ThreadedAVLNode<Key, Value>::setBalance(int8_t balance)
+{
+    balance_ = balance;
+}
+
+template<class Key, class Value>
+void ThreadedAVLNode<Key, Value>::updateBalance(int8_t diff)
+{
+    balance_ += diff;
+}
+
+/*
+  -----------------------------------------------
+  End implementations for the ThreadedAVLNode class.
+  -----------------------------------------------
+*/
+
+/**
+* An AVL node that also counts the nodes in its subtree, which turns the
+* tree into an order-statistic tree: select(), rank(), countInRange(),
+* distance() and iterator += / -= all run in O(log n).
+*
+*   AVLTree<int, int, std::less<int>, OrderStatAVLNode<int, int> >
+*
+* The count is 32 bits and sits in padding AVLNode has anyway for most
+* item types, so a tree holds at most 2^32 - 1 items.
+*/
+template <typename Key, typename Value>
+class OrderStatAVLNode : public BasicNode<Key, Value, OrderStatAVLNode<Key, Value> >
+{
+public:
+    OrderStatAVLNode(const Key& key, const Value& value, OrderStatAVLNode<Key, Value>* parent);
+    template <typename... Args>
+    OrderStatAVLNode(OrderStatAVLNode<Key, Value>* parent, Args&&... args);
+
+    int8_t getBalance () const;
+    void setBalance (int8_t balance);
+    void updateBalance(int8_t diff);
+
+    std::size_t getSize() const;
+    void update();
+
+protected:
+    int8_t balance_;
+    std::uint32_t size_;
+};
+
+/*
+  -------------------------------------------------
+  Begin implementations for the OrderStatAVLNode class.
+  -------------------------------------------------
+*/
+
+template<class Key, class Value>
+OrderStatAVLNode<Key, Value>::OrderStatAVLNode(const Key& key, const Value& value, OrderStatAVLNode<Key, Value> *parent) :
+    BasicNode<Key, Value, OrderStatAVLNode<Key, Value> >(key, value, parent), balance_(0), size_(1)
+{
+
+}
+
+template<class Key, class Value>
+template<typename... Args>
+OrderStatAVLNode<Key, Value>::OrderStatAVLNode(OrderStatAVLNode<Key, Value> *parent, Args&&... args) :
+    BasicNode<Key, Value, OrderStatAVLNode<Key, Value> >(parent, std::forward<Args>(args)...), balance_(0), size_(1)
+{
+
+}
+
+template<class Key, class Value>
+int8_t OrderStatAVLNode<Key, Value>::getBalance() const
+{
+    return balance_;
+}
+
+template<class Key, class Value>
+void OrderStatAVLNode<Key, Value>::setBalance(int8_t balance)
+{
+    balance_ = balance;
+}
+
+template<class Key, class Value>
+void OrderStatAVLNode<Key, Value>::updateBalance(int8_t diff)
+{
+    balance_ += diff;
+}
+
+/**
+* The number of nodes in the subtree rooted here, this one included.
+*/
+template<class Key, class Value>
+std::size_t OrderStatAVLNode<Key, Value>::getSize() const
+{
+    return size_;
+}
+
+/**
+* Recounts the subtree from the children's counts; the tree calls this
+* bottom-up whenever the subtree changes.
+*/
+template<class Key, class Value>
+void OrderStatAVLNode<Key, Value>::update()
+{
+    size_ = static_cast<std::uint32_t>(1 + SubtreeSize<OrderStatAVLNode<Key, Value> >::of(this->left_) +
+                                       SubtreeSize<OrderStatAVLNode<Key, Value> >::of(this->right_));
+}
+
+/*
+  -----------------------------------------------
+  End implementations for the OrderStatAVLNode class.
+  -----------------------------------------------
+*/
+
+/**
+* Monoid policies for AggregateAVLNode. A policy names the aggregate
+* type and supplies three static members: identity(), the aggregate of
+* no values; lift(v), the aggregate of the single value v; and
+* combine(a, b), the aggregate of a's values followed by b's. combine
+* must be associative and identity() neutral for it; it need not be
+* commutative, since the tree always combines in key order.
+*/
+template <typename T>
+struct SumOf
+{
+    typedef T type;
+    static T identity() { return T(); }
+    static T lift(const T& value) { return value; }
+    static T combine(const T& a, const T& b) { return a + b; }
+};
+
+template <typename T>
+struct MinOf
+{
+    typedef T type;
+    static T identity() { return std::numeric_limits<T>::max(); }
+    static T lift(const T& value) { return value; }
+    static T combine(const T& a, const T& b) { return b < a ? b : a; }
+};
+
+template <typename T>
+struct MaxOf
+{
+    typedef T type;
+    static T identity() { return std::numeric_limits<T>::lowest(); }
+    static T lift(const T& value) { return value; }
+    static T combine(const T& a, const T& b) { return a < b ? b : a; }
+};
+
+/**
+* An AVL node that caches Monoid's aggregate of the values in its
+* subtree, so that aggregate(lo, hi) runs in O(log n):
+*
+*   AVLTree<long, long, std::less<long>, AggregateAVLNode<long, long, SumOf<long> > >
+*
+* The cache is kept up to date through inserts, removals and rotations,
+* and by insert() and upsert() when they overwrite a value. A value
+* changed in place through an iterator or a Value& must be followed by
+* tree.refresh(it).
+*/
+template <typename Key, typename Value, typename Monoid>
+class AggregateAVLNode : public BasicNode<Key, Value, AggregateAVLNode<Key, Value, Monoid> >
+{
+public:
+    typedef Monoid monoid_type;
+
+    AggregateAVLNode(const Key& key, const Value& value, AggregateAVLNode<Key, Value, Monoid>* parent);
+    template <typename... Args>
+    AggregateAVLNode(AggregateAVLNode<Key, Value, Monoid>* parent, Args&&... args);
+
+    int8_t getBalance () const;
+    void setBalance (int8_t balance);
+    void updateBalance(int8_t diff);
+
+    const typename Monoid::type& getAggregate() const;
+    void update();
+
+protected:
+    int8_t balance_;
+    typename Monoid::type aggregate_;
+};
+
+/*
+  -------------------------------------------------
+  Begin implementations for the AggregateAVLNode class.
+  -------------------------------------------------
+*/
+
+template<class Key, class Value, class Monoid>
+AggregateAVLNode<Key, Value, Monoid>::AggregateAVLNode(const Key& key, const Value& value,
+                                                       AggregateAVLNode<Key, Value, Monoid> *parent) :
+    BasicNode<Key, Value, AggregateAVLNode<Key, Value, Monoid> >(key, value, parent), balance_(0),
+    aggregate_(Monoid::lift(this->getValue()))
+{
+
+}
+
+template<class Key, class Value, class Monoid>
+template<typename... Args>
+AggregateAVLNode<Key, Value, Monoid>::AggregateAVLNode(AggregateAVLNode<Key, Value, Monoid> *parent, Args&&... args) :
+    BasicNode<Key, Value, AggregateAVLNode<Key, Value, Monoid> >(parent, std::forward<Args>(args)...), balance_(0),
+    aggregate_(Monoid::lift(this->getValue()))
+{
+
+}
+
+template<class Key, class Value, class Monoid>
+int8_t AggregateAVLNode<Key, Value, Monoid>::getBalance() const
+{
+    return balance_;
+}
+
+template<class Key, class Value, class Monoid>
+void AggregateAVLNode<Key, Value, Monoid>::setBalance(int8_t balance)
+{
+    balance_ = balance;
+}
+
+template<class Key, class Value, class Monoid>
+void AggregateAVLNode<Key, Value, Monoid>::updateBalance(int8_t diff)
+{
+    balance_ += diff;
+}
+
+/**
+* Monoid's aggregate of the values in the subtree rooted here, in key order.
+*/
+template<class Key, class Value, class Monoid>
+const typename Monoid::type& AggregateAVLNode<Key, Value, Monoid>::getAggregate() const
+{
+    return aggregate_;
+}
+
+/**
+* Recomputes the aggregate from the children's and this node's value; the
+* tree calls this bottom-up whenever the subtree or the value changes.
+*/
+template<class Key, class Value, class Monoid>
+void AggregateAVLNode<Key, Value, Monoid>::update()
+{
+    typedef SubtreeAggregate<AggregateAVLNode<Key, Value, Monoid> > Agg;
+    aggregate_ = Monoid::combine(Monoid::combine(Agg::of(this->left_), Monoid::lift(this->getValue())),
+                                 Agg::of(this->right_));
+}
+
+/*
+  -----------------------------------------------
+  End implementations for the AggregateAVLNode class.
+  -----------------------------------------------
+*/
+
+/**
+* What a tree offers on top of BinarySearchTree depends on its node type.
+* Nodes that keep subtree sizes (OrderStatAVLNode) give order statistics,
+* and nodes that cache a monoid (AggregateAVLNode) give range aggregates.
+* Each comes as a layer between BinarySearchTree and AVLTree. For any other
+* node type the layer adds nothing, so calling select() on a plain tree
+* does not compile rather than tripping a static_assert.
+*/
+template <class Tree, class Key, class NodeT, bool = SubtreeSize<NodeT>::value>
+class OrderStatistics : public Tree
+{
+public:
+    using Tree::Tree;
+};
+
+template <class Tree, class Key, class NodeT>
+class OrderStatistics<Tree, Key, NodeT, true> : public Tree
+{
+public:
+    using Tree::Tree;
+
+    typename Tree::iterator select(std::size_t k);
+    typename Tree::const_iterator select(std::size_t k) const;
+    std::size_t rank(const Key& key) const;
+    std::size_t countInRange(const Key& lo, const Key& hi) const;
+    std::ptrdiff_t distance(typename Tree::const_iterator first, typename Tree::const_iterator last) const;
+};
+
+template <class Tree, class Key, class NodeT, bool = SubtreeAggregate<NodeT>::value>
+class RangeAggregates : public Tree
+{
+public:
+    using Tree::Tree;
+};
+
+template <class Tree, class Key, class NodeT>
+class RangeAggregates<Tree, Key, NodeT, true> : public Tree
+{
+public:
+    using Tree::Tree;
+
+    typename SubtreeAggregate<NodeT>::type aggregate() const;
+    typename SubtreeAggregate<NodeT>::type aggregate(const Key& lo, const Key& hi) const;
+    void refresh(typename Tree::const_iterator pos);
+};
+
+/*
+  -----------------------------------------------
+  Begin implementations for the OrderStatistics class.
+  -----------------------------------------------
+*/
+
+/**
+* Returns an iterator to the item with the k-th smallest key, counting
+* from 0, or end() if the tree has k items or fewer. Runtime is O(h).
+*/
+template<class Tree, class Key, class NodeT>
+typename Tree::iterator OrderStatistics<Tree, Key, NodeT, true>::select(std::size_t k)
+{
+    return this->iteratorTo(this->selectNode(k));
+}
+
+template<class Tree, class Key, class NodeT>
+typename Tree::const_iterator OrderStatistics<Tree, Key, NodeT, true>::select(std::size_t k) const
+{
+    return this->iteratorTo(this->selectNode(k));
+}
+
+/**
+* Returns how many keys in the tree are less than key (whether or not key
+* itself is in the tree). Runtime is O(h).
+*/
+template<class Tree, class Key, class NodeT>
+std::size_t OrderStatistics<Tree, Key, NodeT, true>::rank(const Key& key) const
+{
+    std::size_t below = 0;
+    NodeT *curr = this->root_;
+    while (curr != NULL)
+    {
+        bool right = this->comp_(curr->getKey(), key);
+        if (right) below += SubtreeSize<NodeT>::of(curr->getLeft()) + 1;
+        curr = curr->getChild(right);
+    }
+    return below;
+}
+
+/**
+* Returns how many keys k satisfy lo <= k < hi. Runtime is O(h).
+*/
+template<class Tree, class Key, class NodeT>
+std::size_t OrderStatistics<Tree, Key, NodeT, true>::countInRange(const Key& lo, const Key& hi) const
+{
+    if (!this->comp_(lo, hi)) return 0;
+    return rank(hi) - rank(lo);
+}
+
+/**
+* Returns the number of steps from first to last, which must both belong
+* to this tree; negative if last comes before first. Runtime is O(h),
+* where std::distance would step through every item in between.
+*/
+template<class Tree, class Key, class NodeT>
+std::ptrdiff_t OrderStatistics<Tree, Key, NodeT, true>::distance(typename Tree::const_iterator first,
+                                                                 typename Tree::const_iterator last) const
+{
+    return static_cast<std::ptrdiff_t>(this->indexOf(Tree::nodeAt(last))) -
+           static_cast<std::ptrdiff_t>(this->indexOf(Tree::nodeAt(first)));
+}
+
+/*
+  -----------------------------------------------
+  End implementations for the OrderStatistics class.
+  -----------------------------------------------
+*/
+
+/*
+  -----------------------------------------------
+  Begin implementations for the RangeAggregates class.
+  -----------------------------------------------
+*/
+
+/**
+* The monoid aggregate of every value in the tree, in key order. O(1).
+*/
+template<class Tree, class Key, class NodeT>
+typename SubtreeAggregate<NodeT>::type RangeAggregates<Tree, Key, NodeT, true>::aggregate() const
+{
+    return SubtreeAggregate<NodeT>::of(this->root_);
+}
+
+/**
+* The monoid aggregate of the values whose keys k satisfy lo <= k < hi,
+* combined in key order (so the monoid need not be commutative); the
+* identity if the range is empty. Runtime is O(h): after finding the
+* topmost node inside the range, one path towards lo picks up whole right
+* subtrees and one path towards hi picks up whole left subtrees.
+*/
+template<class Tree, class Key, class NodeT>
+typename SubtreeAggregate<NodeT>::type RangeAggregates<Tree, Key, NodeT, true>::aggregate(const Key& lo,
+                                                                                        const Key& hi) const
+{
+    typedef SubtreeAggregate<NodeT> Agg;
+    typedef typename Agg::Monoid Monoid;
+
+    if (!this->comp_(lo, hi)) return Monoid::identity();
+
+    NodeT *top = this->root_;
+    while (top != NULL) {
+        if (this->comp_(top->getKey(), lo)) top = top->getRight();
+        else if (!this->comp_(top->getKey(), hi)) top = top->getLeft();
+        else break;
+    }
+    if (top == NULL) return Monoid::identity();
+
+    // Everything in top's left subtree is below hi; keep what is >= lo.
+    typename Agg::type below = Monoid::identity();
+    for (NodeT *curr = top->getLeft(); curr != NULL; ) {
+        if (this->comp_(curr->getKey(), lo)) {
+            curr = curr->getRight();
+        }
+        else {
+            below = Monoid::combine(Monoid::combine(Agg::lift(curr), Agg::of(curr->getRight())), below);
+            curr = curr->getLeft();
+        }
+    }
+
+    // Everything in top's right subtree is >= lo; keep what is below hi.
+    typename Agg::type above = Monoid::identity();
+    for (NodeT *curr = top->getRight(); curr != NULL; ) {
+        if (this->comp_(curr->getKey(), hi)) {
+            above = Monoid::combine(above, Monoid::combine(Agg::of(curr->getLeft()), Agg::lift(curr)));
+            curr = curr->getRight();
+        }
+        else {
+            curr = curr->getLeft();
+        }
+    }
+
+    return Monoid::combine(Monoid::combine(below, Agg::lift(top)), above);
+}
+
+/**
+* Brings the cached aggregates up to date after the value at pos was
+* changed in place, through an iterator, operator[], findOrInsert() or a
+* Value& kept from earlier. insert() and upsert() do this themselves.
+* Runtime is O(h).
+*/
+template<class Tree, class Key, class NodeT>
+void RangeAggregates<Tree, Key, NodeT, true>::refresh(typename Tree::const_iterator pos)
+{
+    this->refreshValue(Tree::nodeAt(pos));
+}
+
+/*
+  -----------------------------------------------
+  End implementations for the RangeAggregates class.
+  -----------------------------------------------
+*/
+
+// BinarySearchTree with the layers its node type calls for, which is
+// what AVLTree derives from.
+template <class Key, class Value, class Compare, class NodeT, class Alloc>
+using AVLTreeBase = RangeAggregates<OrderStatistics<BinarySearchTree<Key, Value, Compare, NodeT, Alloc>, Key, NodeT>,
+                                    Key, NodeT>;
+
+/**
+* A self-balancing search tree. NodeT defaults to AVLNode; any node type with
+* the same interface (links plus get/set/updateBalance) can be plugged in.
+* Keys are ordered by Compare, exactly as in BinarySearchTree.
+*/
+template <class Key, class Value, class Compare = std::less<Key>,
+          class NodeT = AVLNode<Key, Value>, class Alloc = NodePool<NodeT> >
+class AVLTree : public AVLTreeBase<Key, Value, Compare, NodeT, Alloc>
+{
+public:
+    explicit AVLTree(const Compare& comp = Compare());
+    template <typename InputIt>
+    AVLTree(InputIt first, InputIt last, const Compare& comp = Compare());
+
+    // Moving whole key ranges between trees in O(log n)
+    void split(const Key& key, AVLTree& right);
+    void join(AVLTree& right);
+    void join(const std::pair<const Key, Value>& pivot, AVLTree& right);
+
+    // Removing a whole key range at once
+    std::size_t eraseRange(const Key& lo, const Key& hi);
+    typename BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::iterator
+    erase(typename BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::const_iterator first,
+          typename BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::const_iterator last);
+
+    // Set algebra, by divide and conquer over split and join
+    template <typename Merge>
+    void unionWith(AVLTree& other, Merge merge, ThreadPool& pool = ThreadPool::shared());
+    template <typename Merge>
+    void intersectWith(AVLTree& other, Merge merge, ThreadPool& pool = ThreadPool::shared());
+    void differenceWith(const AVLTree& other, ThreadPool& pool = ThreadPool::shared());
+protected:
+    virtual void nodeSwap( NodeT* n1, NodeT* n2);
+    virtual void removeNode(NodeT* n);  // TODO
+
+    // Add helper functions here
+    virtual void postInsert(NodeT* n);
+    virtual void postBuild(NodeT* n, int balance);
+    virtual void insertFix( NodeT* p, NodeT* n);
+    virtual void removeFix( NodeT* n, int diff);
+    //TODO
+    //rotate left
+    virtual void rotateLeft(NodeT* n);
+    //rotate right
+    virtual void rotateRight(NodeT* n);
+    // sets a balance left by a rotation, tracing it
+    void settleBalance(NodeT* n, int balance);
+
+    // A detached subtree and its height, the unit split and join work on
+    struct Subtree
+    {
+        NodeT* root;
+        int height;
+    };
+    static int heightOf(const NodeT* n);
+    static int childHeight(const NodeT* n, int height, bool right);
+    Subtree joinNodes(Subtree left, NodeT* pivot, Subtree right);
+    Subtree joinNodes(Subtree left, Subtree right);
+    Subtree joinRight(Subtree left, NodeT* pivot, Subtree right);
+    Subtree joinLeft(Subtree left, NodeT* pivot, Subtree right);
+    Subtree link(Subtree left, NodeT* pivot, Subtree right);
+    NodeT* splitNodes(Subtree t, const Key& key, Subtree& left, Subtree& right);
+    Subtree splitLast(Subtree t, NodeT*& last);
+    Subtree joinStitched(Subtree left, NodeT* pivot, Subtree right);
+    void adopt(Subtree t);
+    std::size_t eraseFrom(const Key& lo, const Key* hi);
+    std::size_t destroySubtree(NodeT* n);
+
+    // Subproblems whose trees are both at least this tall are forked to
+    // the pool; anything smaller is not worth a task.
+    static const int forkHeight = 12;
+    // A node that stays and the node with the same key from the other tree
+    typedef std::vector<std::pair<NodeT*, NodeT*> > Matches;
+    Subtree unionNodes(Subtree a, Subtree b, Matches& matches, std::vector<NodeT*>& discard, ThreadPool& pool);
+    Subtree intersectNodes(Subtree a, Subtree b, Matches& matches, std::vector<NodeT*>& discard, ThreadPool& pool);
+    template <typename Merge>
+    void mergeMatches(const Matches& matches, Merge& merge, const std::vector<NodeT*>& discard);
+    Subtree differenceNodes(Subtree a, Subtree b, std::vector<NodeT*>& discard, ThreadPool& pool);
+    static void collect(NodeT* n, std::vector<NodeT*>& out);
+    void destroyAll(const std::vector<NodeT*>& nodes);
+};
+
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+AVLTree<Key, Value, Compare, NodeT, Alloc>::AVLTree(const Compare& comp) :
+    AVLTreeBase<Key, Value, Compare, NodeT, Alloc>(comp)
+{
+
+}
+
+/**
+* Builds the tree from [first, last) with assignSorted(): O(n) for input
+* sorted by key, and every node gets its balance without any rotation.
+* The build has to run here rather than in the base constructor, where
+* postBuild() would not reach AVLTree's override yet.
+*/
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+template<typename InputIt>
+AVLTree<Key, Value, Compare, NodeT, Alloc>::AVLTree(InputIt first, InputIt last, const Compare& comp) :
+    AVLTreeBase<Key, Value, Compare, NodeT, Alloc>(comp)
+{
+    this->assignSorted(first, last);
+}
+
+/*
+ * Recall: If key is already in the tree, you should 
+ * overwrite the current value with the updated value.
+ *
+ * The descent and the overwrite are done by BinarySearchTree::insert;
+ * this is called once the new node n has been attached.
+ */
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+void AVLTree<Key, Value, Compare, NodeT, Alloc>::postInsert(NodeT* n)
+{
+    NodeT *parent = n->getParent();
+    if (parent == nullptr) return; // the new root, balance is already 0
+
+    if (parent->getLeft() == n) // the new node was inserted to the left.
+    {
+        parent->updateBalance(-1); // now heavier to the left
+        BST_TRACE_EVENT(Rebalance, parent, parent->getBalance() + 1, parent->getBalance());
+        // so if it was 1 -> it would be 0
+    }
+    else 
+    {
+        parent->updateBalance(1);
+        BST_TRACE_EVENT(Rebalance, parent, parent->getBalance() - 1, parent->getBalance());
+        // so if it was -1, -> it would be 0
+    }
+
+    if (parent->getBalance() != 0)
+    {
+        insertFix(parent, n);
+    }
+}
+
+/**
+* A built node's balance is known from its subtree heights.
+*/
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+void AVLTree<Key, Value, Compare, NodeT, Alloc>::postBuild(NodeT* n, int balance)
+{
+    n->setBalance(balance);
+}
+
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+void AVLTree<Key, Value, Compare, NodeT, Alloc>::insertFix(NodeT* p, NodeT* n)
+{
+    if (p == nullptr || p->getParent() == nullptr)
+        return;
+
+    NodeT* g = p->getParent();
+
+    if (p == g->getLeft()) 
+    {
+        g->updateBalance(-1);
+        BST_TRACE_EVENT(Rebalance, g, g->getBalance() + 1, g->getBalance());
+
+        switch (g->getBalance()) 
+        {
+            case 0:
+                return;
+            case -1:
+                insertFix(g, p);
+                break;
+            case -2:
+                if (n == p->getLeft())  
+                //ZIGZIG LEFT LEFT
+                {
+                    BST_STATS_COUNT(singleRotations, 1);
+                    rotateRight(g);
+                    settleBalance(p, 0);
+                    settleBalance(g, 0);
+                }
+                else // ZIG ZAG LEFT RIGHT
+                {
+                    BST_STATS_COUNT(doubleRotations, 1);
+                    rotateLeft(p);
+                    rotateRight(g);
+                    int b = n->getBalance();
+                    if (b == -1) 
+                    {
+                        settleBalance(p, 0);
+                        settleBalance(g, 1);
+                    }
+                    else if (b == 0) 
+                    {
+                        settleBalance(p, 0);
+                        settleBalance(g, 0);
+                    }
+                    else 
+                    { // b is 1
+                        settleBalance(p, -1);
+                        settleBalance(g, 0);
+                    }
+
+                    settleBalance(n, 0);
+                }
+                break;
+        }
+    }
+    else 
+    {
+        g->updateBalance(1); // flip for right child
+        BST_TRACE_EVENT(Rebalance, g, g->getBalance() - 1, g->getBalance());
+
+        switch (g->getBalance()) 
+        {
+            case 0:
+                return;
+            case 1:
+                insertFix(g, p);
+                break;
+            case 2:
+                if (n == p->getRight()) 
+                { //RIGHT RIGHT ZIG ZIG
+                    BST_STATS_COUNT(singleRotations, 1);
+                    rotateLeft(g);
+                    settleBalance(p, 0);
+                    settleBalance(g, 0);
+                }
+                else 
+                { // RIGHT LEFT ZIG ZAG
+                    BST_STATS_COUNT(doubleRotations, 1);
+                    rotateRight(p);
+                    rotateLeft(g);
+
+                    int b = n->getBalance();
+                    if (b == 1) 
+                    {
+                        settleBalance(p, 0);
+                        settleBalance(g, -1);
+                    }
+                    else if (b == 0) {
+                        settleBalance(p, 0);
+                        settleBalance(g, 0);
+                    }
+                    else 
+                    {  // -1
+                        settleBalance(p, 1);
+                        settleBalance(g, 0);
+                    }
+
+                    settleBalance(n, 0);
+                }
+                break;
+        }
+    }
+}
+
+
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+void AVLTree<Key, Value, Compare, NodeT, Alloc>::rotateLeft(NodeT* n) 
+{
+    if (n == nullptr || n->getRight() == nullptr) return;
+    BST_TRACE_EVENT(RotateLeft, n, n->getBalance(), n->getRight()->getBalance());
+
+    //take a right child then make it parent (OK)
+    //make the original parent the new left child (OK)
+
+    NodeT *originalGrandparent = n->getParent();
+    NodeT *newParent = n->getRight();
+    NodeT *newParentOriginalLeft = n->getRight()->getLeft();
+
+    n->setParent(newParent); // right child is now the parent
+    newParent->setLeft(n);
+
+    n->setRight(newParentOriginalLeft);
+    if (newParentOriginalLeft != nullptr) newParentOriginalLeft->setParent(n);
+    else Threads<NodeT>::join(n, newParent); // n's successor is now its parent
+
+    newParent->setParent(originalGrandparent);
+    Augmented<NodeT>::update(n);
+    Augmented<NodeT>::update(newParent);
+    
+    if (originalGrandparent != nullptr) 
+    {
+        if (originalGrandparent->getRight() == n) 
+            originalGrandparent->setRight(newParent);
+        else
+            originalGrandparent->setLeft(newParent);
+    }
+    else if (this->root_ == n) // not a detached subtree being split or joined
+    {
+        this->root_ = newParent;
+    }
+}
+
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+void AVLTree<Key, Value, Compare, NodeT, Alloc>::rotateRight(NodeT* n) 
+{
+    if (n == nullptr || n->getLeft() == nullptr) return;
+    BST_TRACE_EVENT(RotateRight, n, n->getBalance(), n->getLeft()->getBalance());
+
+    //take a left child then make it parent
+    //make the original parent the new right child
+
+    NodeT *originalGrandparent = n->getParent();
+    NodeT *newParent = n->getLeft();
+    NodeT *newParentOriginalRight = n->getLeft()->getRight();
+
+    n->setParent(newParent);
+    newParent->setRight(n);
+
+    n->setLeft(newParentOriginalRight);
     if (newParentOriginalRight != nullptr) newParentOriginalRight->setParent(n);
+    else Threads<NodeT>::join(newParent, n); // n's predecessor is now its parent
 
     newParent->setParent(originalGrandparent);
+    Augmented<NodeT>::update(n);
+    Augmented<NodeT>::update(newParent);
 
     if (originalGrandparent != nullptr) 
     {
@@ -371,62 +1194,59 @@ void AVLTree<Key, Value>::rotateRight(AVLNode<Key,Value>* n)
         else
             originalGrandparent->setLeft(newParent);
     }
-    else 
+    else if (this->root_ == n) // not a detached subtree being split or joined
     {
         this->root_ = newParent;
     }
 }
 
+/**
+* Gives n the balance a rotation in insertFix() or removeFix() left it
+* with. The rotation's own event holds the balances before it; this one
+* records n's balance after it.
+*/
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+void AVLTree<Key, Value, Compare, NodeT, Alloc>::settleBalance(NodeT* n, int balance)
+{
+    BST_TRACE_EVENT(Rebalance, n, n->getBalance(), balance);
+    n->setBalance(static_cast<int8_t>(balance));
+}
+
 /*
  * Recall: The writeup specifies that if a node has 2 children you
  * should swap with the predecessor and then remove.
+ * remove() and popMin()/popMax() get here with the node already found.
  */
-template<class Key, class Value>
-void AVLTree<Key, Value>::remove(const Key& key)
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+void AVLTree<Key, Value, Compare, NodeT, Alloc>::removeNode(NodeT* n)
 {
     // TODO
-    AVLNode<Key, Value> *n = static_cast<AVLNode<Key, Value>*>(this->root_);
-
-    while (n != nullptr) 
-    {
-        if (key == n->getKey()) 
-            break; // found!
-        else if (key < n->getKey())
-            n = n->getLeft();
-        else n = n->getRight();
-    }
-
     if (n == nullptr) return; //failed to find one.
+    BST_TRACE_EVENT(Remove, n, n->getBalance(), n->getBalance());
 
-    //std::cout << "removing node: " << n->getKey() << std::endl;
+    typename BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::Gap gap = this->beforeUnlink(n);
 
     int diff = 0;
 
     if (n->getLeft() != nullptr && n->getRight() != nullptr) //case with 2 children
     {
-        AVLNode<Key, Value>* replacement = static_cast<AVLNode<Key, Value>*>(this->predecessor(n));
+        NodeT* replacement = this->predecessor(n);
 
         nodeSwap(replacement, n);
     }
     // now the node is going to be have only one child or none
 
-    AVLNode<Key, Value> *p = n->getParent();
+    NodeT *p = n->getParent();
 
     if (p != nullptr) 
     {
         if (p->getLeft() == n) // the node to be deleted is on the left
         {
             diff = 1;
-            //std::cout << "the node to be deleted is on the left!" << std::endl;
         }
         else if (p->getRight() == n) // the node to be deleted is on the right
         {
             diff = -1;
-            //std::cout << "the node to be deleted is on the right!" << std::endl;
-        }
-        else 
-        {
-            std::cout << "n is not a child of p!" << std::endl;
         }
     }
 
@@ -453,7 +1273,6 @@ void AVLTree<Key, Value>::remove(const Key& key)
                 p->setRight(n->getLeft());
                 n->getLeft()->setParent(p);
             }
-            else std::cout << "UNEXPECTED BEHAVIOUR" << std::endl;
         }
     }
     else if (n->getRight() != nullptr) 
@@ -476,7 +1295,6 @@ void AVLTree<Key, Value>::remove(const Key& key)
                 p->setRight(n->getRight());
                 n->getRight()->setParent(p);
             }
-            else std::cout << "UNEXPECTED BEHAVIOUR" << std::endl;
         }
     }
     else // no children of n
@@ -489,56 +1307,39 @@ void AVLTree<Key, Value>::remove(const Key& key)
         {
             if (diff == 1) // n is a left child
             {
-                //std::cout << "yup it's right" << std::endl;
                 p->setLeft(nullptr);
             }
             else if (diff == -1) 
             {
-                //std::cout << "yup it's left" << std::endl;
                 p->setRight(nullptr);
             }
-            else std::cout << "UNEXPECTED BEHAVIOUR" << std::endl;
             
         }
     }
 
-    delete n;
+    this->afterUnlink(gap, p);
+    this->destroyNode(n);
 
 
     if (p != nullptr) 
     {
-        //p->updateBalance(diff);
-
-        //std::cout << "balance of P: " << static_cast<int>(p->getBalance()) << std::endl;
-        //std::cout << "p is " << static_cast<int>(p->getKey()) << std::endl;
-
-        //TODO here if?
-
-        //if (p->getBalance > 1 && p->getBalance > 1)
-
         removeFix(p, diff);
-        showBalanceOfAll(); //DEBUG
-
     }
 }
 
 
 
-template<class Key, class Value>
-void AVLTree<Key, Value>::removeFix( AVLNode<Key,Value>* n, int diff)
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+void AVLTree<Key, Value, Compare, NodeT, Alloc>::removeFix( NodeT* n, int diff)
 {
     // TODO
-    if (n == nullptr) return;
-
-
-    //std::cout << "balance Before: " << static_cast<int>(n->getBalance()) << std::endl;
-    //std::cout << "Diff to add is " << diff << std::endl;
+    if (n == nullptr) return;
 
     n->updateBalance(diff);
-    //std::cout << "node balance after: " << static_cast<int>(n->getBalance()) << std::endl;
+    BST_TRACE_EVENT(Rebalance, n, n->getBalance() - diff, n->getBalance());
 
-    AVLNode<Key, Value> *p = n->getParent(); 
-    int ndiff;
+    NodeT *p = n->getParent(); 
+    int ndiff = 0;
 
     if (p != nullptr) 
     {
@@ -547,55 +1348,50 @@ void AVLTree<Key, Value>::removeFix( AVLNode<Key,Value>* n, int diff)
         else ndiff = -1;
     }
 
-    //std::cout << "balance after: " << static_cast<int>(n->getBalance()) << std::endl;
-    
-    //std::cout << "n is " << n->getKey() << std::endl;
-
     if (n->getBalance() <= -2) // its left heavy 
     {
-        AVLNode<Key, Value> *c = n->getLeft(); 
+        NodeT *c = n->getLeft(); 
 
         if (c->getBalance() == -1) //zig zig LEFT LEFT
         {
-            std::cout << "LL" << std::endl;
+            BST_STATS_COUNT(singleRotations, 1);
             rotateRight(n);
-            n->setBalance(0);
-            c->setBalance(0);
+            settleBalance(n, 0);
+            settleBalance(c, 0);
             removeFix(p, ndiff);
         }
         else if (c->getBalance() == 0) 
         {
-            //std::cout << "LL" << std::endl;
+            BST_STATS_COUNT(singleRotations, 1);
             rotateRight(n);
-            n->setBalance(-1);
-            c->setBalance(1); //DONE
+            settleBalance(n, -1);
+            settleBalance(c, 1); //DONE
         }
         else if (c->getBalance() == 1) // LEFT RIGHT
         {
+            NodeT *g = c->getRight(); //taller child of n
 
-            //std::cout << "LR" << std::endl;
-            AVLNode<Key, Value> *g = c->getRight(); //taller child of n
-
+            BST_STATS_COUNT(doubleRotations, 1);
             rotateLeft(c);
             rotateRight(n);
 
             if (g->getBalance() == 1) 
             {
-                n->setBalance(0);
-                c->setBalance(-1);
+                settleBalance(n, 0);
+                settleBalance(c, -1);
             }
             else if (g->getBalance() == 0) 
             {
-                n->setBalance(0);
-                c->setBalance(0);
+                settleBalance(n, 0);
+                settleBalance(c, 0);
             }
             else // -1
             {
-                n->setBalance(1);
-                c->setBalance(0);
+                settleBalance(n, 1);
+                settleBalance(c, 0);
             }
 
-            g->setBalance(0);
+            settleBalance(g, 0);
             removeFix(p, ndiff);
         }
     }
@@ -614,101 +1410,841 @@ void AVLTree<Key, Value>::removeFix( AVLNode<Key,Value>* n, int diff)
     }
     else if (n->getBalance() >= 2) // it's right heavy 
     {
-        AVLNode<Key, Value> *c = n->getRight();
-        
-        //std::cout << "balance of c: " << static_cast<int>(c->getBalance()) << std::endl;
+        NodeT *c = n->getRight();
 
         if (c->getBalance() == 1) //zig zig RIGHT RIGHT
         {
-
-            //std::cout << "RR" << std::endl;
-
+            BST_STATS_COUNT(singleRotations, 1);
             rotateLeft(n);
-            n->setBalance(0);
-            c->setBalance(0);
-
-            //showBalanceOfAll(); //TEMP DEBUG
-            //this->print();
+            settleBalance(n, 0);
+            settleBalance(c, 0);
 
             removeFix(p, ndiff);
-
         }
         else if (c->getBalance() == 0)  
         {
-            //std::cout << "RR" << std::endl;
-
+            BST_STATS_COUNT(singleRotations, 1);
             rotateLeft(n);
-            n->setBalance(1);
-            c->setBalance(-1); //DONE
+            settleBalance(n, 1);
+            settleBalance(c, -1); //DONE
         }
         else if (c->getBalance() == -1)
         {
-            //this->print();
-            //showBalanceOfAll();
-
-            // BEFORE 43 got changed, lets check the status
-            //std::cout << "RL" << std::endl;
-
-            AVLNode<Key, Value> *g = c->getLeft(); //taller child of n
+            NodeT *g = c->getLeft(); //taller child of n
 
+            BST_STATS_COUNT(doubleRotations, 1);
             rotateRight(c);
             rotateLeft(n);
 
-            // LETS QUICKY CHECK WHAT N , G, C are
-            /*
-            std::cout << "N " << n->getKey() << std::endl;
-            std::cout << "G " << g->getKey() << std::endl;
-            std::cout << "C " << c->getKey() << std::endl;
-            */
             if (g->getBalance() == 1) 
             {
-                n->setBalance(-1); //ok so this is wrong
-                c->setBalance(0);
-
-                //std::cout << "N " << n->getKey() << std::endl;
+                settleBalance(n, -1);
+                settleBalance(c, 0);
             }
             else if (g->getBalance() == 0) 
             {
-                n->setBalance(0);
-                c->setBalance(0);
+                settleBalance(n, 0);
+                settleBalance(c, 0);
             }
             else if (g->getBalance() == -1) 
             {
-                n->setBalance(0);
-                c->setBalance(1);
+                settleBalance(n, 0);
+                settleBalance(c, 1);
             }
 
-            g->setBalance(0);
+            settleBalance(g, 0);
             removeFix(p, ndiff);
         }
     }
 }
 
-template<class Key, class Value>
-void AVLTree<Key, Value>::nodeSwap( AVLNode<Key,Value>* n1, AVLNode<Key,Value>* n2)
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+void AVLTree<Key, Value, Compare, NodeT, Alloc>::nodeSwap( NodeT* n1, NodeT* n2)
 {
-    BinarySearchTree<Key, Value>::nodeSwap(n1, n2);
+    BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::nodeSwap(n1, n2);
     int8_t tempB = n1->getBalance();
     n1->setBalance(n2->getBalance());
     n2->setBalance(tempB);
 }
 
-template<class Key, class Value>
-void AVLTree<Key, Value>::showBalanceOfAll() 
+/**
+* Moves every item whose key is not less than key into right, which must
+* be another, empty tree; this tree keeps the keys below key. O(log n).
+*
+* No node is copied: the two trees end up sharing their allocators'
+* storage (see share() in node_pool.h), so right must use the same
+* Compare and a non-relocatable allocator. Iterators into this tree are
+* invalidated.
+*/
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+void AVLTree<Key, Value, Compare, NodeT, Alloc>::split(const Key& key, AVLTree& right)
+{
+    static_assert(!Alloc::relocatable, "split() moves nodes between trees, which a relocatable allocator cannot do");
+    if (&right == this || !right.empty()) throw std::invalid_argument("split: the target must be another, empty tree");
+
+    this->alloc_.share(right.alloc_);
+
+    Subtree whole = { this->root_, heightOf(this->root_) };
+    Subtree below, above;
+    NodeT* match = splitNodes(whole, key, below, above);
+    if (match != NULL)
+    {
+        NodeT* next = this->findMinInternal(above.root);
+        Subtree none = { NULL, 0 };
+        above = joinNodes(none, match, above);
+        Threads<NodeT>::join(match, next);
+    }
+
+    adopt(below);
+    right.adopt(above);
+}
+
+/**
+* Moves every item of right to the end of this tree, leaving right empty.
+* Every key in right must be greater than every key here, otherwise
+* std::invalid_argument is thrown and neither tree changes. O(log n),
+* with the same conditions on right as split().
+*/
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+void AVLTree<Key, Value, Compare, NodeT, Alloc>::join(AVLTree& right)
+{
+    static_assert(!Alloc::relocatable, "join() moves nodes between trees, which a relocatable allocator cannot do");
+    if (&right == this) throw std::invalid_argument("join: cannot join a tree with itself");
+    if (right.empty()) return;
+    if (!this->empty() && !this->comp_(this->rightmost_->getKey(), right.leftmost_->getKey()))
+        throw std::invalid_argument("join: keys of the right tree must come after this tree's");
+
+    this->alloc_.share(right.alloc_);
+
+    Subtree left = { this->root_, heightOf(this->root_) };
+    Subtree rest = { right.root_, heightOf(right.root_) };
+    Subtree none = { NULL, 0 };
+    right.adopt(none);
+    adopt(joinNodes(left, rest));
+}
+
+/**
+* Same as join(right), with the item pivot placed between the two trees;
+* its key must be greater than every key here and less than every key in
+* right. Cheaper than join(right), which has to take its pivot out of
+* this tree first.
+*/
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+void AVLTree<Key, Value, Compare, NodeT, Alloc>::join(const std::pair<const Key, Value>& pivot, AVLTree& right)
+{
+    static_assert(!Alloc::relocatable, "join() moves nodes between trees, which a relocatable allocator cannot do");
+    if (&right == this) throw std::invalid_argument("join: cannot join a tree with itself");
+    if ((!this->empty() && !this->comp_(this->rightmost_->getKey(), pivot.first)) ||
+        (!right.empty() && !this->comp_(pivot.first, right.leftmost_->getKey())))
+        throw std::invalid_argument("join: the pivot must sit between the two trees' keys");
+
+    this->alloc_.share(right.alloc_);
+
+    NodeT* middle = this->createNode(NULL, pivot);
+    NodeT* before = this->rightmost_;
+    NodeT* after = right.leftmost_;
+
+    Subtree left = { this->root_, heightOf(this->root_) };
+    Subtree rest = { right.root_, heightOf(right.root_) };
+    Subtree none = { NULL, 0 };
+    right.adopt(none);
+    Subtree joined = joinNodes(left, middle, rest);
+    Threads<NodeT>::join(before, middle);
+    Threads<NodeT>::join(middle, after);
+    adopt(joined);
+}
+
+/**
+* The height of the subtree at n, 0 for NULL, read off the balances on
+* the way down its taller side. O(h).
+*/
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+int AVLTree<Key, Value, Compare, NodeT, Alloc>::heightOf(const NodeT* n)
+{
+    int height = 0;
+    for (; n != NULL; ++height) n = n->getBalance() < 0 ? n->getLeft() : n->getRight();
+    return height;
+}
+
+/**
+* The height of n's left or right subtree, given the height of n's.
+*/
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+int AVLTree<Key, Value, Compare, NodeT, Alloc>::childHeight(const NodeT* n, int height, bool right)
+{
+    bool shorter = right ? n->getBalance() < 0 : n->getBalance() > 0;
+    return shorter ? height - 2 : height - 1;
+}
+
+/**
+* Joins two detached AVL subtrees and the node pivot between them, every
+* key in left being less than pivot's and every key in right greater,
+* into one detached AVL subtree. O(|left.height - right.height| + 1).
+*
+* The shorter side is hung off the spine of the taller one at the point
+* where the heights match, and the spine is rebalanced on the way back.
+* Threads between the pieces and pivot are left to the caller.
+*/
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+typename AVLTree<Key, Value, Compare, NodeT, Alloc>::Subtree
+AVLTree<Key, Value, Compare, NodeT, Alloc>::joinNodes(Subtree left, NodeT* pivot, Subtree right)
+{
+    if (left.root != NULL) left.root->setParent(NULL);
+    if (right.root != NULL) right.root->setParent(NULL);
+
+    Subtree joined;
+    if (left.height > right.height + 1) joined = joinRight(left, pivot, right);
+    else if (right.height > left.height + 1) joined = joinLeft(left, pivot, right);
+    else joined = link(left, pivot, right);
+
+    joined.root->setParent(NULL);
+    return joined;
+}
+
+/**
+* Joins two detached subtrees without a pivot, by taking left's last node
+* out to serve as one. O(log n).
+*/
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+typename AVLTree<Key, Value, Compare, NodeT, Alloc>::Subtree
+AVLTree<Key, Value, Compare, NodeT, Alloc>::joinNodes(Subtree left, Subtree right)
+{
+    if (left.root == NULL)
+    {
+        if (right.root != NULL) right.root->setParent(NULL);
+        return right;
+    }
+
+    NodeT* after = this->findMinInternal(right.root);
+    NodeT* last;
+    Subtree rest = splitLast(left, last);
+    NodeT* before = rest.root;
+    while (before != NULL && before->getRight() != NULL) before = before->getRight();
+
+    Subtree joined = joinNodes(rest, last, right);
+    Threads<NodeT>::join(before, last);
+    Threads<NodeT>::join(last, after);
+    return joined;
+}
+
+/**
+* joinNodes() for a left side more than one taller than the right: walks
+* down left's right spine to a node no more than one taller than right,
+* puts pivot in its place with both below it, then climbs back fixing
+* balances. Unlike after an insert, a rotation on the way up does not
+* always stop the growth, so every level returns its new height.
+*/
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+typename AVLTree<Key, Value, Compare, NodeT, Alloc>::Subtree
+AVLTree<Key, Value, Compare, NodeT, Alloc>::joinRight(Subtree left, NodeT* pivot, Subtree right)
+{
+    NodeT* n = left.root;
+    int nLeft = childHeight(n, left.height, false);
+    Subtree spine = { n->getRight(), childHeight(n, left.height, true) };
+
+    Subtree t;
+    if (spine.height <= right.height + 1)
+    {
+        t = link(spine, pivot, right);
+        if (spine.root == NULL) Threads<NodeT>::join(n, pivot); // n comes right before pivot
+    }
+    else
+    {
+        t = joinRight(spine, pivot, right);
+    }
+
+    n->setRight(t.root);
+    t.root->setParent(n);
+
+    if (t.height <= nLeft + 1)
+    {
+        n->setBalance(t.height - nLeft);
+        Augmented<NodeT>::update(n);
+        Subtree joined = { n, std::max(nLeft, t.height) + 1 };
+        return joined;
+    }
+
+    // t is two taller than n's left subtree
+    NodeT* s = t.root;
+    int sLeft = childHeight(s, t.height, false);
+    int sRight = childHeight(s, t.height, true);
+
+    if (sLeft <= sRight)
+    {
+        rotateLeft(n);
+        n->setBalance(sLeft - nLeft);
+        int nHeight = std::max(nLeft, sLeft) + 1;
+        s->setBalance(sRight - nHeight);
+        Subtree joined = { s, std::max(nHeight, sRight) + 1 };
+        return joined;
+    }
+
+    NodeT* g = s->getLeft();
+    int gLeft = childHeight(g, sLeft, false);
+    int gRight = childHeight(g, sLeft, true);
+
+    rotateRight(s);
+    rotateLeft(n);
+    n->setBalance(gLeft - nLeft);
+    s->setBalance(sRight - gRight);
+    int nHeight = std::max(nLeft, gLeft) + 1;
+    int sHeight = std::max(gRight, sRight) + 1;
+    g->setBalance(sHeight - nHeight);
+    Subtree joined = { g, std::max(nHeight, sHeight) + 1 };
+    return joined;
+}
+
+/**
+* The mirror image of joinRight(), for a right side more than one taller
+* than the left: pivot goes in along right's left spine.
+*/
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+typename AVLTree<Key, Value, Compare, NodeT, Alloc>::Subtree
+AVLTree<Key, Value, Compare, NodeT, Alloc>::joinLeft(Subtree left, NodeT* pivot, Subtree right)
+{
+    NodeT* n = right.root;
+    int nRight = childHeight(n, right.height, true);
+    Subtree spine = { n->getLeft(), childHeight(n, right.height, false) };
+
+    Subtree t;
+    if (spine.height <= left.height + 1)
+    {
+        t = link(left, pivot, spine);
+        if (spine.root == NULL) Threads<NodeT>::join(pivot, n); // n comes right after pivot
+    }
+    else
+    {
+        t = joinLeft(left, pivot, spine);
+    }
+
+    n->setLeft(t.root);
+    t.root->setParent(n);
+
+    if (t.height <= nRight + 1)
+    {
+        n->setBalance(nRight - t.height);
+        Augmented<NodeT>::update(n);
+        Subtree joined = { n, std::max(nRight, t.height) + 1 };
+        return joined;
+    }
+
+    // t is two taller than n's right subtree
+    NodeT* s = t.root;
+    int sLeft = childHeight(s, t.height, false);
+    int sRight = childHeight(s, t.height, true);
+
+    if (sRight <= sLeft)
+    {
+        rotateRight(n);
+        n->setBalance(nRight - sRight);
+        int nHeight = std::max(sRight, nRight) + 1;
+        s->setBalance(nHeight - sLeft);
+        Subtree joined = { s, std::max(sLeft, nHeight) + 1 };
+        return joined;
+    }
+
+    NodeT* g = s->getRight();
+    int gLeft = childHeight(g, sRight, false);
+    int gRight = childHeight(g, sRight, true);
+
+    rotateLeft(s);
+    rotateRight(n);
+    s->setBalance(gLeft - sLeft);
+    n->setBalance(nRight - gRight);
+    int sHeight = std::max(sLeft, gLeft) + 1;
+    int nHeight = std::max(gRight, nRight) + 1;
+    g->setBalance(nHeight - sHeight);
+    Subtree joined = { g, std::max(sHeight, nHeight) + 1 };
+    return joined;
+}
+
+/**
+* Makes left and right pivot's children; their heights differ by at most
+* one. A link that already holds the right child is not rewritten, so a
+* threaded node keeps the thread it has where the side stays empty.
+*/
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+typename AVLTree<Key, Value, Compare, NodeT, Alloc>::Subtree
+AVLTree<Key, Value, Compare, NodeT, Alloc>::link(Subtree left, NodeT* pivot, Subtree right)
+{
+    if (pivot->getLeft() != left.root) pivot->setLeft(left.root);
+    if (pivot->getRight() != right.root) pivot->setRight(right.root);
+    if (left.root != NULL) left.root->setParent(pivot);
+    if (right.root != NULL) right.root->setParent(pivot);
+
+    pivot->setBalance(right.height - left.height);
+    Augmented<NodeT>::update(pivot);
+    Subtree joined = { pivot, std::max(left.height, right.height) + 1 };
+    return joined;
+}
+
+/**
+* Splits the detached subtree t into the keys less than key (left) and
+* the keys greater (right), both detached AVL subtrees. Returns the node
+* holding key itself, unlinked from both, or NULL. O(h): one join per
+* level on the way back up, and their costs telescope.
+*
+* Threads at the two cut ends are left to the caller; every other thread
+* still points at the right node.
+*/
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+NodeT* AVLTree<Key, Value, Compare, NodeT, Alloc>::splitNodes(Subtree t, const Key& key, Subtree& left, Subtree& right)
+{
+    if (t.root == NULL)
+    {
+        left = t;
+        right = t;
+        return NULL;
+    }
+
+    NodeT* n = t.root;
+    Subtree l = { n->getLeft(), childHeight(n, t.height, false) };
+    Subtree r = { n->getRight(), childHeight(n, t.height, true) };
+    if (l.root != NULL) l.root->setParent(NULL);
+    if (r.root != NULL) r.root->setParent(NULL);
+
+    if (this->comp_(key, n->getKey()))
+    {
+        Subtree between;
+        NodeT* match = splitNodes(l, key, left, between);
+        right = joinNodes(between, n, r);
+        return match;
+    }
+    if (this->comp_(n->getKey(), key))
+    {
+        Subtree between;
+        NodeT* match = splitNodes(r, key, between, right);
+        left = joinNodes(l, n, between);
+        return match;
+    }
+
+    left = l;
+    right = r;
+    return n;
+}
+
+/**
+* Takes the node with the largest key out of the detached subtree t and
+* returns it in last, along with what remains of t. O(h).
+*/
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+typename AVLTree<Key, Value, Compare, NodeT, Alloc>::Subtree
+AVLTree<Key, Value, Compare, NodeT, Alloc>::splitLast(Subtree t, NodeT*& last)
+{
+    NodeT* n = t.root;
+    Subtree l = { n->getLeft(), childHeight(n, t.height, false) };
+    if (l.root != NULL) l.root->setParent(NULL);
+
+    if (n->getRight() == NULL)
+    {
+        last = n;
+        return l;
+    }
+
+    Subtree r = { n->getRight(), childHeight(n, t.height, true) };
+    r.root->setParent(NULL);
+    return joinNodes(l, n, splitLast(r, last));
+}
+
+/**
+* Makes the detached subtree t the whole tree, finding its first and last
+* nodes again and cutting their outer threads. O(h).
+*/
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+void AVLTree<Key, Value, Compare, NodeT, Alloc>::adopt(Subtree t)
 {
-    int i = 1;
-    for (typename AVLTree<Key, Value>::iterator it = this->begin(); it != this->end(); ++it) 
+    this->root_ = t.root;
+    if (t.root != NULL) t.root->setParent(NULL);
+
+    this->leftmost_ = this->findMinInternal(t.root);
+    this->rightmost_ = t.root;
+    while (this->rightmost_ != NULL && this->rightmost_->getRight() != NULL)
+        this->rightmost_ = this->rightmost_->getRight();
+
+    Threads<NodeT>::join(NULL, this->leftmost_);
+    Threads<NodeT>::join(this->rightmost_, NULL);
+}
+
+/**
+* Removes every item with lo <= key < hi and returns how many there
+* were. O(k + log n) for k items removed, against O(k log n) for a
+* remove() per key: the range is split off in one piece, the two sides
+* are joined back, and the nodes in between are freed without any
+* rebalancing. Iterators to the removed items are invalidated.
+*/
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+std::size_t AVLTree<Key, Value, Compare, NodeT, Alloc>::eraseRange(const Key& lo, const Key& hi)
+{
+    if (!this->comp_(lo, hi)) return 0;
+    return eraseFrom(lo, &hi);
+}
+
+/**
+* Removes the items in [first, last) and returns an iterator to last, in
+* the same time as eraseRange().
+*/
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+typename BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::iterator
+AVLTree<Key, Value, Compare, NodeT, Alloc>::erase(
+    typename BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::const_iterator first,
+    typename BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::const_iterator last)
+{
+    if (last == this->end())
+    {
+        if (first != last) eraseFrom(first->first, NULL);
+        return this->end();
+    }
+
+    // last's node stays put, so its key can bound the range while it is split
+    NodeT* kept = this->nodeAt(last);
+    const Key& hi = last->first;
+    if (first != last) eraseFrom(first->first, &hi);
+    return this->iteratorTo(kept);
+}
+
+/**
+* eraseRange() helper: removes the keys from lo up to, but not including,
+* *hi, or up to the end when hi is NULL.
+*/
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+std::size_t AVLTree<Key, Value, Compare, NodeT, Alloc>::eraseFrom(const Key& lo, const Key* hi)
+{
+    Subtree whole = { this->root_, heightOf(this->root_) };
+    Subtree below, middle, above = { NULL, 0 };
+    NodeT* first = splitNodes(whole, lo, below, middle);
+
+    if (hi != NULL)
+    {
+        Subtree rest = middle;
+        NodeT* end = splitNodes(rest, *hi, middle, above);
+        if (end != NULL) // hi itself stays
+        {
+            NodeT* next = this->findMinInternal(above.root);
+            Subtree none = { NULL, 0 };
+            above = joinNodes(none, end, above);
+            Threads<NodeT>::join(end, next);
+        }
+    }
+
+    // The tree is whole again before anything is freed
+    adopt(joinNodes(below, above));
+    std::size_t erased = destroySubtree(middle.root);
+    if (first != NULL) {
+        this->destroyNode(first);
+        ++erased;
+    }
+    return erased;
+}
+
+/**
+* Destroys every node of the detached subtree at n, children first, and
+* returns how many there were. Allocates nothing, so it cannot fail
+* halfway; the recursion is as deep as the subtree is tall.
+*/
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+std::size_t AVLTree<Key, Value, Compare, NodeT, Alloc>::destroySubtree(NodeT* n)
+{
+    if (n == NULL) return 0;
+    std::size_t erased = destroySubtree(n->getLeft()) + destroySubtree(n->getRight());
+    this->destroyNode(n);
+    return erased + 1;
+}
+
+/**
+* Adds every item of other to this tree, leaving other empty. Where both
+* trees hold a key, the value becomes merge(this value, other's value),
+* e.g. std::plus<Value>() to add counts up.
+*
+* Work is O(m log(n/m + 1)) for trees of m <= n items, against
+* O(m log n) for inserting one into the other: each node of one tree
+* splits the other, and the halves are merged recursively and joined
+* back. The two halves are independent, so large ones run in parallel on
+* pool. No node is copied, so other must share storage with this tree on
+* the same terms as for join().
+*
+* merge is only called once the trees have been rearranged, on the
+* calling thread, so it need not be thread safe. If it throws, this tree
+* still holds every key, those not merged yet with this tree's value,
+* and other is left empty.
+*/
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+template<typename Merge>
+void AVLTree<Key, Value, Compare, NodeT, Alloc>::unionWith(AVLTree& other, Merge merge, ThreadPool& pool)
+{
+    static_assert(!Alloc::relocatable, "unionWith() moves nodes between trees, which a relocatable allocator cannot do");
+    if (&other == this) throw std::invalid_argument("unionWith: cannot merge a tree with itself");
+
+    this->alloc_.share(other.alloc_);
+
+    Subtree mine = { this->root_, heightOf(this->root_) };
+    Subtree theirs = { other.root_, heightOf(other.root_) };
+    Subtree none = { NULL, 0 };
+    this->root_ = NULL;
+    other.adopt(none);
+
+    std::vector<NodeT*> discard;
+    Matches matches;
+    adopt(unionNodes(mine, theirs, matches, discard, pool));
+    mergeMatches(matches, merge, discard);
+}
+
+/**
+* Keeps only the keys that are in both trees, with value merge(this
+* value, other's value), and leaves other empty. Same costs and
+* conditions as unionWith().
+*/
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+template<typename Merge>
+void AVLTree<Key, Value, Compare, NodeT, Alloc>::intersectWith(AVLTree& other, Merge merge, ThreadPool& pool)
+{
+    static_assert(!Alloc::relocatable, "intersectWith() moves nodes between trees, which a relocatable allocator cannot do");
+    if (&other == this) throw std::invalid_argument("intersectWith: cannot merge a tree with itself");
+
+    this->alloc_.share(other.alloc_);
+
+    Subtree mine = { this->root_, heightOf(this->root_) };
+    Subtree theirs = { other.root_, heightOf(other.root_) };
+    Subtree none = { NULL, 0 };
+    this->root_ = NULL;
+    other.adopt(none);
+
+    std::vector<NodeT*> discard;
+    Matches matches;
+    adopt(intersectNodes(mine, theirs, matches, discard, pool));
+    mergeMatches(matches, merge, discard);
+}
+
+/**
+* Removes every key that is also in other, which is only read. Same work
+* bound as unionWith(), and parallel on pool in the same way; nothing
+* moves between the trees, so any allocator will do.
+*/
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+void AVLTree<Key, Value, Compare, NodeT, Alloc>::differenceWith(const AVLTree& other, ThreadPool& pool)
+{
+    if (&other == this)
+    {
+        this->clear();
+        return;
+    }
+
+    Subtree mine = { this->root_, heightOf(this->root_) };
+    Subtree theirs = { other.root_, heightOf(other.root_) };
+    this->root_ = NULL;
+
+    std::vector<NodeT*> discard;
+    adopt(differenceNodes(mine, theirs, discard, pool));
+    destroyAll(discard);
+}
+
+/**
+* Gives each node that stays in a union or intersection the value
+* merge(its value, its match's value), then frees discard, which holds
+* the matches. Runs after the tree is whole again, so that a throwing
+* merge leaves nothing detached: discard is freed all the same.
+*/
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+template<typename Merge>
+void AVLTree<Key, Value, Compare, NodeT, Alloc>::mergeMatches(const Matches& matches, Merge& merge,
+                                                              const std::vector<NodeT*>& discard)
+{
+    try
     {
-        // Find the node corresponding to the key
-        Node<Key, Value>* baseNode = this->internalFind(it->first);
-        AVLNode<Key, Value>* avlNode = dynamic_cast<AVLNode<Key, Value>*>(baseNode);
-        if (avlNode != nullptr) 
+        for (std::size_t i = 0; i < matches.size(); ++i)
         {
-            std::cout << " [" << i << "] -> " << static_cast<int>(avlNode->getBalance());
+            NodeT* kept = matches[i].first;
+            kept->getValue() = merge(kept->getValue(), matches[i].second->getValue());
+            this->refreshValue(kept);
         }
-        i++;
     }
-    std::cout << std::endl;
+    catch (...)
+    {
+        destroyAll(discard);
+        throw;
+    }
+    destroyAll(discard);
+}
+
+/**
+* joinNodes() for pieces that were not next to each other before, as in
+* the set operations: the threads across both seams are redone too,
+* which costs a walk down each side.
+*/
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+typename AVLTree<Key, Value, Compare, NodeT, Alloc>::Subtree
+AVLTree<Key, Value, Compare, NodeT, Alloc>::joinStitched(Subtree left, NodeT* pivot, Subtree right)
+{
+    if (!HasThreads<NodeT>::value) return joinNodes(left, pivot, right);
+
+    NodeT* before = left.root;
+    while (before != NULL && before->getRight() != NULL) before = before->getRight();
+    NodeT* after = this->findMinInternal(right.root);
+
+    Subtree joined = joinNodes(left, pivot, right);
+    Threads<NodeT>::join(before, pivot);
+    Threads<NodeT>::join(pivot, after);
+    return joined;
+}
+
+/**
+* The union of two detached subtrees: a's root splits b, and the two
+* sides are merged on their own before being joined around it. Nodes of
+* b whose key a already has are paired with a's node in matches and left
+* in discard for the caller to free, since the allocator is not shared
+* between the tasks.
+*/
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+typename AVLTree<Key, Value, Compare, NodeT, Alloc>::Subtree
+AVLTree<Key, Value, Compare, NodeT, Alloc>::unionNodes(Subtree a, Subtree b, Matches& matches,
+                                                       std::vector<NodeT*>& discard, ThreadPool& pool)
+{
+    if (b.root == NULL) return a;
+    if (a.root == NULL) return b;
+
+    NodeT* n = a.root;
+    Subtree aLeft = { n->getLeft(), childHeight(n, a.height, false) };
+    Subtree aRight = { n->getRight(), childHeight(n, a.height, true) };
+    if (aLeft.root != NULL) aLeft.root->setParent(NULL);
+    if (aRight.root != NULL) aRight.root->setParent(NULL);
+
+    Subtree bLeft, bRight;
+    NodeT* match = splitNodes(b, n->getKey(), bLeft, bRight);
+    if (match != NULL)
+    {
+        matches.push_back(std::make_pair(n, match));
+        discard.push_back(match);
+    }
+
+    Subtree left, right;
+    if (std::min(a.height, b.height) >= forkHeight)
+    {
+        Matches matchesRight;
+        std::vector<NodeT*> discardRight;
+        pool.invoke([&]() { left = unionNodes(aLeft, bLeft, matches, discard, pool); },
+                    [&]() { right = unionNodes(aRight, bRight, matchesRight, discardRight, pool); });
+        matches.insert(matches.end(), matchesRight.begin(), matchesRight.end());
+        discard.insert(discard.end(), discardRight.begin(), discardRight.end());
+    }
+    else
+    {
+        left = unionNodes(aLeft, bLeft, matches, discard, pool);
+        right = unionNodes(aRight, bRight, matches, discard, pool);
+    }
+
+    return joinStitched(left, n, right);
+}
+
+/**
+* The intersection of two detached subtrees, along the same lines as
+* unionNodes(). Every node that does not make it, from either side, goes
+* to discard.
+*/
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+typename AVLTree<Key, Value, Compare, NodeT, Alloc>::Subtree
+AVLTree<Key, Value, Compare, NodeT, Alloc>::intersectNodes(Subtree a, Subtree b, Matches& matches,
+                                                           std::vector<NodeT*>& discard, ThreadPool& pool)
+{
+    if (a.root == NULL || b.root == NULL)
+    {
+        collect(a.root, discard);
+        collect(b.root, discard);
+        Subtree none = { NULL, 0 };
+        return none;
+    }
+
+    NodeT* n = a.root;
+    Subtree aLeft = { n->getLeft(), childHeight(n, a.height, false) };
+    Subtree aRight = { n->getRight(), childHeight(n, a.height, true) };
+    if (aLeft.root != NULL) aLeft.root->setParent(NULL);
+    if (aRight.root != NULL) aRight.root->setParent(NULL);
+
+    Subtree bLeft, bRight;
+    NodeT* match = splitNodes(b, n->getKey(), bLeft, bRight);
+
+    Subtree left, right;
+    if (std::min(a.height, b.height) >= forkHeight)
+    {
+        Matches matchesRight;
+        std::vector<NodeT*> discardRight;
+        pool.invoke([&]() { left = intersectNodes(aLeft, bLeft, matches, discard, pool); },
+                    [&]() { right = intersectNodes(aRight, bRight, matchesRight, discardRight, pool); });
+        matches.insert(matches.end(), matchesRight.begin(), matchesRight.end());
+        discard.insert(discard.end(), discardRight.begin(), discardRight.end());
+    }
+    else
+    {
+        left = intersectNodes(aLeft, bLeft, matches, discard, pool);
+        right = intersectNodes(aRight, bRight, matches, discard, pool);
+    }
+
+    if (match == NULL)
+    {
+        discard.push_back(n);
+        return joinNodes(left, right);
+    }
+
+    matches.push_back(std::make_pair(n, match));
+    discard.push_back(match);
+    return joinStitched(left, n, right);
+}
+
+/**
+* The detached subtree a without the keys found in b. b belongs to
+* another tree and is only read: its root splits a, and the pieces
+* either side lose what b's children hold before being joined again.
+*/
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+typename AVLTree<Key, Value, Compare, NodeT, Alloc>::Subtree
+AVLTree<Key, Value, Compare, NodeT, Alloc>::differenceNodes(Subtree a, Subtree b, std::vector<NodeT*>& discard,
+                                                            ThreadPool& pool)
+{
+    if (a.root == NULL || b.root == NULL) return a;
+
+    NodeT* n = b.root;
+    Subtree bLeft = { n->getLeft(), childHeight(n, b.height, false) };
+    Subtree bRight = { n->getRight(), childHeight(n, b.height, true) };
+
+    Subtree aLeft, aRight;
+    NodeT* match = splitNodes(a, n->getKey(), aLeft, aRight);
+    if (match != NULL) discard.push_back(match);
+
+    Subtree left, right;
+    if (std::min(a.height, b.height) >= forkHeight)
+    {
+        std::vector<NodeT*> discardRight;
+        pool.invoke([&]() { left = differenceNodes(aLeft, bLeft, discard, pool); },
+                    [&]() { right = differenceNodes(aRight, bRight, discardRight, pool); });
+        discard.insert(discard.end(), discardRight.begin(), discardRight.end());
+    }
+    else
+    {
+        left = differenceNodes(aLeft, bLeft, discard, pool);
+        right = differenceNodes(aRight, bRight, discard, pool);
+    }
+
+    return joinNodes(left, right);
+}
+
+/**
+* Appends every node of the subtree at n to out.
+*/
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+void AVLTree<Key, Value, Compare, NodeT, Alloc>::collect(NodeT* n, std::vector<NodeT*>& out)
+{
+    for (; n != NULL; n = n->getRight())
+    {
+        collect(n->getLeft(), out);
+        out.push_back(n);
+    }
+}
+
+/**
+* Destroys nodes that were taken out of the tree, on the calling thread.
+*/
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+void AVLTree<Key, Value, Compare, NodeT, Alloc>::destroyAll(const std::vector<NodeT*>& nodes)
+{
+    for (std::size_t i = 0; i < nodes.size(); ++i) this->destroyNode(nodes[i]);
 }
 
 
@@ -0,0 +1,797 @@
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <cstdlib>
+#include <string>
+#include <limits>
+#include <map>
+#include <thread>
+#include <algorithm>
+#include "bst.h"
+#include "avlbst.h"
+
+using namespace std;
+
+/*
+ * Lookup benchmark: statically typed AVLNode links against the old
+ * design, where every getLeft()/getRight() was a virtual call that
+ * AVLNode overrode with a static_cast.
+ *
+ * Both trees have exactly the same shape: the legacy nodes are built
+ * as a mirror of the AVLTree, so the only difference is how the links
+ * are reached.
+ */
+
+// The old node hierarchy, kept here only for comparison.
+struct LegacyNode
+{
+    LegacyNode(int k, int v) : key(k), value(v), parent(NULL), left(NULL), right(NULL) { }
+    virtual ~LegacyNode() { }
+
+    virtual LegacyNode* getParent() const { return parent; }
+    virtual LegacyNode* getLeft() const { return left; }
+    virtual LegacyNode* getRight() const { return right; }
+
+    int key;
+    int value;
+    LegacyNode* parent;
+    LegacyNode* left;
+    LegacyNode* right;
+};
+
+struct LegacyAVLNode : public LegacyNode
+{
+    LegacyAVLNode(int k, int v) : LegacyNode(k, v), balance(0) { }
+
+    virtual LegacyAVLNode* getParent() const { return static_cast<LegacyAVLNode*>(parent); }
+    virtual LegacyAVLNode* getLeft() const { return static_cast<LegacyAVLNode*>(left); }
+    virtual LegacyAVLNode* getRight() const { return static_cast<LegacyAVLNode*>(right); }
+
+    int8_t balance;
+};
+
+// Same loop as the old BinarySearchTree::internalFind.
+static LegacyNode* legacyFind(LegacyNode* curr, int key)
+{
+    while (curr != NULL)
+    {
+        if (curr->key == key) return curr;
+        else if (key < curr->key) curr = curr->getLeft();
+        else curr = curr->getRight();
+    }
+    return NULL;
+}
+
+static LegacyNode* mirror(AVLNode<int, int>* n, LegacyNode* parent)
+{
+    if (n == NULL) return NULL;
+
+    LegacyAVLNode* copy = new LegacyAVLNode(n->getKey(), n->getValue());
+    copy->parent = parent;
+    copy->balance = n->getBalance();
+    copy->left = mirror(n->getLeft(), copy);
+    copy->right = mirror(n->getRight(), copy);
+    return copy;
+}
+
+static void destroy(LegacyNode* n)
+{
+    if (n == NULL) return;
+    destroy(n->left);
+    destroy(n->right);
+    delete n;
+}
+
+// Gives the benchmark access to the root so it can mirror the shape.
+class BenchTree : public AVLTree<int, int>
+{
+public:
+    AVLNode<int, int>* root() const { return this->root_; }
+};
+
+typedef AVLTree<int, int, less<int>, CompactAVLNode<int, int> > CompactTree;
+typedef AVLTree<int, int, less<int>, IndexedAVLNode<int, int>, NodeArena<IndexedAVLNode<int, int> > > IndexedTree;
+
+template<typename NodeT>
+static void printNodeSize(const char* name, size_t baseline, size_t n)
+{
+    cout << "  " << left << setw(34) << name << right << setw(3) << sizeof(NodeT) << " bytes";
+    if (baseline != sizeof(NodeT))
+    {
+        cout << "  (saves " << baseline - sizeof(NodeT) << " bytes/node, "
+             << setprecision(1) << (baseline - sizeof(NodeT)) * n / (1024.0 * 1024.0) << " MiB for " << n << " nodes)";
+    }
+    cout << endl;
+}
+
+// Node footprint of the AVL layouts; each line is compared against AVLNode.
+static void reportNodeSizes(size_t n)
+{
+    cout << "node sizes" << endl;
+    printNodeSize<AVLNode<int, int> >("AVLNode<int,int>", sizeof(AVLNode<int, int>), n);
+    printNodeSize<CompactAVLNode<int, int> >("CompactAVLNode<int,int>", sizeof(AVLNode<int, int>), n);
+    printNodeSize<IndexedAVLNode<int, int> >("IndexedAVLNode<int,int>", sizeof(AVLNode<int, int>), n);
+    printNodeSize<OrderStatAVLNode<int, int> >("OrderStatAVLNode<int,int>", sizeof(AVLNode<int, int>), n);
+    printNodeSize<AggregateAVLNode<int, int, SumOf<int> > >("AggregateAVLNode<int,int,Sum>", sizeof(AVLNode<int, int>), n);
+    printNodeSize<AVLNode<int, double> >("AVLNode<int,double>", sizeof(AVLNode<int, double>), n);
+    printNodeSize<CompactAVLNode<int, double> >("CompactAVLNode<int,double>", sizeof(AVLNode<int, double>), n);
+    printNodeSize<IndexedAVLNode<int, double> >("IndexedAVLNode<int,double>", sizeof(AVLNode<int, double>), n);
+}
+
+static double nsPerOp(chrono::steady_clock::time_point start, size_t ops)
+{
+    chrono::duration<double, nano> elapsed = chrono::steady_clock::now() - start;
+    return elapsed.count() / ops;
+}
+
+// Orders strings with operator< only, so the tree takes the less-than walk.
+struct StringLess
+{
+    bool operator()(const string& a, const string& b) const { return a < b; }
+};
+
+class StringTree : public AVLTree<string, int>
+{
+public:
+    AVLNode<string, int>* root() const { return this->root_; }
+};
+
+// The loop internalFind used before Compare: == then < on every level.
+static AVLNode<string, int>* equalThenLessFind(AVLNode<string, int>* curr, const string& key)
+{
+    while (curr != NULL)
+    {
+        if (key == curr->getKey()) return curr;
+        else if (key < curr->getKey()) curr = curr->getLeft();
+        else curr = curr->getRight();
+    }
+    return NULL;
+}
+
+// String keys sharing a long prefix, so every comparison reads the whole key.
+static long long benchStringKeys(size_t n, size_t lookups, mt19937& rng)
+{
+    vector<string> keys(n);
+    StringTree tree;
+    AVLTree<string, int, StringLess> lessOnly;
+    for (size_t i = 0; i < n; ++i)
+    {
+        keys[i] = "/usr/share/benchmark/keys/" + to_string(rng());
+        tree.insert(make_pair(keys[i], static_cast<int>(i)));
+        lessOnly.insert(make_pair(keys[i], static_cast<int>(i)));
+    }
+
+    vector<const string*> probes(lookups);
+    for (size_t i = 0; i < lookups; ++i) probes[i] = &keys[rng() % n];
+
+    long long sum = 0;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (size_t i = 0; i < lookups; ++i) sum += equalThenLessFind(tree.root(), *probes[i])->getValue();
+    double old = nsPerOp(start, lookups);
+
+    start = chrono::steady_clock::now();
+    for (size_t i = 0; i < lookups; ++i) sum -= 2 * tree.find(*probes[i])->second;
+    double threeWay = nsPerOp(start, lookups);
+
+    start = chrono::steady_clock::now();
+    for (size_t i = 0; i < lookups; ++i) sum += lessOnly.find(*probes[i])->second;
+    double lessThan = nsPerOp(start, lookups);
+
+    cout << fixed << setprecision(1);
+    cout << "find on " << n << " string keys, " << lookups << " lookups" << endl;
+    cout << "  == then < per level:        " << old << " ns/op" << endl;
+    cout << "  string::compare per level:  " << threeWay << " ns/op" << endl;
+    cout << "  one < per level:            " << lessThan << " ns/op" << endl;
+    return sum;
+}
+
+// Insert n keys with a 4 KiB buffer each, then try every key again.
+static long long benchLargeValues(size_t n)
+{
+    const size_t bufferSize = 4096;
+    vector<int> keys(n);
+    for (size_t i = 0; i < n; ++i) keys[i] = static_cast<int>(i * 2654435761u);
+
+    // Warm the heap up so the first run does not pay for the page faults.
+    AVLTree<int, vector<char> > tree;
+    for (size_t i = 0; i < n; ++i) tree.try_emplace(keys[i], bufferSize, 'x');
+    tree.clear();
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (size_t i = 0; i < n; ++i)
+    {
+        const pair<const int, vector<char> > item(keys[i], vector<char>(bufferSize, 'x'));
+        tree.insert(item);
+    }
+    double copy = nsPerOp(start, n);
+    tree.clear();
+
+    start = chrono::steady_clock::now();
+    for (size_t i = 0; i < n; ++i) tree.insert(make_pair(keys[i], vector<char>(bufferSize, 'x')));
+    double move = nsPerOp(start, n);
+    tree.clear();
+
+    start = chrono::steady_clock::now();
+    for (size_t i = 0; i < n; ++i) tree.try_emplace(keys[i], bufferSize, 'x');
+    double emplace = nsPerOp(start, n);
+
+    // Every key is present now: try_emplace must not build a buffer.
+    long long added = 0;
+    start = chrono::steady_clock::now();
+    for (size_t i = 0; i < n; ++i) added += tree.try_emplace(keys[i], bufferSize, 'y').second;
+    double existing = nsPerOp(start, n);
+
+    cout << "insert of " << n << " keys with " << bufferSize << " byte values" << endl;
+    cout << "  insert(const pair&):        " << copy << " ns/op" << endl;
+    cout << "  insert(pair&&):             " << move << " ns/op" << endl;
+    cout << "  try_emplace:                " << emplace << " ns/op" << endl;
+    cout << "  try_emplace, key present:   " << existing << " ns/op" << endl;
+    return added;
+}
+
+// Counting occurrences: find + insert + operator[] against a single upsert.
+static long long benchUpdates(size_t distinct, size_t updates, mt19937& rng)
+{
+    vector<int> keys(updates);
+    for (size_t i = 0; i < updates; ++i) keys[i] = static_cast<int>(rng() % distinct);
+
+    AVLTree<int, long long> threeDescents;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (size_t i = 0; i < updates; ++i)
+    {
+        if (threeDescents.find(keys[i]) == threeDescents.end()) threeDescents.insert(make_pair(keys[i], 0LL));
+        threeDescents[keys[i]] += 1;
+    }
+    double old = nsPerOp(start, updates);
+
+    AVLTree<int, long long> oneDescent;
+    start = chrono::steady_clock::now();
+    for (size_t i = 0; i < updates; ++i) oneDescent.upsert(keys[i], [](long long& count) { ++count; });
+    double upsert = nsPerOp(start, updates);
+
+    long long sum = 0;
+    for (size_t i = 0; i < distinct; i += distinct / 100 + 1)
+    {
+        if (oneDescent.find(static_cast<int>(i)) == oneDescent.end()) continue;
+        sum += threeDescents[static_cast<int>(i)] - oneDescent.findOrInsert(static_cast<int>(i));
+    }
+
+    cout << updates << " counter updates over " << distinct << " keys" << endl;
+    cout << "  find + insert + []:         " << old << " ns/op" << endl;
+    cout << "  upsert:                     " << upsert << " ns/op" << endl;
+    return sum;
+}
+
+// Loading sorted keys: one insert each against the O(n) bulk build.
+static long long benchSortedLoad(size_t n)
+{
+    vector<pair<int, int> > items(n);
+    for (size_t i = 0; i < n; ++i) items[i] = make_pair(static_cast<int>(i), static_cast<int>(i));
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    AVLTree<int, int> inserted;
+    for (size_t i = 0; i < n; ++i) inserted.insert(items[i]);
+    double insert = nsPerOp(start, n);
+
+    start = chrono::steady_clock::now();
+    AVLTree<int, int> built(items.begin(), items.end());
+    double build = nsPerOp(start, n);
+
+    // Reversed input takes the sort-then-build path.
+    start = chrono::steady_clock::now();
+    built.assignSorted(items.rbegin(), items.rend());
+    double unsorted = nsPerOp(start, n);
+
+    cout << "loading " << n << " sorted keys" << endl;
+    cout << "  insert one by one:          " << insert << " ns/item" << endl;
+    cout << "  range constructor:          " << build << " ns/item" << endl;
+    cout << "  assignSorted, reversed:     " << unsorted << " ns/item" << endl;
+    return inserted[0] - built[0];
+}
+
+// Streams of increasing keys: a full descent per insert against append(),
+// for a strictly increasing stream and one shuffled within small windows.
+static long long benchStreams(size_t n, mt19937& rng)
+{
+    vector<pair<int, int> > items(n);
+    for (size_t i = 0; i < n; ++i) items[i] = make_pair(static_cast<int>(i), static_cast<int>(i));
+    vector<pair<int, int> > nearly(items);
+    for (size_t i = 0; i + 1 < n; ++i) swap(nearly[i], nearly[i + rng() % min<size_t>(8, n - i)]);
+
+    long long sum = 0;
+    double times[4];
+    const vector<pair<int, int> >* streams[2] = { &items, &nearly };
+    for (int s = 0; s < 2; ++s)
+    {
+        const vector<pair<int, int> >& stream = *streams[s];
+
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        AVLTree<int, int> inserted;
+        for (size_t i = 0; i < n; ++i) inserted.insert(stream[i]);
+        times[2 * s] = nsPerOp(start, n);
+
+        start = chrono::steady_clock::now();
+        AVLTree<int, int> appended;
+        for (size_t i = 0; i < n; ++i) appended.append(stream[i]);
+        times[2 * s + 1] = nsPerOp(start, n);
+
+        sum += inserted[0] - appended[0];
+    }
+
+    cout << "streaming " << n << " increasing keys" << endl;
+    cout << "  sorted, insert:             " << times[0] << " ns/item" << endl;
+    cout << "  sorted, append:             " << times[1] << " ns/item" << endl;
+    cout << "  nearly sorted, insert:      " << times[2] << " ns/item" << endl;
+    cout << "  nearly sorted, append:      " << times[3] << " ns/item" << endl;
+    return sum;
+}
+
+// Draining the tree as an ordered work queue: remove(begin()->first)
+// looks the minimum up again, popMin() takes the cached node. A plain
+// BinarySearchTree, so the difference is the lookup and not rebalancing.
+static long long benchWorkQueue(size_t n)
+{
+    vector<pair<int, int> > items(n);
+    for (size_t i = 0; i < n; ++i) items[i] = make_pair(static_cast<int>(i), static_cast<int>(i));
+
+    long long sum = 0;
+    BinarySearchTree<int, int> byKey(items.begin(), items.end());
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    while (!byKey.empty())
+    {
+        sum += byKey.begin()->second;
+        byKey.remove(byKey.begin()->first);
+    }
+    double lookup = nsPerOp(start, n);
+
+    BinarySearchTree<int, int> popped(items.begin(), items.end());
+    start = chrono::steady_clock::now();
+    while (!popped.empty()) sum -= popped.popMin().second;
+    double pop = nsPerOp(start, n);
+
+    cout << "draining " << n << " items smallest first" << endl;
+    cout << "  remove(begin()->first):     " << lookup << " ns/item" << endl;
+    cout << "  popMin:                     " << pop << " ns/item" << endl;
+    return sum;
+}
+
+// Full in-order scans of a randomly built tree: climbing through the
+// parents against following threads. Also scans backwards.
+template<typename Tree>
+static void scanTree(const Tree& tree, size_t n, size_t passes, double& forward, double& backward, long long& sum)
+{
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (size_t p = 0; p < passes; ++p)
+    {
+        for (typename Tree::const_iterator it = tree.begin(); it != tree.end(); ++it) sum += it->second;
+    }
+    forward = nsPerOp(start, n * passes);
+
+    start = chrono::steady_clock::now();
+    for (size_t p = 0; p < passes; ++p)
+    {
+        for (typename Tree::const_reverse_iterator it = tree.rbegin(); it != tree.rend(); ++it) sum -= it->second;
+    }
+    backward = nsPerOp(start, n * passes);
+}
+
+static long long benchScans(const vector<int>& keys)
+{
+    AVLTree<int, int> plain;
+    AVLTree<int, int, less<int>, ThreadedAVLNode<int, int> > threaded;
+    for (size_t i = 0; i < keys.size(); ++i)
+    {
+        plain.insert(make_pair(keys[i], 1));
+        threaded.insert(make_pair(keys[i], 1));
+    }
+
+    const size_t passes = 5;
+    long long sum = 0;
+    double plainForward, plainBackward, threadedForward, threadedBackward;
+    scanTree(plain, keys.size(), passes, plainForward, plainBackward, sum);
+    scanTree(threaded, keys.size(), passes, threadedForward, threadedBackward, sum);
+
+    cout << "in-order scans of " << keys.size() << " random keys" << endl;
+    cout << "  AVLNode, forward:           " << plainForward << " ns/item" << endl;
+    cout << "  AVLNode, backward:          " << plainBackward << " ns/item" << endl;
+    cout << "  ThreadedAVLNode, forward:   " << threadedForward << " ns/item" << endl;
+    cout << "  ThreadedAVLNode, backward:  " << threadedBackward << " ns/item" << endl;
+    return sum;
+}
+
+// Range queries "all keys in [lo, lo + width)": filtering a walk from
+// begin() against forEachInRange(), which starts at lower_bound(lo).
+static long long benchRanges(const BenchTree& tree, size_t queries, mt19937& rng)
+{
+    const int width = 1 << 20; // 2^-12 of the key space, ~250 items of a million random keys
+    vector<int> starts(queries);
+    for (size_t i = 0; i < queries; ++i) starts[i] = static_cast<int>(rng());
+
+    long long filtered = 0;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (size_t i = 0; i < queries; ++i)
+    {
+        long long lo = starts[i], hi = lo + width;
+        for (BenchTree::const_iterator it = tree.begin(); it != tree.end(); ++it)
+        {
+            if (it->first >= lo && it->first < hi) filtered += it->second;
+        }
+    }
+    double scan = nsPerOp(start, queries);
+
+    long long visited = 0;
+    start = chrono::steady_clock::now();
+    for (size_t i = 0; i < queries; ++i)
+    {
+        int hi = starts[i] > numeric_limits<int>::max() - width ? numeric_limits<int>::max() : starts[i] + width;
+        tree.forEachInRange(starts[i], hi, [&visited](const pair<const int, int>& item) { visited += item.second; });
+    }
+    double ranged = nsPerOp(start, queries);
+
+    cout << queries << " range queries of width " << width << endl;
+    cout << "  filter from begin():        " << scan << " ns/query" << endl;
+    cout << "  forEachInRange:             " << ranged << " ns/query" << endl;
+    return filtered - visited;
+}
+
+// Percentile queries: stepping an iterator from begin() against select()
+// and rank() on a tree whose nodes count their subtrees.
+static long long benchOrderStats(const vector<int>& keys, size_t queries, mt19937& rng)
+{
+    AVLTree<int, int, less<int>, OrderStatAVLNode<int, int> > counted;
+    for (size_t i = 0; i < keys.size(); ++i) counted.insert(make_pair(keys[i], 1));
+    const size_t n = counted.distance(counted.begin(), counted.end());
+
+    vector<size_t> positions(queries);
+    vector<int> probes(queries);
+    long long expectedRanks = 0;
+    for (size_t i = 0; i < queries; ++i)
+    {
+        positions[i] = rng() % n;
+        probes[i] = counted.select(positions[i])->first;
+        expectedRanks += positions[i];
+    }
+
+    long long sum = 0;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (size_t i = 0; i < queries; ++i)
+    {
+        AVLTree<int, int, less<int>, OrderStatAVLNode<int, int> >::iterator it = counted.begin();
+        for (size_t step = 0; step < positions[i]; ++step) ++it;
+        sum += it->first;
+    }
+    double walked = nsPerOp(start, queries);
+
+    start = chrono::steady_clock::now();
+    for (size_t i = 0; i < queries; ++i) sum -= counted.select(positions[i])->first;
+    double selected = nsPerOp(start, queries);
+
+    start = chrono::steady_clock::now();
+    for (size_t i = 0; i < queries; ++i) sum += counted.rank(probes[i]);
+    double ranked = nsPerOp(start, queries);
+
+    cout << queries << " order statistics over " << n << " keys" << endl;
+    cout << "  k-th key, ++ from begin():  " << walked << " ns/query" << endl;
+    cout << "  select(k):                  " << selected << " ns/query" << endl;
+    cout << "  rank(key):                  " << ranked << " ns/query" << endl;
+    return sum - expectedRanks;
+}
+
+// Window sums: adding up the values between two keys with
+// forEachInRange against aggregate() on a tree caching subtree sums.
+static long long benchAggregates(const vector<int>& keys, size_t queries, mt19937& rng)
+{
+    typedef AVLTree<int, long long, less<int>, AggregateAVLNode<int, long long, SumOf<long long> > > SumTree;
+    SumTree sums;
+    for (size_t i = 0; i < keys.size(); ++i) sums.insert(make_pair(keys[i], static_cast<long long>(i % 1000)));
+
+    vector<int> los(queries), his(queries);
+    for (size_t i = 0; i < queries; ++i)
+    {
+        int a = keys[rng() % keys.size()], b = keys[rng() % keys.size()];
+        los[i] = min(a, b);
+        his[i] = max(a, b);
+    }
+
+    long long scanned = 0;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (size_t i = 0; i < queries; ++i)
+    {
+        sums.forEachInRange(los[i], his[i], [&scanned](const pair<const int, long long>& item) { scanned += item.second; });
+    }
+    double scan = nsPerOp(start, queries);
+
+    long long aggregated = 0;
+    start = chrono::steady_clock::now();
+    for (size_t i = 0; i < queries; ++i) aggregated += sums.aggregate(los[i], his[i]);
+    double cached = nsPerOp(start, queries);
+
+    cout << queries << " window sums over " << keys.size() << " keys" << endl;
+    cout << "  forEachInRange:             " << scan << " ns/query" << endl;
+    cout << "  aggregate(lo, hi):          " << cached << " ns/query" << endl;
+    return scanned - aggregated;
+}
+
+// Cutting a tree in two at a key and gluing it back: copying the upper
+// half into a new tree item by item against split() and join().
+static long long benchSplitJoin(const vector<int>& keys, size_t rounds, mt19937& rng)
+{
+    BenchTree whole;
+    for (size_t i = 0; i < keys.size(); ++i) whole.insert(make_pair(keys[i], 1));
+
+    vector<int> cuts(rounds);
+    for (size_t i = 0; i < rounds; ++i) cuts[i] = keys[rng() % keys.size()];
+
+    long long copied = 0;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (size_t i = 0; i < rounds; ++i)
+    {
+        BenchTree upper;
+        for (BenchTree::iterator it = whole.lower_bound(cuts[i]); it != whole.end(); ++it) upper.insert(*it);
+        copied += (upper.empty() ? 0 : upper.min().first + upper.max().first);
+    }
+    double copying = nsPerOp(start, rounds);
+
+    long long moved = 0;
+    start = chrono::steady_clock::now();
+    for (size_t i = 0; i < rounds; ++i)
+    {
+        BenchTree upper;
+        whole.split(cuts[i], upper);
+        moved += (upper.empty() ? 0 : upper.min().first + upper.max().first);
+        whole.join(upper);
+    }
+    double splitting = nsPerOp(start, rounds);
+
+    cout << rounds << " cuts of a " << keys.size() << " key tree" << endl;
+    cout << "  copy upper half:            " << copying << " ns/cut" << endl;
+    cout << "  split() + join():           " << splitting << " ns/cut" << endl;
+    return copied - moved;
+}
+
+// Merging two keyed datasets: inserting one tree's items into the other
+// against unionWith(), on the calling thread alone and on the shared pool.
+// One key in every ratio goes to the second tree.
+static long long benchUnion(const vector<int>& keys, size_t ratio)
+{
+    vector<pair<int, int> > lower, upper;
+    for (size_t i = 0; i < keys.size(); ++i) (i % ratio ? lower : upper).push_back(make_pair(keys[i], 1));
+    sort(lower.begin(), lower.end());
+    sort(upper.begin(), upper.end());
+
+    long long totals[3];
+    double times[3];
+    ThreadPool serial(0);
+    for (int method = 0; method < 3; ++method)
+    {
+        BenchTree mine, theirs;
+        mine.assignSorted(lower.begin(), lower.end());
+        theirs.assignSorted(upper.begin(), upper.end());
+
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        if (method == 0)
+        {
+            for (BenchTree::iterator it = theirs.begin(); it != theirs.end(); ++it)
+            {
+                mine.upsert(it->first, [&it](int& value) { value += it->second; });
+            }
+        }
+        else
+        {
+            mine.unionWith(theirs, plus<int>(), method == 1 ? serial : ThreadPool::shared());
+        }
+        times[method] = nsPerOp(start, upper.size());
+
+        totals[method] = 0;
+        for (BenchTree::iterator it = mine.begin(); it != mine.end(); ++it) totals[method] += it->second;
+    }
+
+    cout << "union of a " << lower.size() << " and a " << upper.size() << " key tree" << endl;
+    cout << "  upsert each item:           " << times[0] << " ns/item" << endl;
+    cout << "  unionWith, one thread:      " << times[1] << " ns/item" << endl;
+    cout << "  unionWith, shared pool:     " << times[2] << " ns/item  ("
+         << ThreadPool::shared().workers() + 1 << " threads)" << endl;
+    return 2 * totals[0] - totals[1] - totals[2];
+}
+
+// Builds a tree from the keys in random order, each one twice with the
+// second value winning: an insert() per item, then parallelBuild() with
+// 1, 2, 4, ... threads up to the hardware's.
+static long long benchParallelBuild(const vector<int>& keys)
+{
+    vector<pair<int, int> > items;
+    for (size_t i = 0; i < keys.size(); ++i) items.push_back(make_pair(keys[i], 0));
+    for (size_t i = 0; i < keys.size(); ++i) items.push_back(make_pair(keys[i], static_cast<int>(i)));
+    shuffle(items.begin(), items.end(), mt19937(99));
+
+    // the two copies of a key are now in random order, so find the winner
+    map<int, int> expected;
+    for (size_t i = 0; i < items.size(); ++i) expected[items[i].first] = items[i].second;
+    long long want = 0;
+    for (map<int, int>::const_iterator it = expected.begin(); it != expected.end(); ++it) want += it->second;
+
+    long long wrong = 0;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    {
+        BenchTree tree;
+        for (size_t i = 0; i < items.size(); ++i) tree.insert(items[i]);
+        double perItem = nsPerOp(start, items.size());
+        for (BenchTree::iterator it = tree.begin(); it != tree.end(); ++it) wrong += it->second;
+        wrong -= want;
+        cout << "build from " << items.size() << " unsorted items, " << expected.size() << " keys" << endl;
+        cout << "  insert each item:           " << perItem << " ns/item" << endl;
+    }
+
+    unsigned hardware = max(thread::hardware_concurrency(), 1u);
+    double oneThread = 0;
+    for (unsigned threads = 1; ; threads *= 2)
+    {
+        threads = min(threads, max(hardware, 4u));
+        BenchTree tree;
+        ThreadPool pool(threads - 1);
+        start = chrono::steady_clock::now();
+        tree.parallelBuild(items.begin(), items.end(), pool);
+        double perItem = nsPerOp(start, items.size());
+        if (threads == 1) oneThread = perItem;
+
+        for (BenchTree::iterator it = tree.begin(); it != tree.end(); ++it) wrong += it->second;
+        wrong -= want;
+        if (!tree.isBalanced()) ++wrong;
+
+        cout << "  parallelBuild, " << setw(2) << threads << " threads:  " << perItem << " ns/item  ("
+             << setprecision(2) << oneThread / perItem << "x)" << setprecision(1) << endl;
+        if (threads >= max(hardware, 4u)) break;
+    }
+    if (hardware < 4) cout << "  (only " << hardware << " hardware threads)" << endl;
+    return wrong;
+}
+
+// A full pass over every item: summing, then rewriting every value, with
+// iterators and with parallelReduce() / parallelForEach().
+static long long benchFullPass(BenchTree& tree, size_t n)
+{
+    ThreadPool& pool = ThreadPool::shared();
+    const size_t passes = 10;
+
+    long long iterated = 0;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (size_t pass = 0; pass < passes; ++pass)
+    {
+        for (BenchTree::iterator it = tree.begin(); it != tree.end(); ++it) iterated += it->second;
+    }
+    double iterate = nsPerOp(start, passes * n);
+
+    long long reduced = 0;
+    start = chrono::steady_clock::now();
+    for (size_t pass = 0; pass < passes; ++pass)
+    {
+        reduced += tree.parallelReduce(0LL, [](const pair<const int, int>& item) { return (long long)item.second; },
+                                       plus<long long>(), pool);
+    }
+    double reduce = nsPerOp(start, passes * n);
+
+    start = chrono::steady_clock::now();
+    for (BenchTree::iterator it = tree.begin(); it != tree.end(); ++it) it->second ^= 0x5a5a;
+    double rewrite = nsPerOp(start, n);
+
+    start = chrono::steady_clock::now();
+    tree.parallelForEach([](pair<const int, int>& item) { item.second ^= 0x5a5a; }, pool);
+    double parallelRewrite = nsPerOp(start, n);
+
+    cout << "full pass over " << n << " items, " << pool.workers() + 1 << " threads" << endl;
+    cout << "  sum, iterators:             " << iterate << " ns/item" << endl;
+    cout << "  sum, parallelReduce:        " << reduce << " ns/item" << endl;
+    cout << "  rewrite, iterators:         " << rewrite << " ns/item" << endl;
+    cout << "  rewrite, parallelForEach:   " << parallelRewrite << " ns/item" << endl;
+    return iterated - reduced;
+}
+
+// Expiring the oldest keys of a time-ordered tree a window at a time:
+// a remove() per key against one eraseRange() per window.
+static long long benchEraseRange(size_t n, size_t window)
+{
+    vector<pair<int, int> > items(n);
+    for (size_t i = 0; i < n; ++i) items[i] = make_pair(static_cast<int>(i), 1);
+    const size_t windows = min<size_t>(10, (n - 1) / window);
+
+    BenchTree removed, erased;
+    removed.assignSorted(items.begin(), items.end());
+    erased.assignSorted(items.begin(), items.end());
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (size_t w = 0; w < windows; ++w)
+    {
+        for (size_t i = w * window; i < (w + 1) * window; ++i) removed.remove(static_cast<int>(i));
+    }
+    double removing = nsPerOp(start, windows * window);
+
+    long long count = 0;
+    start = chrono::steady_clock::now();
+    for (size_t w = 0; w < windows; ++w)
+    {
+        count += erased.eraseRange(static_cast<int>(w * window), static_cast<int>((w + 1) * window));
+    }
+    double erasing = nsPerOp(start, windows * window);
+
+    cout << "expiring " << windows << " windows of " << window << " keys from " << n << endl;
+    cout << "  remove() per key:           " << removing << " ns/item" << endl;
+    cout << "  eraseRange() per window:    " << erasing << " ns/item" << endl;
+    return count - static_cast<long long>(windows * window) + (removed.min().first - erased.min().first);
+}
+
+int main(int argc, char *argv[])
+{
+    size_t n = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+    size_t lookups = argc > 2 ? strtoul(argv[2], NULL, 10) : 5000000;
+
+    mt19937 rng(12345);
+    vector<int> keys(n);
+    BenchTree tree;
+    for (size_t i = 0; i < n; ++i)
+    {
+        keys[i] = static_cast<int>(rng());
+        tree.insert(make_pair(keys[i], static_cast<int>(i)));
+    }
+
+    vector<int> probes(lookups);
+    for (size_t i = 0; i < lookups; ++i) probes[i] = keys[rng() % n];
+
+    LegacyNode* legacyRoot = mirror(tree.root(), NULL);
+
+    CompactTree compact;
+    for (size_t i = 0; i < n; ++i) compact.insert(make_pair(keys[i], static_cast<int>(i)));
+
+    IndexedTree indexed;
+    for (size_t i = 0; i < n; ++i) indexed.insert(make_pair(keys[i], static_cast<int>(i)));
+
+    long long sum = 0;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (size_t i = 0; i < lookups; ++i) sum += legacyFind(legacyRoot, probes[i])->value;
+    double legacy = nsPerOp(start, lookups);
+
+    start = chrono::steady_clock::now();
+    for (size_t i = 0; i < lookups; ++i) sum -= 3 * tree.find(probes[i])->second;
+    double typed = nsPerOp(start, lookups);
+
+    start = chrono::steady_clock::now();
+    for (size_t i = 0; i < lookups; ++i) sum += compact.find(probes[i])->second;
+    double packed = nsPerOp(start, lookups);
+
+    start = chrono::steady_clock::now();
+    for (size_t i = 0; i < lookups; ++i) sum += indexed.find(probes[i])->second;
+    double relative = nsPerOp(start, lookups);
+
+    cout << fixed << setprecision(1);
+    cout << "find on " << n << " keys, " << lookups << " lookups" << endl;
+    cout << "  virtual node links: " << legacy << " ns/op" << endl;
+    cout << "  static node links:  " << typed << " ns/op" << endl;
+    cout << "  compact node links: " << packed << " ns/op" << endl;
+    cout << "  index node links:   " << relative << " ns/op" << endl;
+    cout << "  speedup:            " << setprecision(2) << legacy / typed << "x" << endl;
+    cout << "  sizeof(LegacyAVLNode) = " << sizeof(LegacyAVLNode)
+         << ", sizeof(AVLNode<int,int>) = " << sizeof(AVLNode<int, int>) << endl;
+
+    sum += benchStringKeys(n / 4, lookups / 4, rng);
+    sum += benchLargeValues(n / 10);
+    sum += benchUpdates(n / 10, lookups, rng);
+    sum += benchSortedLoad(n);
+    sum += benchStreams(n, rng);
+    sum += benchWorkQueue(n);
+    sum += benchScans(keys);
+    sum += benchRanges(tree, 20, rng);
+    sum += benchOrderStats(keys, 20, rng);
+    sum += benchAggregates(keys, 20, rng);
+    sum += benchSplitJoin(keys, 20, rng);
+    sum += benchUnion(keys, 2);
+    sum += benchUnion(keys, 64);
+    sum += benchParallelBuild(keys);
+    sum += benchFullPass(tree, n);
+    sum += benchEraseRange(n, max<size_t>(n / 100, 1));
+
+    reportNodeSizes(n);
+
+    destroy(legacyRoot);
+    return sum == 0 ? 0 : 1;
+}
@@ -0,0 +1,623 @@
+#include <atomic>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "bst.h"
+#include "avlbst.h"
+
+using namespace std;
+
+/*
+ * Behavioural checks for the trees, run by `make check`. Each failed
+ * check prints where it failed and which tree it was checking; the exit
+ * status is 1 if any did.
+ *
+ * Most checks are differential: random operations are applied both to a
+ * tree and to a std::map, and the two must agree after every step that
+ * returns something and on their whole contents every few steps. AVL
+ * trees must also stay balanced throughout. Every node type is covered
+ * with each allocator it works with, including a NodeArena small enough
+ * to move its nodes many times over.
+ */
+
+static int failures = 0;
+static string checking;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            cerr << __FILE__ << ":" << __LINE__ << ": " << checking << ": check failed: " #cond << endl; \
+            ++failures; \
+        } \
+    } while (0)
+
+typedef map<int, long> Model;
+
+static const int keyRange = 600;    // small enough that keys collide often
+static const size_t steps = 3000;   // random operations per tree
+static const size_t wholeEvery = 97; // steps between full comparisons
+
+static mt19937 rng(20240611);
+
+static int randomKey() { return static_cast<int>(rng() % keyRange); }
+static long randomValue() { return static_cast<long>(rng() % 100000); }
+
+// Every item, forwards and backwards, and the ends.
+template<typename Tree>
+static bool sameItems(const Tree& tree, const Model& model)
+{
+    if (tree.empty() != model.empty()) return false;
+    if (distance(tree.begin(), tree.end()) != static_cast<ptrdiff_t>(model.size())) return false;
+    if (!equal(model.begin(), model.end(), tree.begin())) return false;
+    if (!equal(model.rbegin(), model.rend(), tree.rbegin())) return false;
+    if (model.empty()) return true;
+    return tree.min() == *model.begin() && tree.max() == *model.rbegin();
+}
+
+template<typename Tree>
+static void checkWhole(const Tree& tree, const Model& model, bool balanced)
+{
+    CHECK(sameItems(tree, model));
+    if (balanced) CHECK(tree.isBalanced());
+}
+
+// An iterator's position, or -1 for end(), to compare with the model's.
+template<typename It, typename End>
+static ptrdiff_t position(It first, It it, End end)
+{
+    return it == end ? -1 : distance(first, it);
+}
+
+template<typename Tree>
+static void fillRandom(Tree& tree, Model& model, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+    {
+        int key = randomKey();
+        long value = randomValue();
+        tree.insert(make_pair(key, value));
+        model[key] = value;
+    }
+}
+
+// Inserts, removals and lookups through every entry point the tree has
+// for them.
+template<typename Tree>
+static void checkBasics(const string& name, bool balanced)
+{
+    checking = name;
+    Tree tree;
+    Model model;
+
+    for (size_t step = 1; step <= steps; ++step)
+    {
+        int key = randomKey();
+        long value = randomValue();
+        switch (rng() % 12)
+        {
+            case 0:
+                tree.insert(make_pair(key, value));
+                model[key] = value;
+                break;
+            case 1: {
+                typename Tree::iterator it = tree.insert(tree.lower_bound(key), make_pair(key, value));
+                CHECK(it->first == key && it->second == value);
+                model[key] = value;
+                break;
+            }
+            case 2: {
+                pair<typename Tree::iterator, bool> added = tree.emplace(key, value);
+                pair<Model::iterator, bool> expected = model.emplace(key, value);
+                CHECK(added.second == expected.second && added.first->second == expected.first->second);
+                break;
+            }
+            case 3: {
+                pair<typename Tree::iterator, bool> added = tree.try_emplace(key, value);
+                CHECK(added.second == model.emplace(key, value).second);
+                break;
+            }
+            case 4:
+                tree.findOrInsert(key) += value;
+                model[key] += value;
+                break;
+            case 5:
+                CHECK(tree.upsert(key, [value](long& v) { v -= value; }) == (model.count(key) == 0));
+                model[key] -= value;
+                break;
+            case 6: {
+                // append() is meant for keys above the maximum but takes any
+                int above = model.empty() || key % 2 ? key : model.rbegin()->first + 1 + key % 5;
+                tree.append(make_pair(above, value));
+                model[above] = value;
+                break;
+            }
+            case 7:
+            case 8:
+                tree.remove(key);
+                model.erase(key);
+                break;
+            case 9:
+                CHECK((tree.find(key) == tree.end()) == (model.find(key) == model.end()));
+                CHECK(position(tree.begin(), tree.lower_bound(key), tree.end())
+                      == position(model.begin(), model.lower_bound(key), model.end()));
+                CHECK(position(tree.begin(), tree.upper_bound(key), tree.end())
+                      == position(model.begin(), model.upper_bound(key), model.end()));
+                CHECK(distance(tree.equal_range(key).first, tree.equal_range(key).second)
+                      == static_cast<ptrdiff_t>(model.count(key)));
+                if (model.count(key)) CHECK(tree[key] == model[key]);
+                break;
+            case 10:
+                if (!model.empty()) {
+                    pair<int, long> popped = tree.popMin();
+                    CHECK(popped.first == model.begin()->first && popped.second == model.begin()->second);
+                    model.erase(model.begin());
+                }
+                break;
+            case 11:
+                if (!model.empty()) {
+                    pair<int, long> popped = tree.popMax();
+                    CHECK(popped.first == model.rbegin()->first && popped.second == model.rbegin()->second);
+                    model.erase(prev(model.end()));
+                }
+                break;
+        }
+        if (step % wholeEvery == 0) checkWhole(tree, model, balanced);
+    }
+    checkWhole(tree, model, balanced);
+
+    // Random access through iterators, and a range visit
+    if (!model.empty()) {
+        ptrdiff_t n = static_cast<ptrdiff_t>(model.size());
+        typename Tree::const_iterator it = tree.begin();
+        it += n / 2;
+        CHECK(*it == *next(model.begin(), n / 2));
+        it -= n / 4;
+        CHECK(*it == *next(model.begin(), n / 2 - n / 4));
+    }
+    int lo = randomKey(), hi = lo + keyRange / 4;
+    long inRange = 0, expected = 0;
+    tree.forEachInRange(lo, hi, [&inRange](pair<const int, long>& item) { inRange += item.second; });
+    for (Model::iterator it = model.lower_bound(lo); it != model.lower_bound(hi); ++it) expected += it->second;
+    CHECK(inRange == expected);
+
+    tree.clear();
+    model.clear();
+    CHECK(tree.empty() && tree.begin() == tree.end());
+}
+
+// Bulk builds from unsorted input, in which repeated keys keep the last
+// value, and inserts afterwards so the tree grows past its first nodes.
+template<typename Tree>
+static void checkBulkBuilds(const string& name)
+{
+    checking = name;
+    vector<pair<int, long> > items;
+    Model model;
+    for (size_t i = 0; i < 2000; ++i) items.push_back(make_pair(randomKey() * 3, randomValue()));
+    for (size_t i = 0; i < items.size(); ++i) model[items[i].first] = items[i].second;
+
+    Tree built;
+    built.assignSorted(items.begin(), items.end());
+    CHECK(sameItems(built, model));
+    CHECK(built.isBalanced());
+
+    Tree parallel;
+    parallel.parallelBuild(items.begin(), items.end());
+    CHECK(sameItems(parallel, model));
+    CHECK(parallel.isBalanced());
+
+    ThreadPool pool(3);
+    Tree own;
+    own.parallelBuild(items.begin(), items.end(), pool);
+    CHECK(sameItems(own, model));
+
+    fillRandom(parallel, model, 500);
+    CHECK(sameItems(parallel, model));
+}
+
+// Parallel passes see every item exactly once, on the shared pool and on
+// one of our own.
+template<typename Tree>
+static void checkParallelPasses(const string& name)
+{
+    checking = name;
+    Tree tree;
+    Model model;
+    fillRandom(tree, model, 2000);
+
+    ThreadPool pool(3);
+    for (int round = 0; round < 2; ++round)
+    {
+        if (round == 0) tree.parallelForEach([](pair<const int, long>& item) { item.second += item.first; });
+        else tree.parallelForEach([](pair<const int, long>& item) { item.second += item.first; }, pool);
+        long sum = 0;
+        for (Model::iterator it = model.begin(); it != model.end(); ++it) {
+            it->second += it->first;
+            sum += it->second;
+        }
+        CHECK(sameItems(tree, model));
+
+        const Tree& readOnly = tree;
+        atomic<long> visited(0);
+        readOnly.parallelForEach([&visited](const pair<const int, long>&) { ++visited; });
+        CHECK(visited == static_cast<long>(model.size()));
+        CHECK(readOnly.parallelReduce(0L, [](const pair<const int, long>& item) { return item.second; },
+                                      plus<long>(), round == 0 ? ThreadPool::shared() : pool) == sum);
+    }
+}
+
+// split() and join() against the model cut and put back together.
+template<typename Tree>
+static void checkSplitJoin(const string& name)
+{
+    checking = name;
+    for (int round = 0; round < 40; ++round)
+    {
+        Tree tree;
+        Model model;
+        fillRandom(tree, model, rng() % 400);
+
+        int key = randomKey();
+        Tree right;
+        tree.split(key, right);
+        Model below(model.begin(), model.lower_bound(key)), above(model.lower_bound(key), model.end());
+        checkWhole(tree, below, true);
+        checkWhole(right, above, true);
+
+        if (!above.empty() && !below.empty()) {
+            bool threw = false;
+            try { right.join(tree); }
+            catch (const invalid_argument&) { threw = true; }
+            CHECK(threw);
+            checkWhole(tree, below, true);
+            checkWhole(right, above, true);
+        }
+        tree.join(right);
+        CHECK(right.empty());
+        checkWhole(tree, model, true);
+
+        // join with a pivot between the two trees
+        Tree high;
+        Model highModel;
+        for (int k = keyRange + 1; k < keyRange + 1 + static_cast<int>(rng() % 200); ++k) {
+            high.insert(make_pair(k, static_cast<long>(k)));
+            highModel[k] = k;
+        }
+        tree.join(make_pair(keyRange, 7L), high);
+        model[keyRange] = 7;
+        model.insert(highModel.begin(), highModel.end());
+        CHECK(high.empty());
+        checkWhole(tree, model, true);
+    }
+}
+
+// eraseRange() and erase(first, last) against the same ranges erased
+// from the model.
+template<typename Tree>
+static void checkEraseRange(const string& name)
+{
+    checking = name;
+    for (int round = 0; round < 40; ++round)
+    {
+        Tree tree;
+        Model model;
+        fillRandom(tree, model, rng() % 400);
+
+        int lo = randomKey(), hi = lo + static_cast<int>(rng() % (keyRange / 2));
+        size_t expected = distance(model.lower_bound(lo), model.lower_bound(hi));
+        CHECK(tree.eraseRange(lo, hi) == expected);
+        model.erase(model.lower_bound(lo), model.lower_bound(hi));
+        checkWhole(tree, model, true);
+
+        if (!model.empty()) {
+            size_t first = rng() % model.size(), last = first + rng() % (model.size() - first + 1);
+            typename Tree::iterator after = tree.erase(next(tree.cbegin(), first), next(tree.cbegin(), last));
+            Model::iterator expectedAfter = model.erase(next(model.begin(), first), next(model.begin(), last));
+            CHECK(position(tree.begin(), after, tree.end()) == position(model.begin(), expectedAfter, model.end()));
+            checkWhole(tree, model, true);
+        }
+    }
+}
+
+static long plusValues(long a, long b) { return a + b; }
+
+// unionWith, intersectWith and differenceWith against the same set
+// operations on two models.
+template<typename Tree>
+static void checkSetAlgebra(const string& name)
+{
+    checking = name;
+    ThreadPool pool(3);
+    for (int round = 0; round < 30; ++round)
+    {
+        Model a, b;
+        Tree ta, tb, tc, td, te;
+        fillRandom(ta, a, rng() % 500);
+        fillRandom(tb, b, rng() % 500);
+        for (Model::iterator it = a.begin(); it != a.end(); ++it) {
+            tc.insert(*it);
+            te.insert(*it);
+        }
+        for (Model::iterator it = b.begin(); it != b.end(); ++it) td.insert(*it);
+
+        Model united = a, common, rest = a;
+        for (Model::iterator it = b.begin(); it != b.end(); ++it)
+        {
+            Model::iterator found = a.find(it->first);
+            if (found != a.end()) {
+                united[it->first] = found->second + it->second;
+                common[it->first] = found->second + it->second;
+                rest.erase(it->first);
+            }
+            else united.insert(*it);
+        }
+
+        // Alternate between the shared pool and one of our own
+        if (round % 2) ta.unionWith(tb, plusValues, pool);
+        else ta.unionWith(tb, plusValues);
+        CHECK(tb.empty());
+        checkWhole(ta, united, true);
+
+        tc.intersectWith(td, plusValues, pool);
+        CHECK(td.empty());
+        checkWhole(tc, common, true);
+
+        Tree other;
+        for (Model::iterator it = b.begin(); it != b.end(); ++it) other.insert(*it);
+        te.differenceWith(other, pool);
+        checkWhole(te, rest, true);
+        CHECK(sameItems(other, b));
+    }
+}
+
+// select, rank, countInRange and distance against positions in the model.
+template<typename Tree>
+static void checkOrderStatistics(const string& name)
+{
+    checking = name;
+    Tree tree;
+    Model model;
+    for (int round = 0; round < 20; ++round)
+    {
+        fillRandom(tree, model, 100);
+        for (int i = 0; i < 30; ++i) {
+            int key = randomKey();
+            tree.remove(key);
+            model.erase(key);
+        }
+
+        vector<int> keys;
+        for (Model::iterator it = model.begin(); it != model.end(); ++it) keys.push_back(it->first);
+        for (size_t k = 0; k < keys.size(); ++k) CHECK(tree.select(k)->first == keys[k]);
+        CHECK(tree.select(keys.size()) == tree.end());
+
+        for (int i = 0; i < 50; ++i)
+        {
+            int lo = randomKey(), hi = randomKey();
+            size_t below = lower_bound(keys.begin(), keys.end(), lo) - keys.begin();
+            CHECK(tree.rank(lo) == below);
+            size_t inRange = lo < hi ? lower_bound(keys.begin(), keys.end(), hi) - keys.begin() - below : 0;
+            CHECK(tree.countInRange(lo, hi) == inRange);
+            ptrdiff_t between = (lower_bound(keys.begin(), keys.end(), hi) - keys.begin()) - static_cast<ptrdiff_t>(below);
+            CHECK(tree.distance(tree.lower_bound(lo), tree.lower_bound(hi)) == between);
+        }
+        if (!keys.empty()) {
+            size_t first = rng() % keys.size(), last = rng() % keys.size();
+            CHECK(tree.distance(tree.select(first), tree.select(last))
+                  == static_cast<ptrdiff_t>(last) - static_cast<ptrdiff_t>(first));
+            CHECK(tree.distance(tree.select(first), tree.end())
+                  == static_cast<ptrdiff_t>(keys.size() - first));
+        }
+        checkWhole(tree, model, true);
+    }
+}
+
+// Aggregates stay right through inserts, overwrites, removals, in-place
+// updates followed by refresh(), and range erasure.
+template<typename Tree, typename Monoid>
+static void checkAggregates(const string& name)
+{
+    checking = name;
+    Tree tree;
+    Model model;
+    for (int round = 0; round < 20; ++round)
+    {
+        fillRandom(tree, model, 120);
+        for (int i = 0; i < 40; ++i) {
+            int key = randomKey();
+            tree.remove(key);
+            model.erase(key);
+        }
+        for (int i = 0; i < 20; ++i) {
+            int key = randomKey();
+            typename Tree::iterator it = tree.find(key);
+            if (it == tree.end()) continue;
+            it->second = randomValue();
+            tree.refresh(it);
+            model[key] = it->second;
+        }
+        tree.upsert(randomKey(), [](long& v) { v += 11; });
+        model.clear();
+        for (typename Tree::iterator it = tree.begin(); it != tree.end(); ++it) model.insert(*it);
+
+        for (int i = 0; i < 50; ++i)
+        {
+            int lo = randomKey(), hi = randomKey();
+            typename Monoid::type expected = Monoid::identity();
+            for (Model::iterator it = model.lower_bound(lo); lo < hi && it != model.lower_bound(hi); ++it)
+                expected = Monoid::combine(expected, Monoid::lift(it->second));
+            CHECK(tree.aggregate(lo, hi) == expected);
+        }
+        typename Monoid::type all = Monoid::identity();
+        for (Model::iterator it = model.begin(); it != model.end(); ++it)
+            all = Monoid::combine(all, Monoid::lift(it->second));
+        CHECK(tree.aggregate() == all);
+        checkWhole(tree, model, true);
+    }
+
+    int lo = randomKey(), hi = lo + keyRange / 3;
+    tree.eraseRange(lo, hi);
+    model.erase(model.lower_bound(lo), model.lower_bound(hi));
+    typename Monoid::type all = Monoid::identity();
+    for (Model::iterator it = model.begin(); it != model.end(); ++it)
+        all = Monoid::combine(all, Monoid::lift(it->second));
+    CHECK(tree.aggregate() == all);
+}
+
+typedef IndexedAVLNode<int, long> ArenaNode;
+typedef AVLTree<int, long, less<int>, ArenaNode, NodeArena<ArenaNode> > ArenaTree;
+
+// Arguments that refer into the tree's own nodes must survive the
+// NodeArena moving every node to make room for the new one.
+static void checkArenaAliasing()
+{
+    checking = "arena aliasing";
+    const int n = 64; // the arena's initial capacity, so the next node moves them all
+
+    ArenaTree insertCopy;
+    for (int i = 1; i <= n; ++i) insertCopy.insert(make_pair(2 * i, static_cast<long>(i)));
+    insertCopy.insert(insertCopy.min());
+    CHECK(distance(insertCopy.begin(), insertCopy.end()) == n);
+
+    ArenaTree findOrInsert;
+    for (int i = 1; i <= n; ++i) findOrInsert.insert(make_pair(2 * i, static_cast<long>(i)));
+    findOrInsert.findOrInsert(findOrInsert.max().first + 1) = 7;
+    CHECK(findOrInsert.max().first == 2 * n + 1 && findOrInsert.max().second == 7);
+
+    ArenaTree emplace;
+    for (int i = 1; i <= n; ++i) emplace.insert(make_pair(2 * i, static_cast<long>(i)));
+    emplace.emplace(emplace.min().first + 1, emplace.max().second);
+    ArenaTree::iterator it = emplace.find(3);
+    CHECK(it != emplace.end() && it->second == n);
+
+    ArenaTree tryEmplace;
+    for (int i = 1; i <= n; ++i) tryEmplace.insert(make_pair(2 * i, static_cast<long>(i)));
+    tryEmplace.try_emplace(tryEmplace.min().first - 1, tryEmplace.max().second);
+    CHECK(tryEmplace.min().first == 1 && tryEmplace.min().second == n);
+
+    ArenaTree hinted;
+    for (int i = 1; i <= n; ++i) hinted.insert(make_pair(2 * i, static_cast<long>(i)));
+    hinted.insert(hinted.end(), make_pair(hinted.max().first + 2, hinted.min().second));
+    CHECK(hinted.max().first == 2 * n + 2 && hinted.max().second == 1);
+    CHECK(hinted.isBalanced());
+}
+
+struct MergeFailed { };
+
+// A merge that throws on the third collision.
+struct ThrowingMerge
+{
+    int calls;
+    ThrowingMerge() : calls(0) { }
+    int operator()(int a, int b)
+    {
+        if (++calls == 3) throw MergeFailed();
+        return a + b;
+    }
+};
+
+// A throwing merge must leave every key in the tree and leak no node;
+// LeakSanitizer checks the latter at exit.
+static void checkThrowingMerge()
+{
+    checking = "throwing merge";
+    AVLTree<int, int> a, b;
+    for (int i = 0; i < 100; ++i) a.insert(make_pair(2 * i, 1));
+    for (int i = 0; i < 100; ++i) b.insert(make_pair(3 * i, 1));
+
+    bool threw = false;
+    try { a.unionWith(b, ThrowingMerge()); }
+    catch (const MergeFailed&) { threw = true; }
+    CHECK(threw);
+    CHECK(b.empty());
+    CHECK(distance(a.begin(), a.end()) == 166);
+    CHECK(a.isBalanced());
+
+    AVLTree<int, int> c, d;
+    for (int i = 0; i < 100; ++i) c.insert(make_pair(2 * i, 1));
+    for (int i = 0; i < 100; ++i) d.insert(make_pair(3 * i, 1));
+    threw = false;
+    try { c.intersectWith(d, ThrowingMerge()); }
+    catch (const MergeFailed&) { threw = true; }
+    CHECK(threw);
+    CHECK(d.empty());
+    CHECK(distance(c.begin(), c.end()) == 34);
+    CHECK(c.isBalanced());
+}
+
+int main()
+{
+    typedef less<int> L;
+
+    checkBasics<BinarySearchTree<int, long> >("BinarySearchTree<Node>", false);
+    checkBasics<BinarySearchTree<int, long, L, IndexedNode<int, long>, NodeArena<IndexedNode<int, long> > > >(
+        "BinarySearchTree<IndexedNode, NodeArena>", false);
+    checkBasics<BinarySearchTree<int, long, L, ThreadedNode<int, long> > >("BinarySearchTree<ThreadedNode>", false);
+    checkBasics<BinarySearchTree<int, long, L, Node<int, long>, HeapNodeAllocator<Node<int, long> > > >(
+        "BinarySearchTree<Node, HeapNodeAllocator>", false);
+
+    checkBasics<AVLTree<int, long> >("AVLTree<AVLNode>", true);
+    checkBasics<AVLTree<int, long, L, AVLNode<int, long>, HeapNodeAllocator<AVLNode<int, long> > > >(
+        "AVLTree<AVLNode, HeapNodeAllocator>", true);
+    checkBasics<AVLTree<int, long, L, CompactAVLNode<int, long> > >("AVLTree<CompactAVLNode>", true);
+    checkBasics<ArenaTree>("AVLTree<IndexedAVLNode, NodeArena>", true);
+    checkBasics<AVLTree<int, long, L, ThreadedAVLNode<int, long> > >("AVLTree<ThreadedAVLNode>", true);
+    checkBasics<AVLTree<int, long, L, OrderStatAVLNode<int, long> > >("AVLTree<OrderStatAVLNode>", true);
+    checkBasics<AVLTree<int, long, L, AggregateAVLNode<int, long, SumOf<long> > > >(
+        "AVLTree<AggregateAVLNode>", true);
+
+    checkBulkBuilds<BinarySearchTree<int, long> >("BinarySearchTree<Node> bulk builds");
+    checkBulkBuilds<BinarySearchTree<int, long, L, IndexedNode<int, long>, NodeArena<IndexedNode<int, long> > > >(
+        "BinarySearchTree<IndexedNode, NodeArena> bulk builds");
+    checkBulkBuilds<AVLTree<int, long> >("AVLTree<AVLNode> bulk builds");
+    checkBulkBuilds<ArenaTree>("AVLTree<IndexedAVLNode, NodeArena> bulk builds");
+    checkBulkBuilds<AVLTree<int, long, L, ThreadedAVLNode<int, long> > >("AVLTree<ThreadedAVLNode> bulk builds");
+    checkBulkBuilds<AVLTree<int, long, L, OrderStatAVLNode<int, long> > >("AVLTree<OrderStatAVLNode> bulk builds");
+    checkBulkBuilds<AVLTree<int, long, L, AggregateAVLNode<int, long, SumOf<long> > > >(
+        "AVLTree<AggregateAVLNode> bulk builds");
+
+    checkParallelPasses<BinarySearchTree<int, long> >("BinarySearchTree<Node> parallel passes");
+    checkParallelPasses<AVLTree<int, long> >("AVLTree<AVLNode> parallel passes");
+    checkParallelPasses<ArenaTree>("AVLTree<IndexedAVLNode, NodeArena> parallel passes");
+    checkParallelPasses<AVLTree<int, long, L, ThreadedAVLNode<int, long> > >("AVLTree<ThreadedAVLNode> parallel passes");
+
+    checkSplitJoin<AVLTree<int, long> >("AVLTree<AVLNode> split/join");
+    checkSplitJoin<AVLTree<int, long, L, AVLNode<int, long>, HeapNodeAllocator<AVLNode<int, long> > > >(
+        "AVLTree<AVLNode, HeapNodeAllocator> split/join");
+    checkSplitJoin<AVLTree<int, long, L, CompactAVLNode<int, long> > >("AVLTree<CompactAVLNode> split/join");
+    checkSplitJoin<AVLTree<int, long, L, ThreadedAVLNode<int, long> > >("AVLTree<ThreadedAVLNode> split/join");
+    checkSplitJoin<AVLTree<int, long, L, OrderStatAVLNode<int, long> > >("AVLTree<OrderStatAVLNode> split/join");
+
+    checkEraseRange<AVLTree<int, long> >("AVLTree<AVLNode> eraseRange");
+    checkEraseRange<AVLTree<int, long, L, AVLNode<int, long>, HeapNodeAllocator<AVLNode<int, long> > > >(
+        "AVLTree<AVLNode, HeapNodeAllocator> eraseRange");
+    checkEraseRange<ArenaTree>("AVLTree<IndexedAVLNode, NodeArena> eraseRange");
+    checkEraseRange<AVLTree<int, long, L, ThreadedAVLNode<int, long> > >("AVLTree<ThreadedAVLNode> eraseRange");
+    checkEraseRange<AVLTree<int, long, L, OrderStatAVLNode<int, long> > >("AVLTree<OrderStatAVLNode> eraseRange");
+
+    checkSetAlgebra<AVLTree<int, long> >("AVLTree<AVLNode> set algebra");
+    checkSetAlgebra<AVLTree<int, long, L, ThreadedAVLNode<int, long> > >("AVLTree<ThreadedAVLNode> set algebra");
+    checkSetAlgebra<AVLTree<int, long, L, AggregateAVLNode<int, long, SumOf<long> > > >(
+        "AVLTree<AggregateAVLNode> set algebra");
+
+    checkOrderStatistics<AVLTree<int, long, L, OrderStatAVLNode<int, long> > >("AVLTree<OrderStatAVLNode> order statistics");
+
+    checkAggregates<AVLTree<int, long, L, AggregateAVLNode<int, long, SumOf<long> > >, SumOf<long> >(
+        "AVLTree<AggregateAVLNode<SumOf>> aggregates");
+    checkAggregates<AVLTree<int, long, L, AggregateAVLNode<int, long, MinOf<long> > >, MinOf<long> >(
+        "AVLTree<AggregateAVLNode<MinOf>> aggregates");
+
+    checkArenaAliasing();
+    checkThrowingMerge();
+
+    if (failures > 0) {
+        cerr << failures << " checks failed" << endl;
+        return 1;
+    }
+    cout << "all checks passed" << endl;
+    return 0;
+}
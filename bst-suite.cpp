@@ -0,0 +1,334 @@
+#include <iostream>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <cstdlib>
+#include <cstdio>
+#include <cmath>
+#include <string>
+#include <map>
+#include <algorithm>
+#include "bst.h"
+#include "avlbst.h"
+#include "perf_counters.h"
+
+using namespace std;
+
+/*
+ * Workload suite: BinarySearchTree, AVLTree and std::map under the same
+ * operation sequences, written to stdout as CSV for regression tracking.
+ *
+ *   bst-suite [--perf] [max-size] [min-size] > results.csv
+ *
+ * Sizes go from min-size (default 1000) up to max-size (default 1000000)
+ * in steps of 10, for int and std::string keys, over four workloads:
+ *
+ *   sequential  keys inserted, looked up and removed in increasing order
+ *   random      keys inserted and removed in random order, uniform lookups
+ *   zipfian     random inserts, lookups skewed towards a few hot keys
+ *   mixed       90% lookups, 5% inserts, 5% removes of random keys, half
+ *               of them missing, on a preloaded tree
+ *
+ * Every operation is timed on its own, so the percentiles include one
+ * steady_clock read (some tens of ns) and so does ns_per_op. iterate is
+ * timed per full pass and reports ns per item, with no percentiles.
+ *
+ * With --perf, each operation type is also wrapped in Linux hardware
+ * counters (see perf_counters.h) and the *_per_op columns give cycles,
+ * instructions and L1D, LLC, branch and dTLB misses per operation, clock
+ * reads included. Counters the machine does not offer, or that
+ * perf_event_paranoid forbids, are left empty, and so is everything
+ * without --perf.
+ *
+ * A plain BinarySearchTree fed sorted keys turns into a list, costing
+ * O(n^2) to build; it only runs the sequential workload up to
+ * sequentialBstLimit keys.
+ *
+ * All three trees see exactly the same keys, so they must agree on how
+ * many lookups hit and how many items they hold; the exit status is 1
+ * if they do not.
+ */
+
+static const size_t sequentialBstLimit = 20000;
+
+// Set by --perf: counts hardware events around every timed loop.
+static PerfCounters* counters = NULL;
+
+template<typename K> K makeKey(uint32_t i);
+
+template<> int makeKey<int>(uint32_t i)
+{
+    return static_cast<int>(i);
+}
+
+// Zero padded, so the strings sort in the same order as the numbers.
+template<> string makeKey<string>(uint32_t i)
+{
+    char buffer[16];
+    snprintf(buffer, sizeof(buffer), "k%010u", i);
+    return buffer;
+}
+
+// Draws ranks 0..n-1 with probability proportional to 1 / (rank + 1)^theta,
+// the YCSB generator (Gray et al., "Quickly generating billion-record
+// synthetic databases").
+class Zipf
+{
+public:
+    Zipf(size_t n, double theta) : n_(n)
+    {
+        double zetaN = 0;
+        for (size_t i = 1; i <= n; ++i) zetaN += 1.0 / pow(static_cast<double>(i), theta);
+        double zeta2 = 1.0 + 1.0 / pow(2.0, theta);
+        alpha_ = 1.0 / (1.0 - theta);
+        eta_ = (1.0 - pow(2.0 / n, 1.0 - theta)) / (1.0 - zeta2 / zetaN);
+        half_ = 1.0 + pow(0.5, theta);
+        zetaN_ = zetaN;
+    }
+
+    size_t operator()(mt19937& rng)
+    {
+        double u = uniform_real_distribution<double>(0.0, 1.0)(rng);
+        double uz = u * zetaN_;
+        if (uz < 1.0) return 0;
+        if (uz < half_) return 1;
+        size_t rank = static_cast<size_t>(n_ * pow(eta_ * u - eta_ + 1.0, alpha_));
+        return min(rank, n_ - 1);
+    }
+
+private:
+    size_t n_;
+    double zetaN_, alpha_, eta_, half_;
+};
+
+// One workload: every key sequence the trees are put through.
+template<typename K>
+struct Workload
+{
+    const char* name;
+    vector<K> inserts;
+    vector<K> finds;
+    vector<K> removes;
+    vector<pair<int, K> > mixed; // 0 find, 1 insert, 2 remove
+};
+
+template<typename K>
+static Workload<K> makeWorkload(const char* name, size_t n, mt19937& rng)
+{
+    Workload<K> w;
+    w.name = name;
+    string kind = name;
+
+    // even numbers, so the mixed workload has odd ones to miss with
+    vector<uint32_t> ids(n);
+    for (size_t i = 0; i < n; ++i) ids[i] = static_cast<uint32_t>(2 * i);
+
+    vector<uint32_t> order = ids;
+    if (kind != "sequential") shuffle(order.begin(), order.end(), rng);
+    for (size_t i = 0; i < n; ++i) w.inserts.push_back(makeKey<K>(order[i]));
+
+    if (kind == "sequential") {
+        for (size_t i = 0; i < n; ++i) w.finds.push_back(makeKey<K>(ids[i]));
+        w.removes = w.inserts;
+    }
+    else if (kind == "random") {
+        for (size_t i = 0; i < n; ++i) w.finds.push_back(makeKey<K>(ids[rng() % n]));
+        shuffle(order.begin(), order.end(), rng);
+        for (size_t i = 0; i < n; ++i) w.removes.push_back(makeKey<K>(order[i]));
+    }
+    else if (kind == "zipfian") {
+        // hot ranks are spread over the key range rather than bunched at the low keys
+        Zipf zipf(n, 0.99);
+        for (size_t i = 0; i < n; ++i) w.finds.push_back(makeKey<K>(order[zipf(rng)]));
+    }
+    else {
+        for (size_t i = 0; i < n; ++i)
+        {
+            unsigned roll = rng() % 100;
+            int op = roll < 90 ? 0 : (roll < 95 ? 1 : 2);
+            w.mixed.push_back(make_pair(op, makeKey<K>(static_cast<uint32_t>(rng() % (2 * n)))));
+        }
+    }
+    return w;
+}
+
+template<typename Tree, typename K>
+static void put(Tree& tree, const K& key, int value) { tree.insert(make_pair(key, value)); }
+
+template<typename K>
+static void put(map<K, int>& tree, const K& key, int value) { tree[key] = value; }
+
+template<typename Tree, typename K>
+static void drop(Tree& tree, const K& key) { tree.remove(key); }
+
+template<typename K>
+static void drop(map<K, int>& tree, const K& key) { tree.erase(key); }
+
+// Times ops calls of fn(i) one at a time into latencies, and returns the
+// whole loop's time in ns.
+template<typename Fn>
+static double timeEach(size_t ops, Fn fn, vector<uint32_t>& latencies)
+{
+    latencies.resize(ops);
+    if (counters != NULL) {
+        counters->clear();
+        counters->start();
+    }
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    chrono::steady_clock::time_point previous = start;
+    for (size_t i = 0; i < ops; ++i)
+    {
+        fn(i);
+        chrono::steady_clock::time_point now = chrono::steady_clock::now();
+        latencies[i] = static_cast<uint32_t>(chrono::duration_cast<chrono::nanoseconds>(now - previous).count());
+        previous = now;
+    }
+    if (counters != NULL) counters->stop();
+    return chrono::duration<double, nano>(previous - start).count();
+}
+
+static uint32_t percentile(vector<uint32_t>& sorted, double p)
+{
+    size_t at = static_cast<size_t>(p * (sorted.size() - 1));
+    return sorted[at];
+}
+
+static void writeRow(const char* tree, const char* key, const char* workload, const char* op, size_t size,
+                     size_t ops, double ns, vector<uint32_t>* latencies)
+{
+    cout << tree << ',' << key << ',' << workload << ',' << op << ',' << size << ',' << ops << ','
+         << ns / ops << ',' << ops / ns * 1000.0;
+    if (latencies != NULL && !latencies->empty())
+    {
+        sort(latencies->begin(), latencies->end());
+        cout << ',' << percentile(*latencies, 0.5) << ',' << percentile(*latencies, 0.9)
+             << ',' << percentile(*latencies, 0.99) << ',' << percentile(*latencies, 0.999)
+             << ',' << latencies->back();
+    }
+    else
+    {
+        cout << ",,,,,";
+    }
+    for (int e = 0; e < PerfCounters::EventCount; ++e)
+    {
+        cout << ',';
+        PerfCounters::Event event = static_cast<PerfCounters::Event>(e);
+        if (counters != NULL && counters->available(event)) cout << counters->count(event) / ops;
+    }
+    cout << endl;
+}
+
+// Puts a fresh Tree through w, writing one row per operation type, and
+// returns a checksum that must come out the same for every tree.
+template<typename Tree, typename K>
+static size_t runTree(const char* treeName, const char* keyName, const Workload<K>& w, size_t n)
+{
+    Tree tree;
+    vector<uint32_t> latencies;
+    size_t checksum = 0;
+
+    double ns = timeEach(w.inserts.size(), [&](size_t i) { put(tree, w.inserts[i], static_cast<int>(i)); },
+                         latencies);
+    writeRow(treeName, keyName, w.name, "insert", n, w.inserts.size(), ns, &latencies);
+
+    if (!w.finds.empty())
+    {
+        size_t hits = 0;
+        ns = timeEach(w.finds.size(), [&](size_t i) { hits += tree.find(w.finds[i]) != tree.end(); }, latencies);
+        writeRow(treeName, keyName, w.name, "find", n, w.finds.size(), ns, &latencies);
+        checksum += hits;
+    }
+
+    if (!w.mixed.empty())
+    {
+        size_t hits = 0;
+        ns = timeEach(w.mixed.size(), [&](size_t i) {
+            const pair<int, K>& op = w.mixed[i];
+            if (op.first == 0) hits += tree.find(op.second) != tree.end();
+            else if (op.first == 1) put(tree, op.second, static_cast<int>(i));
+            else drop(tree, op.second);
+        }, latencies);
+        writeRow(treeName, keyName, w.name, "mixed", n, w.mixed.size(), ns, &latencies);
+        checksum += hits;
+    }
+
+    const size_t passes = 3;
+    size_t items = 0;
+    if (counters != NULL) {
+        counters->clear();
+        counters->start();
+    }
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (size_t pass = 0; pass < passes; ++pass)
+    {
+        for (typename Tree::iterator it = tree.begin(); it != tree.end(); ++it) ++items;
+    }
+    ns = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
+    if (counters != NULL) counters->stop();
+    writeRow(treeName, keyName, w.name, "iterate", n, items, ns, NULL);
+    checksum += items;
+
+    if (!w.removes.empty())
+    {
+        ns = timeEach(w.removes.size(), [&](size_t i) { drop(tree, w.removes[i]); }, latencies);
+        writeRow(treeName, keyName, w.name, "remove", n, w.removes.size(), ns, &latencies);
+        checksum += tree.empty() ? 0 : 1;
+    }
+    return checksum;
+}
+
+template<typename K>
+static bool runKeyType(const char* keyName, size_t minSize, size_t maxSize)
+{
+    const char* workloads[] = { "sequential", "random", "zipfian", "mixed" };
+    bool agreed = true;
+    mt19937 rng(2024);
+
+    for (size_t n = minSize; n <= maxSize; n *= 10)
+    {
+        for (size_t i = 0; i < sizeof(workloads) / sizeof(workloads[0]); ++i)
+        {
+            Workload<K> w = makeWorkload<K>(workloads[i], n, rng);
+
+            size_t expected = runTree<map<K, int> >("std::map", keyName, w, n);
+            if (runTree<AVLTree<K, int> >("AVLTree", keyName, w, n) != expected) agreed = false;
+            if (string(w.name) != "sequential" || n <= sequentialBstLimit)
+            {
+                if (runTree<BinarySearchTree<K, int> >("BinarySearchTree", keyName, w, n) != expected) agreed = false;
+            }
+            if (!agreed) cerr << "trees disagree on " << keyName << " " << w.name << " " << n << endl;
+        }
+        if (n > maxSize / 10) break;
+    }
+    return agreed;
+}
+
+int main(int argc, char *argv[])
+{
+    size_t sizes[2] = { 1000000, 1000 };
+    size_t given = 0;
+    bool perf = false;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (string(argv[i]) == "--perf") perf = true;
+        else if (given < 2) sizes[given++] = strtoul(argv[i], NULL, 10);
+    }
+    size_t maxSize = sizes[0];
+    size_t minSize = sizes[1] > 0 ? sizes[1] : 1;
+
+    PerfCounters hardware;
+    if (perf) {
+        counters = &hardware;
+        if (!hardware.anyAvailable()) cerr << "no hardware counters available, *_per_op columns stay empty" << endl;
+    }
+
+    cout << "tree,key,workload,op,size,ops,ns_per_op,mops_per_s,p50_ns,p90_ns,p99_ns,p999_ns,max_ns";
+    for (int e = 0; e < PerfCounters::EventCount; ++e)
+    {
+        cout << ',' << PerfCounters::name(static_cast<PerfCounters::Event>(e)) << "_per_op";
+    }
+    cout << endl;
+    bool agreed = runKeyType<int>("int", minSize, maxSize);
+    agreed = runKeyType<string>("string", minSize, maxSize) && agreed;
+    return agreed ? 0 : 1;
+}
@@ -5,11 +5,30 @@
 
 using namespace std;
 
+// An AVLTree that can print the balance of every node, in key order.
+class DebugTree : public AVLTree<int, double>
+{
+public:
+    void showBalanceOfAll()
+    {
+        int i = 1;
+        for (iterator it = begin(); it != end(); ++it)
+        {
+            AVLNode<int, double>* avlNode = internalFind(it->first);
+            if (avlNode != nullptr)
+            {
+                cout << " [" << i << "] -> " << static_cast<int>(avlNode->getBalance());
+            }
+            i++;
+        }
+        cout << endl;
+    }
+};
 
 int main(int argc, char *argv[])
 {
 
-    AVLTree<int, double> bst;
+    DebugTree bst;
 	bst.insert(std::make_pair(43, 1.0));
 	bst.insert(std::make_pair(-109, 1.0));
 	bst.insert(std::make_pair(107, 1.0));
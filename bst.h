@@ -4,21 +4,38 @@
 #include <iostream>
 #include <exception>
 #include <cstdlib>
+#include <cstdint>
 #include <utility>
+#include <new>
+#include <type_traits>
+#include <tuple>
+#include <vector>
+#include <iterator>
+#include <algorithm>
+#include <functional>
+#include <string>
+#include "node_pool.h"
+#include "thread_pool.h"
+#include "tree_trace.h"
+#include "tree_stats.h"
 
 /**
- * A templated class for a Node in a search tree.
- * The getters for parent/left/right are virtual so
- * that they can be overridden for future kinds of
- * search trees, such as Red Black trees, Splay trees,
- * and AVL trees.
+ * The common part of every node in a search tree: the item and the
+ * parent/left/right links.
+ *
+ * Derived is the concrete node type (CRTP), so the links are stored and
+ * returned as Derived* and the getters are plain inline functions. An
+ * AVL tree walking its AVLNodes therefore pays no virtual call and no
+ * cast per step, and nodes carry no vtable pointer.
  */
-template <typename Key, typename Value>
-class Node
+template <typename Key, typename Value, typename Derived>
+class BasicNode
 {
 public:
-    Node(const Key& key, const Value& value, Node<Key, Value>* parent);
-    virtual ~Node();
+    BasicNode(const Key& key, const Value& value, Derived* parent);
+    template <typename... Args>
+    BasicNode(Derived* parent, Args&&... args);
+    ~BasicNode();
 
     const std::pair<const Key, Value>& getItem() const;
     std::pair<const Key, Value>& getItem();
@@ -26,20 +43,36 @@ public:
     const Value& getValue() const;
     Value& getValue();
 
-    virtual Node<Key, Value>* getParent() const;
-    virtual Node<Key, Value>* getLeft() const;
-    virtual Node<Key, Value>* getRight() const;
+    Derived* getParent() const;
+    Derived* getLeft() const;
+    Derived* getRight() const;
+    Derived* getChild(bool right) const;
 
-    void setParent(Node<Key, Value>* parent);
-    void setLeft(Node<Key, Value>* left);
-    void setRight(Node<Key, Value>* right);
+    void setParent(Derived* parent);
+    void setLeft(Derived* left);
+    void setRight(Derived* right);
     void setValue(const Value &value);
 
 protected:
     std::pair<const Key, Value> item_;
-    Node<Key, Value>* parent_;
-    Node<Key, Value>* left_;
-    Node<Key, Value>* right_;
+    Derived* parent_;
+    Derived* left_;
+    Derived* right_;
+};
+
+/**
+ * A templated class for a Node in a plain binary search tree.
+ * Other kinds of search trees (AVL, Red Black, Splay...) define
+ * their own node type on top of BasicNode and hand it to the tree
+ * as a template argument.
+ */
+template <typename Key, typename Value>
+class Node : public BasicNode<Key, Value, Node<Key, Value> >
+{
+public:
+    Node(const Key& key, const Value& value, Node<Key, Value>* parent);
+    template <typename... Args>
+    Node(Node<Key, Value>* parent, Args&&... args);
 };
 
 /*
@@ -51,8 +84,8 @@ protected:
 /**
 * Explicit constructor for a node.
 */
-template<typename Key, typename Value>
-Node<Key, Value>::Node(const Key& key, const Value& value, Node<Key, Value>* parent) :
+template<typename Key, typename Value, typename Derived>
+BasicNode<Key, Value, Derived>::BasicNode(const Key& key, const Value& value, Derived* parent) :
     item_(key, value),
     parent_(parent),
     left_(NULL),
@@ -61,13 +94,29 @@ Node<Key, Value>::Node(const Key& key, const Value& value, Node<Key, Value>* par
 
 }
 
+/**
+* Emplacing constructor: the item is built in place from args, which go
+* straight to the matching std::pair constructor (key and value, a pair
+* to move from, or piecewise_construct and two tuples).
+*/
+template<typename Key, typename Value, typename Derived>
+template<typename... Args>
+BasicNode<Key, Value, Derived>::BasicNode(Derived* parent, Args&&... args) :
+    item_(std::forward<Args>(args)...),
+    parent_(parent),
+    left_(NULL),
+    right_(NULL)
+{
+
+}
+
 /**
 * Destructor, which does not need to do anything since the pointers inside of a node
 * are only used as references to existing nodes. The nodes pointed to by parent/left/right
 * are freed by the BinarySearchTree.
 */
-template<typename Key, typename Value>
-Node<Key, Value>::~Node()
+template<typename Key, typename Value, typename Derived>
+BasicNode<Key, Value, Derived>::~BasicNode()
 {
 
 }
@@ -75,8 +124,8 @@ Node<Key, Value>::~Node()
 /**
 * A const getter for the item.
 */
-template<typename Key, typename Value>
-const std::pair<const Key, Value>& Node<Key, Value>::getItem() const
+template<typename Key, typename Value, typename Derived>
+const std::pair<const Key, Value>& BasicNode<Key, Value, Derived>::getItem() const
 {
     return item_;
 }
@@ -84,8 +133,8 @@ const std::pair<const Key, Value>& Node<Key, Value>::getItem() const
 /**
 * A non-const getter for the item.
 */
-template<typename Key, typename Value>
-std::pair<const Key, Value>& Node<Key, Value>::getItem()
+template<typename Key, typename Value, typename Derived>
+std::pair<const Key, Value>& BasicNode<Key, Value, Derived>::getItem()
 {
     return item_;
 }
@@ -93,8 +142,8 @@ std::pair<const Key, Value>& Node<Key, Value>::getItem()
 /**
 * A const getter for the key.
 */
-template<typename Key, typename Value>
-const Key& Node<Key, Value>::getKey() const
+template<typename Key, typename Value, typename Derived>
+const Key& BasicNode<Key, Value, Derived>::getKey() const
 {
     return item_.first;
 }
@@ -102,8 +151,8 @@ const Key& Node<Key, Value>::getKey() const
 /**
 * A const getter for the value.
 */
-template<typename Key, typename Value>
-const Value& Node<Key, Value>::getValue() const
+template<typename Key, typename Value, typename Derived>
+const Value& BasicNode<Key, Value, Derived>::getValue() const
 {
     return item_.second;
 }
@@ -111,44 +160,55 @@ const Value& Node<Key, Value>::getValue() const
 /**
 * A non-const getter for the value.
 */
-template<typename Key, typename Value>
-Value& Node<Key, Value>::getValue()
+template<typename Key, typename Value, typename Derived>
+Value& BasicNode<Key, Value, Derived>::getValue()
 {
     return item_.second;
 }
 
 /**
-* An implementation of the virtual function for retreiving the parent.
+* A getter for the parent, already typed as the concrete node.
 */
-template<typename Key, typename Value>
-Node<Key, Value>* Node<Key, Value>::getParent() const
+template<typename Key, typename Value, typename Derived>
+Derived* BasicNode<Key, Value, Derived>::getParent() const
 {
     return parent_;
 }
 
 /**
-* An implementation of the virtual function for retreiving the left child.
+* A getter for the left child, already typed as the concrete node.
 */
-template<typename Key, typename Value>
-Node<Key, Value>* Node<Key, Value>::getLeft() const
+template<typename Key, typename Value, typename Derived>
+Derived* BasicNode<Key, Value, Derived>::getLeft() const
 {
     return left_;
 }
 
 /**
-* An implementation of the virtual function for retreiving the right child.
+* A getter for the right child, already typed as the concrete node.
 */
-template<typename Key, typename Value>
-Node<Key, Value>* Node<Key, Value>::getRight() const
+template<typename Key, typename Value, typename Derived>
+Derived* BasicNode<Key, Value, Derived>::getRight() const
 {
     return right_;
 }
 
+/**
+* Picks the right child if right is true, the left one otherwise.
+* Searches use this instead of branching between getLeft() and getRight()
+* so the compiler can select the link without a branch.
+*/
+template<typename Key, typename Value, typename Derived>
+Derived* BasicNode<Key, Value, Derived>::getChild(bool right) const
+{
+    return right ? right_ : left_;
+}
+
 /**
 * A setter for setting the parent of a node.
 */
-template<typename Key, typename Value>
-void Node<Key, Value>::setParent(Node<Key, Value>* parent)
+template<typename Key, typename Value, typename Derived>
+void BasicNode<Key, Value, Derived>::setParent(Derived* parent)
 {
     parent_ = parent;
 }
@@ -156,8 +216,8 @@ void Node<Key, Value>::setParent(Node<Key, Value>* parent)
 /**
 * A setter for setting the left child of a node.
 */
-template<typename Key, typename Value>
-void Node<Key, Value>::setLeft(Node<Key, Value>* left)
+template<typename Key, typename Value, typename Derived>
+void BasicNode<Key, Value, Derived>::setLeft(Derived* left)
 {
     left_ = left;
 }
@@ -165,8 +225,8 @@ void Node<Key, Value>::setLeft(Node<Key, Value>* left)
 /**
 * A setter for setting the right child of a node.
 */
-template<typename Key, typename Value>
-void Node<Key, Value>::setRight(Node<Key, Value>* right)
+template<typename Key, typename Value, typename Derived>
+void BasicNode<Key, Value, Derived>::setRight(Derived* right)
 {
     right_ = right;
 }
@@ -174,12 +234,33 @@ void Node<Key, Value>::setRight(Node<Key, Value>* right)
 /**
 * A setter for the value of a node.
 */
-template<typename Key, typename Value>
-void Node<Key, Value>::setValue(const Value& value)
+template<typename Key, typename Value, typename Derived>
+void BasicNode<Key, Value, Derived>::setValue(const Value& value)
 {
     item_.second = value;
 }
 
+/**
+* Explicit constructor for a plain BST node.
+*/
+template<typename Key, typename Value>
+Node<Key, Value>::Node(const Key& key, const Value& value, Node<Key, Value>* parent) :
+    BasicNode<Key, Value, Node<Key, Value> >(key, value, parent)
+{
+
+}
+
+/**
+* Emplacing constructor, see BasicNode.
+*/
+template<typename Key, typename Value>
+template<typename... Args>
+Node<Key, Value>::Node(Node<Key, Value>* parent, Args&&... args) :
+    BasicNode<Key, Value, Node<Key, Value> >(parent, std::forward<Args>(args)...)
+{
+
+}
+
 /*
   ---------------------------------------
   End implementations for the Node class.
@@ -187,590 +268,3087 @@ void Node<Key, Value>::setValue(const Value& value)
 */
 
 /**
-* A templated unbalanced binary search tree.
-*/
-template <typename Key, typename Value>
-class BinarySearchTree
+ * The index-linked counterpart of BasicNode, for trees that keep all of
+ * their nodes in one contiguous NodeArena (see node_pool.h).
+ *
+ * Each link is a signed 32-bit offset, counted in nodes, from this node
+ * to the linked one; 0 means NULL since a node never links to itself.
+ * That halves the three links compared to 64-bit pointers, and because
+ * the offsets are relative the whole array can be moved or written out
+ * as-is. The getters and setters still speak Derived*, so the tree code
+ * (rotations, nodeSwap, the iterator) is exactly the same.
+ *
+ * Nodes must live in the same array, so only use these with NodeArena:
+ *   BinarySearchTree<int, int, std::less<int>, IndexedNode<int, int>, NodeArena<IndexedNode<int, int> > >
+ */
+template <typename Key, typename Value, typename Derived>
+class BasicIndexedNode
 {
 public:
-    BinarySearchTree(); //TODO
-    virtual ~BinarySearchTree(); //TODO
-    virtual void insert(const std::pair<const Key, Value>& keyValuePair); //TODO
-    virtual void remove(const Key& key); //TODO
-    void clear(); //TODO
-    bool isBalanced() const; //TODO
-    void print() const;
-    bool empty() const;
-
-    template<typename PPKey, typename PPValue>
-    friend void prettyPrintBST(BinarySearchTree<PPKey, PPValue> & tree);
-public:
-    /**
-    * An internal iterator class for traversing the contents of the BST.
-    */
-    class iterator  // TODO
-    {
-    public:
-        iterator();
-
-        std::pair<const Key,Value>& operator*() const;
-        std::pair<const Key,Value>* operator->() const;
+    BasicIndexedNode(const Key& key, const Value& value, Derived* parent);
+    template <typename... Args>
+    BasicIndexedNode(Derived* parent, Args&&... args);
 
-        bool operator==(const iterator& rhs) const;
-        bool operator!=(const iterator& rhs) const;
-
-        iterator& operator++();
+    const std::pair<const Key, Value>& getItem() const;
+    std::pair<const Key, Value>& getItem();
+    const Key& getKey() const;
+    const Value& getValue() const;
+    Value& getValue();
 
-    protected:
-        friend class BinarySearchTree<Key, Value>;
-        iterator(Node<Key,Value>* ptr);
-        Node<Key, Value> *current_;
-    };
+    Derived* getParent() const;
+    Derived* getLeft() const;
+    Derived* getRight() const;
+    Derived* getChild(bool right) const;
 
-public:
-    iterator begin() const;
-    iterator end() const;
-    iterator find(const Key& key) const;
-    Value& operator[](const Key& key);
-    Value const & operator[](const Key& key) const;
+    void setParent(Derived* parent);
+    void setLeft(Derived* left);
+    void setRight(Derived* right);
+    void setValue(const Value &value);
 
 protected:
-    // Mandatory helper functions
-    Node<Key, Value>* internalFind(const Key& k) const; // TODO
-    Node<Key, Value> *getSmallestNode() const;  // TODO
-    static Node<Key, Value>* predecessor(Node<Key, Value>* current); // TODO
-    // Note:  static means these functions don't have a "this" pointer
-    //        and instead just use the input argument.
-
-    // Provided helper functions
-    virtual void printRoot (Node<Key, Value> *r) const;
-    virtual void nodeSwap( Node<Key,Value>* n1, Node<Key,Value>* n2) ;
-
-    // Add helper functions here
+    Derived* follow(std::int32_t offset) const;
+    std::int32_t offsetTo(Derived* node) const;
 
-    int checkBalanced(Node<Key, Value>* n) const;
-    void clearHelper(Node<Key, Value>* current);
-
-    Node<Key, Value> *findMinInternal(Node<Key, Value>* root) const;
-    
+    std::pair<const Key, Value> item_;
+    std::int32_t parent_;
+    std::int32_t left_;
+    std::int32_t right_;
+};
 
-protected:
-    Node<Key, Value>* root_;
-    // You should not need other data members
+/**
+ * A plain BST node with 32-bit index links.
+ */
+template <typename Key, typename Value>
+class IndexedNode : public BasicIndexedNode<Key, Value, IndexedNode<Key, Value> >
+{
+public:
+    IndexedNode(const Key& key, const Value& value, IndexedNode<Key, Value>* parent);
+    template <typename... Args>
+    IndexedNode(IndexedNode<Key, Value>* parent, Args&&... args);
 };
 
 /*
---------------------------------------------------------------
-Begin implementations for the BinarySearchTree::iterator class.
----------------------------------------------------------------
+  -----------------------------------------
+  Begin implementations for the IndexedNode class.
+  -----------------------------------------
 */
 
 /**
-* Explicit constructor that initializes an iterator with a given node pointer.
-*
-* You will need to implement the unfinished functions of the iterator class.
-* Note: You do NOT need to check whether the iterator is about to dereference a NULL pointer
-* in operator*() or operator->() of the iterator. Just let it fault.
-* It is up to the user to ensure the iterator is not equal to the end() iterator.
+* The parent offset is taken from where the node is being constructed,
+* so it has to be constructed in its final slot.
 */
-template<class Key, class Value>
-BinarySearchTree<Key, Value>::iterator::iterator(Node<Key,Value> *ptr)
+template<typename Key, typename Value, typename Derived>
+BasicIndexedNode<Key, Value, Derived>::BasicIndexedNode(const Key& key, const Value& value, Derived* parent) :
+    item_(key, value),
+    parent_(0),
+    left_(0),
+    right_(0)
 {
-    // TODO DONE
-    current_ = ptr;
+    parent_ = offsetTo(parent);
 }
 
 /**
-* A default constructor that initializes the iterator to NULL.
+* Emplacing constructor, see BasicNode. Like the one above it has to run
+* in the node's final slot.
 */
-template<class Key, class Value>
-BinarySearchTree<Key, Value>::iterator::iterator() 
+template<typename Key, typename Value, typename Derived>
+template<typename... Args>
+BasicIndexedNode<Key, Value, Derived>::BasicIndexedNode(Derived* parent, Args&&... args) :
+    item_(std::forward<Args>(args)...),
+    parent_(0),
+    left_(0),
+    right_(0)
 {
-    // TODO DONE
-    current_ = NULL;
+    parent_ = offsetTo(parent);
 }
 
-/**
-* Provides access to the item.
-*/
-template<class Key, class Value>
-std::pair<const Key,Value> &
-BinarySearchTree<Key, Value>::iterator::operator*() const
+template<typename Key, typename Value, typename Derived>
+const std::pair<const Key, Value>& BasicIndexedNode<Key, Value, Derived>::getItem() const
 {
-    return current_->getItem();
+    return item_;
 }
 
-/**
-* Provides access to the address of the item.
-*/
-template<class Key, class Value>
-std::pair<const Key,Value> *
-BinarySearchTree<Key, Value>::iterator::operator->() const
+template<typename Key, typename Value, typename Derived>
+std::pair<const Key, Value>& BasicIndexedNode<Key, Value, Derived>::getItem()
 {
-    return &(current_->getItem());
+    return item_;
 }
 
-/**
-* Checks if 'this' iterator's internals have the same value
-* as 'rhs'
-*/
-template<class Key, class Value>
-bool
-BinarySearchTree<Key, Value>::iterator::operator==(
-    const BinarySearchTree<Key, Value>::iterator& rhs) const
+template<typename Key, typename Value, typename Derived>
+const Key& BasicIndexedNode<Key, Value, Derived>::getKey() const
 {
-    // TODO DONE
-    return current_ == rhs.current_;
+    return item_.first;
 }
 
-/**
-* Checks if 'this' iterator's internals have a different value
-* as 'rhs'
-*/
-template<class Key, class Value>
-bool
-BinarySearchTree<Key, Value>::iterator::operator!=(
-    const BinarySearchTree<Key, Value>::iterator& rhs) const
+template<typename Key, typename Value, typename Derived>
+const Value& BasicIndexedNode<Key, Value, Derived>::getValue() const
 {
-    // TODO DONE
-    return current_ != rhs.current_;
+    return item_.second;
 }
 
-
-/**
-* Advances the iterator's location using an in-order sequencing
-*/
-template<class Key, class Value>
-typename BinarySearchTree<Key, Value>::iterator&
-BinarySearchTree<Key, Value>::iterator::operator++()
+template<typename Key, typename Value, typename Derived>
+Value& BasicIndexedNode<Key, Value, Derived>::getValue()
 {
-    // TODO DONE
-    if (current_ == NULL) return *this;
-
-    if (current_->getRight() == NULL)
-    {
-        Node<Key, Value> *temp = current_->getParent();
-
-        while (temp != NULL)
-        {
-            if (current_ == temp->getLeft()) break;
-
-            current_ = current_->getParent();
-            temp = current_->getParent();
-        }
-
-        current_ = temp;
-    }
-    else
-    {
-        current_ = current_->getRight();
-
-        while (current_ != NULL &&  current_->getLeft() != NULL) {
-            current_ = current_->getLeft();
-        }
-    }
-
-    return *this; // or should i do without start
+    return item_.second;
 }
 
+template<typename Key, typename Value, typename Derived>
+Derived* BasicIndexedNode<Key, Value, Derived>::getParent() const
+{
+    return follow(parent_);
+}
 
-/*
--------------------------------------------------------------
-End implementations for the BinarySearchTree::iterator class.
--------------------------------------------------------------
-*/
+template<typename Key, typename Value, typename Derived>
+Derived* BasicIndexedNode<Key, Value, Derived>::getLeft() const
+{
+    return follow(left_);
+}
 
-/*
------------------------------------------------------
-Begin implementations for the BinarySearchTree class.
------------------------------------------------------
-*/
+template<typename Key, typename Value, typename Derived>
+Derived* BasicIndexedNode<Key, Value, Derived>::getRight() const
+{
+    return follow(right_);
+}
 
 /**
-* Default constructor for a BinarySearchTree, which sets the root to NULL.
-*
-* Your destructor will probably just call the clear function. The constructor should take constant time.
+* Selects the offset first and follows it once, so a search compiles to
+* a conditional move instead of a hard to predict branch.
 */
-template<class Key, class Value>
-BinarySearchTree<Key, Value>::BinarySearchTree() 
+template<typename Key, typename Value, typename Derived>
+Derived* BasicIndexedNode<Key, Value, Derived>::getChild(bool right) const
 {
-    // TODO DONE
-    root_ = NULL;
+    return follow(right ? right_ : left_);
 }
 
-template<typename Key, typename Value>
-BinarySearchTree<Key, Value>::~BinarySearchTree()
+template<typename Key, typename Value, typename Derived>
+void BasicIndexedNode<Key, Value, Derived>::setParent(Derived* parent)
 {
-    // TODO DONE
-    clear();
+    parent_ = offsetTo(parent);
 }
 
-/**
- * Returns true if tree is empty
-*/
-template<class Key, class Value>
-bool BinarySearchTree<Key, Value>::empty() const
+template<typename Key, typename Value, typename Derived>
+void BasicIndexedNode<Key, Value, Derived>::setLeft(Derived* left)
 {
-    return root_ == NULL;
+    left_ = offsetTo(left);
 }
 
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::print() const
+template<typename Key, typename Value, typename Derived>
+void BasicIndexedNode<Key, Value, Derived>::setRight(Derived* right)
 {
-    printRoot(root_);
-    std::cout << "\n";
+    right_ = offsetTo(right);
 }
 
-/**
-* Returns an iterator to the "smallest" item in the tree
-*/
-template<class Key, class Value>
-typename BinarySearchTree<Key, Value>::iterator
-BinarySearchTree<Key, Value>::begin() const
+template<typename Key, typename Value, typename Derived>
+void BasicIndexedNode<Key, Value, Derived>::setValue(const Value& value)
 {
-    BinarySearchTree<Key, Value>::iterator begin(getSmallestNode());
-    return begin;
+    item_.second = value;
 }
 
 /**
-* Returns an iterator whose value means INVALID
+* Turns a relative link back into a pointer; 0 is NULL.
 */
-template<class Key, class Value>
-typename BinarySearchTree<Key, Value>::iterator
-BinarySearchTree<Key, Value>::end() const
+template<typename Key, typename Value, typename Derived>
+Derived* BasicIndexedNode<Key, Value, Derived>::follow(std::int32_t offset) const
 {
-    BinarySearchTree<Key, Value>::iterator end(NULL);
-    return end;
+    if (offset == 0) return NULL;
+    return const_cast<Derived*>(static_cast<const Derived*>(this)) + offset;
 }
 
 /**
-* Returns an iterator to the item with the given key, k
-* or the end iterator if k does not exist in the tree
+* Turns a pointer to another node in the same array into a relative link.
 */
-template<class Key, class Value>
-typename BinarySearchTree<Key, Value>::iterator
-BinarySearchTree<Key, Value>::find(const Key & k) const
+template<typename Key, typename Value, typename Derived>
+std::int32_t BasicIndexedNode<Key, Value, Derived>::offsetTo(Derived* node) const
 {
-    Node<Key, Value> *curr = internalFind(k);
-    BinarySearchTree<Key, Value>::iterator it(curr);
-    return it;
+    if (node == NULL) return 0;
+    return static_cast<std::int32_t>(node - static_cast<const Derived*>(this));
 }
 
-/**
- * @precondition The key exists in the map
- * Returns the value associated with the key
- */
-template<class Key, class Value>
-Value& BinarySearchTree<Key, Value>::operator[](const Key& key)
+template<typename Key, typename Value>
+IndexedNode<Key, Value>::IndexedNode(const Key& key, const Value& value, IndexedNode<Key, Value>* parent) :
+    BasicIndexedNode<Key, Value, IndexedNode<Key, Value> >(key, value, parent)
 {
-    Node<Key, Value> *curr = internalFind(key);
-    if(curr == NULL) throw std::out_of_range("Invalid key");
-    return curr->getValue();
+
 }
-template<class Key, class Value>
-Value const & BinarySearchTree<Key, Value>::operator[](const Key& key) const
+template<typename Key, typename Value>
+template<typename... Args>
+IndexedNode<Key, Value>::IndexedNode(IndexedNode<Key, Value>* parent, Args&&... args) :
+    BasicIndexedNode<Key, Value, IndexedNode<Key, Value> >(parent, std::forward<Args>(args)...)
 {
-    Node<Key, Value> *curr = internalFind(key);
-    if(curr == NULL) throw std::out_of_range("Invalid key");
-    return curr->getValue();
+
 }
 
-/**
-* An insert method to insert into a Binary Search Tree.
-* The tree will not remain balanced when inserting.
-* Recall: If key is already in the tree, you should 
-* overwrite the current value with the updated value.
-*
-* There is no guarantee the tree is balanced before or after the insertion.
-* If key is already in the tree, you should overwrite.
-* Runtime is O(h).
+
+/*
+  ---------------------------------------
+  End implementations for the IndexedNode class.
+  ---------------------------------------
 */
-template<class Key, class Value>
-void BinarySearchTree<Key, Value>::insert(const std::pair<const Key, Value> &keyValuePair)
+
+/**
+ * The threaded counterpart of BasicNode. A link with no child behind it
+ * is not left NULL but holds a thread: the in-order predecessor (left)
+ * or successor (right) of the node, told apart from a child by a tag in
+ * the low bit. Stepping to the next item from a node with no right child
+ * is then one pointer hop instead of a climb through the parents.
+ *
+ * getLeft(), getRight() and getChild() report a thread as NULL, so the
+ * tree code sees the usual shape; getThread() and setThread() reach the
+ * threads themselves. The tree keeps them right across insert, remove,
+ * rotations and the bulk build (see Threads below). Links are plain
+ * pointers, so use these with NodePool or HeapNodeAllocator, not with
+ * NodeArena:
+ *   AVLTree<int, int, std::less<int>, ThreadedAVLNode<int, int> >
+ */
+template <typename Key, typename Value, typename Derived>
+class BasicThreadedNode
 {
-    // TODO DONE
-    if (root_ == NULL) {
-        root_ = new Node<Key, Value>(keyValuePair.first, keyValuePair.second, nullptr);
-        return;
-    }
+public:
+    BasicThreadedNode(const Key& key, const Value& value, Derived* parent);
+    template <typename... Args>
+    BasicThreadedNode(Derived* parent, Args&&... args);
 
-    /*Node<Key, Value> *f = internalFind(keyValuePair.first);
-    if (f != NULL) {
-        f->setValue(keyValuePair.second);
-        return;
-    }*/
+    const std::pair<const Key, Value>& getItem() const;
+    std::pair<const Key, Value>& getItem();
+    const Key& getKey() const;
+    const Value& getValue() const;
+    Value& getValue();
 
-    Node<Key, Value> *temp = root_;
-    Node<Key, Value> *parent = nullptr;
-    bool left;
+    Derived* getParent() const;
+    Derived* getLeft() const;
+    Derived* getRight() const;
+    Derived* getChild(bool right) const;
+    Derived* getThread(bool right) const;
 
-    while (temp != NULL)
-    {
-        parent = temp;
-        if (keyValuePair.first == temp->getKey()) {
-            temp->setValue(keyValuePair.second);
-            return;
-        }
-        else if (keyValuePair.first < temp->getKey()) {
-            temp = temp->getLeft();
-            left = true;
-        }
-        else
-        {
-            temp = temp->getRight();
-            left = false;
-        }
-    }
+    void setParent(Derived* parent);
+    void setLeft(Derived* left);
+    void setRight(Derived* right);
+    void setThread(bool right, Derived* target);
+    void setValue(const Value &value);
 
-    if (parent != nullptr) {
-        if (left)
-            parent->setLeft(new Node<Key, Value>(keyValuePair.first, keyValuePair.second, parent));
-        else
-        {
-            parent->setRight(new Node<Key, Value>(keyValuePair.first, keyValuePair.second, parent));
+protected:
+    static const std::uintptr_t THREAD = 1;
 
-            //std::cout << "add to the right" << std::endl;
-        }
-    }
+    static Derived* child(std::uintptr_t link);
+    static std::uintptr_t childLink(Derived* child);
 
-}
+    std::pair<const Key, Value> item_;
+    Derived* parent_;
+    std::uintptr_t left_;
+    std::uintptr_t right_;
+};
+
+/**
+ * A plain BST node with threaded links.
+ */
+template <typename Key, typename Value>
+class ThreadedNode : public BasicThreadedNode<Key, Value, ThreadedNode<Key, Value> >
+{
+public:
+    ThreadedNode(const Key& key, const Value& value, ThreadedNode<Key, Value>* parent);
+    template <typename... Args>
+    ThreadedNode(ThreadedNode<Key, Value>* parent, Args&&... args);
+};
+
+/*
+  -----------------------------------------
+  Begin implementations for the ThreadedNode class.
+  -----------------------------------------
+*/
+
+/**
+* A new node has no children, and empty threads on both sides until the
+* tree links it in.
+*/
+template<typename Key, typename Value, typename Derived>
+BasicThreadedNode<Key, Value, Derived>::BasicThreadedNode(const Key& key, const Value& value, Derived* parent) :
+    item_(key, value),
+    parent_(parent),
+    left_(THREAD),
+    right_(THREAD)
+{
+
+}
+
+/**
+* Emplacing constructor, see BasicNode.
+*/
+template<typename Key, typename Value, typename Derived>
+template<typename... Args>
+BasicThreadedNode<Key, Value, Derived>::BasicThreadedNode(Derived* parent, Args&&... args) :
+    item_(std::forward<Args>(args)...),
+    parent_(parent),
+    left_(THREAD),
+    right_(THREAD)
+{
+
+}
+
+template<typename Key, typename Value, typename Derived>
+const std::pair<const Key, Value>& BasicThreadedNode<Key, Value, Derived>::getItem() const
+{
+    return item_;
+}
+
+template<typename Key, typename Value, typename Derived>
+std::pair<const Key, Value>& BasicThreadedNode<Key, Value, Derived>::getItem()
+{
+    return item_;
+}
+
+template<typename Key, typename Value, typename Derived>
+const Key& BasicThreadedNode<Key, Value, Derived>::getKey() const
+{
+    return item_.first;
+}
+
+template<typename Key, typename Value, typename Derived>
+const Value& BasicThreadedNode<Key, Value, Derived>::getValue() const
+{
+    return item_.second;
+}
+
+template<typename Key, typename Value, typename Derived>
+Value& BasicThreadedNode<Key, Value, Derived>::getValue()
+{
+    return item_.second;
+}
+
+template<typename Key, typename Value, typename Derived>
+void BasicThreadedNode<Key, Value, Derived>::setValue(const Value& value)
+{
+    item_.second = value;
+}
+
+template<typename Key, typename Value, typename Derived>
+Derived* BasicThreadedNode<Key, Value, Derived>::getParent() const
+{
+    return parent_;
+}
+
+template<typename Key, typename Value, typename Derived>
+Derived* BasicThreadedNode<Key, Value, Derived>::getLeft() const
+{
+    return child(left_);
+}
+
+template<typename Key, typename Value, typename Derived>
+Derived* BasicThreadedNode<Key, Value, Derived>::getRight() const
+{
+    return child(right_);
+}
+
+template<typename Key, typename Value, typename Derived>
+Derived* BasicThreadedNode<Key, Value, Derived>::getChild(bool right) const
+{
+    return child(right ? right_ : left_);
+}
+
+/**
+* The in-order neighbour on that side if the link is a thread (NULL at
+* either end of the tree), and NULL if it is a child.
+*/
+template<typename Key, typename Value, typename Derived>
+Derived* BasicThreadedNode<Key, Value, Derived>::getThread(bool right) const
+{
+    std::uintptr_t link = right ? right_ : left_;
+    if (!(link & THREAD)) return NULL;
+    return reinterpret_cast<Derived*>(link & ~THREAD);
+}
+
+template<typename Key, typename Value, typename Derived>
+void BasicThreadedNode<Key, Value, Derived>::setParent(Derived* parent)
+{
+    parent_ = parent;
+}
+
+/**
+* Setting a NULL child leaves an empty thread, to be filled in by the
+* tree with setThread().
+*/
+template<typename Key, typename Value, typename Derived>
+void BasicThreadedNode<Key, Value, Derived>::setLeft(Derived* left)
+{
+    left_ = childLink(left);
+}
+
+template<typename Key, typename Value, typename Derived>
+void BasicThreadedNode<Key, Value, Derived>::setRight(Derived* right)
+{
+    right_ = childLink(right);
+}
+
+template<typename Key, typename Value, typename Derived>
+void BasicThreadedNode<Key, Value, Derived>::setThread(bool right, Derived* target)
+{
+    std::uintptr_t link = reinterpret_cast<std::uintptr_t>(target) | THREAD;
+    if (right) right_ = link;
+    else left_ = link;
+}
+
+/**
+* Decodes a link: a child, or NULL for a thread.
+*/
+template<typename Key, typename Value, typename Derived>
+Derived* BasicThreadedNode<Key, Value, Derived>::child(std::uintptr_t link)
+{
+    return reinterpret_cast<Derived*>((link & THREAD) ? 0 : link);
+}
+
+template<typename Key, typename Value, typename Derived>
+std::uintptr_t BasicThreadedNode<Key, Value, Derived>::childLink(Derived* child)
+{
+    return child != NULL ? reinterpret_cast<std::uintptr_t>(child) : THREAD;
+}
+
+template<typename Key, typename Value>
+ThreadedNode<Key, Value>::ThreadedNode(const Key& key, const Value& value, ThreadedNode<Key, Value>* parent) :
+    BasicThreadedNode<Key, Value, ThreadedNode<Key, Value> >(key, value, parent)
+{
+
+}
+
+template<typename Key, typename Value>
+template<typename... Args>
+ThreadedNode<Key, Value>::ThreadedNode(ThreadedNode<Key, Value>* parent, Args&&... args) :
+    BasicThreadedNode<Key, Value, ThreadedNode<Key, Value> >(parent, std::forward<Args>(args)...)
+{
+
+}
+
+/*
+  ---------------------------------------
+  End implementations for the ThreadedNode class.
+  ---------------------------------------
+*/
+
+/**
+ * Node-type dependent thread upkeep, so the tree code reads the same for
+ * every node. For nodes without threads (detected by the lack of a
+ * setThread() member) all of it compiles away.
+ *  - join(left, right): left and right have just become neighbours in key
+ *    order; whichever of them has an empty link facing the other gets a
+ *    thread to it. Either may be NULL.
+ *  - point(n, right, target): if n has no child on that side, its thread
+ *    there goes to target. Only n is written, so unlike join() it is safe
+ *    while target is still being built on another thread.
+ *  - thread(n, right): n's thread on that side.
+ */
+template <typename NodeT>
+class HasThreads
+{
+    template <typename N>
+    static std::true_type test(decltype(std::declval<N&>().setThread(true, std::declval<N*>()))*);
+    template <typename N>
+    static std::false_type test(...);
+
+public:
+    static const bool value = decltype(test<NodeT>(0))::value;
+};
+
+template <typename NodeT, bool = HasThreads<NodeT>::value>
+struct Threads
+{
+    static const bool value = false;
+    static void join(NodeT*, NodeT*) { }
+    static void point(NodeT*, bool, NodeT*) { }
+    static NodeT* thread(const NodeT*, bool) { return NULL; }
+};
+
+template <typename NodeT>
+struct Threads<NodeT, true>
+{
+    static const bool value = true;
+    static void join(NodeT* left, NodeT* right)
+    {
+        if (left != NULL && left->getRight() == NULL) left->setThread(true, right);
+        if (right != NULL && right->getLeft() == NULL) right->setThread(false, left);
+    }
+    static void point(NodeT* n, bool right, NodeT* target)
+    {
+        if (n->getChild(right) == NULL) n->setThread(right, target);
+    }
+    static NodeT* thread(const NodeT* n, bool right) { return n->getThread(right); }
+};
+
+/**
+ * Upkeep for nodes that cache something about their subtree (its size,
+ * an aggregate of its values). Such a node has an update() member that
+ * recomputes the cached data from its own item and its children's cached
+ * data; the tree calls it bottom-up wherever a subtree changes. For any
+ * other node update() is a no-op.
+ */
+template <typename NodeT>
+class HasUpdate
+{
+    template <typename N>
+    static std::true_type test(decltype(std::declval<N&>().update())*);
+    template <typename N>
+    static std::false_type test(...);
+
+public:
+    static const bool value = decltype(test<NodeT>(0))::value;
+};
+
+template <typename NodeT, bool = HasUpdate<NodeT>::value>
+struct Augmented
+{
+    static const bool value = false;
+    static void update(NodeT*) { }
+};
+
+template <typename NodeT>
+struct Augmented<NodeT, true>
+{
+    static const bool value = true;
+    static void update(NodeT* n) { n->update(); }
+};
+
+/**
+ * Whether NodeT counts the nodes in its subtree (a getSize() member), as
+ * needed for select(), rank() and O(log n) iterator jumps. of(n) is the
+ * size of the subtree at n, 0 for NULL and for nodes without sizes.
+ */
+template <typename NodeT>
+class HasSubtreeSize
+{
+    template <typename N>
+    static std::true_type test(decltype(std::declval<const N&>().getSize())*);
+    template <typename N>
+    static std::false_type test(...);
+
+public:
+    static const bool value = decltype(test<NodeT>(0))::value;
+};
+
+template <typename NodeT, bool = HasSubtreeSize<NodeT>::value>
+struct SubtreeSize
+{
+    static const bool value = false;
+    static std::size_t of(const NodeT*) { return 0; }
+};
+
+template <typename NodeT>
+struct SubtreeSize<NodeT, true>
+{
+    static const bool value = true;
+    static std::size_t of(const NodeT* n) { return n != NULL ? n->getSize() : 0; }
+};
+
+/**
+ * Whether NodeT caches a monoid aggregate of the values in its subtree
+ * (a monoid_type typedef and a getAggregate() member), as needed for
+ * aggregate(). type is the aggregate's type, void for other nodes; of(n)
+ * is the aggregate of the subtree at n, the monoid's identity for NULL.
+ */
+template <typename NodeT>
+class HasSubtreeAggregate
+{
+    template <typename N>
+    static std::true_type test(typename N::monoid_type*);
+    template <typename N>
+    static std::false_type test(...);
+
+public:
+    static const bool value = decltype(test<NodeT>(0))::value;
+};
+
+template <typename NodeT, bool = HasSubtreeAggregate<NodeT>::value>
+struct SubtreeAggregate
+{
+    static const bool value = false;
+    typedef void type;
+};
+
+template <typename NodeT>
+struct SubtreeAggregate<NodeT, true>
+{
+    typedef typename NodeT::monoid_type Monoid;
+    typedef typename Monoid::type type;
+
+    static const bool value = true;
+    static type of(const NodeT* n) { return n != NULL ? n->getAggregate() : Monoid::identity(); }
+    static type lift(const NodeT* n) { return Monoid::lift(n->getValue()); }
+};
+
+/**
+ * True when Compare has a member int compare(const Key&, const Key&)
+ * returning <0, 0 or >0, like std::string::compare.
+ */
+template <typename Compare, typename Key>
+class HasCompareMember
+{
+    template <typename C>
+    static std::true_type test(decltype(std::declval<const C&>().compare(std::declval<const Key&>(),
+                                                                         std::declval<const Key&>()))*);
+    template <typename C>
+    static std::false_type test(...);
+
+public:
+    static const bool value = decltype(test<Compare>(0))::value;
+};
+
+/**
+ * Says whether Compare can answer "less, equal or greater" in one call,
+ * and how: through a compare() member, or for std::less<std::string>
+ * through string::compare.
+ */
+template <typename Compare, typename Key>
+struct ThreeWayCompare
+{
+    static const bool value = HasCompareMember<Compare, Key>::value;
+    static int compare(const Compare& comp, const Key& a, const Key& b) { return comp.compare(a, b); }
+};
+
+template <>
+struct ThreeWayCompare<std::less<std::string>, std::string>
+{
+    static const bool value = true;
+    static int compare(const std::less<std::string>&, const std::string& a, const std::string& b) { return a.compare(b); }
+};
+
+/**
+ * Tags naming the three ways a tree can walk down to a key:
+ *  - BuiltinDescent: std::less on an arithmetic key. Equality and order
+ *    come from the same machine compare, which feeds both the exit test
+ *    and a branch-free choice of child.
+ *  - ThreeWayDescent: a ThreeWayCompare; one call per level, stopping at
+ *    an equal key.
+ *  - LessThanDescent: anything else. Only the strict weak ordering is
+ *    used, once per level, so keys need nothing beyond operator<.
+ */
+struct BuiltinDescent { };
+struct ThreeWayDescent { };
+struct LessThanDescent { };
+
+template <typename Compare, typename Key>
+struct DescentFor
+{
+    typedef typename std::conditional<
+        std::is_arithmetic<Key>::value && std::is_same<Compare, std::less<Key> >::value, BuiltinDescent,
+        typename std::conditional<ThreeWayCompare<Compare, Key>::value, ThreeWayDescent,
+                                  LessThanDescent>::type>::type type;
+};
+
+/**
+ * Tells emplace() whether the key can be read from its arguments before
+ * anything is constructed: true for (key, value) and for a single pair
+ * whose first member is a Key. get() returns that key.
+ */
+template <typename Key, typename... Args>
+struct EmplaceKey
+{
+    static const bool value = false;
+};
+
+template <typename Key, typename K, typename V>
+struct EmplaceKey<Key, K, V>
+{
+    static const bool value = std::is_same<typename std::decay<K>::type, Key>::value;
+    static const Key& get(const Key& key, const V&) { return key; }
+};
+
+template <typename Key, typename P>
+struct EmplaceKey<Key, P>
+{
+    template <typename T>
+    struct PairKey : std::false_type { };
+    template <typename A, typename B>
+    struct PairKey<std::pair<A, B> > : std::is_same<typename std::remove_const<A>::type, Key> { };
+
+    static const bool value = PairKey<typename std::decay<P>::type>::value;
+    static const Key& get(const P& pair) { return pair.first; }
+};
+
+/**
+* A templated unbalanced binary search tree.
+* Keys are ordered by Compare (std::less<Key> by default), so they need
+* nothing beyond operator<. Each level of a descent does one comparison
+* (see DescentFor for how it is done for a given Compare).
+* NodeT is the node type the tree is built from; derived trees such as
+* AVLTree pass their own node so every link access is statically typed.
+* Nodes come from Alloc, a slab pool by default (see node_pool.h).
+*/
+template <typename Key, typename Value, typename Compare = std::less<Key>,
+          typename NodeT = Node<Key, Value>, typename Alloc = NodePool<NodeT> >
+class BinarySearchTree
+{
+public:
+    explicit BinarySearchTree(const Compare& comp = Compare()); //TODO
+    template <typename InputIt>
+    BinarySearchTree(InputIt first, InputIt last, const Compare& comp = Compare());
+    virtual ~BinarySearchTree(); //TODO
+    void insert(const std::pair<const Key, Value>& keyValuePair); //TODO
+    void insert(std::pair<const Key, Value>&& keyValuePair);
+    virtual void remove(const Key& key); //TODO
+    void clear(); //TODO
+    void reserve(std::size_t n);
+    template <typename InputIt>
+    void assignSorted(InputIt first, InputIt last);
+    template <typename InputIt>
+    void parallelBuild(InputIt first, InputIt last, ThreadPool& pool = ThreadPool::shared());
+    bool isBalanced() const; //TODO
+    void print() const;
+    bool empty() const;
+    Compare key_comp() const;
+
+    template<typename PPKey, typename PPValue, typename PPCompare, typename PPNode, typename PPAlloc>
+    friend void prettyPrintBST(BinarySearchTree<PPKey, PPValue, PPCompare, PPNode, PPAlloc> & tree);
+public:
+    /**
+    * Bidirectional iterators over the contents of the BST, in key order.
+    * const_iterator gives read-only access to the items; iterator derives
+    * from it so the two compare with each other and an iterator converts
+    * to a const_iterator. end() is NULL together with the tree it belongs
+    * to, which is what lets --end() step back to the largest item.
+    */
+    class const_iterator
+    {
+    public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef std::pair<const Key, Value> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const std::pair<const Key, Value>* pointer;
+        typedef const std::pair<const Key, Value>& reference;
+
+        const_iterator();
+
+        reference operator*() const;
+        pointer operator->() const;
+
+        bool operator==(const const_iterator& rhs) const;
+        bool operator!=(const const_iterator& rhs) const;
+
+        const_iterator& operator++();
+        const_iterator operator++(int);
+        const_iterator& operator--();
+        const_iterator operator--(int);
+        const_iterator& operator+=(difference_type n);
+        const_iterator& operator-=(difference_type n);
+
+    protected:
+        friend class BinarySearchTree<Key, Value, Compare, NodeT, Alloc>;
+        const_iterator(NodeT* ptr, const BinarySearchTree* tree);
+        void increment();
+        void decrement();
+        void advance(difference_type n);
+        NodeT *current_;
+        const BinarySearchTree *tree_;
+    };
+
+    class iterator : public const_iterator // TODO
+    {
+    public:
+        typedef std::pair<const Key, Value>* pointer;
+        typedef std::pair<const Key, Value>& reference;
+
+        iterator();
+
+        reference operator*() const;
+        pointer operator->() const;
+
+        iterator& operator++();
+        iterator operator++(int);
+        iterator& operator--();
+        iterator operator--(int);
+        iterator& operator+=(typename const_iterator::difference_type n);
+        iterator& operator-=(typename const_iterator::difference_type n);
+
+    protected:
+        friend class BinarySearchTree<Key, Value, Compare, NodeT, Alloc>;
+        iterator(NodeT* ptr, const BinarySearchTree* tree);
+    };
+
+    typedef std::reverse_iterator<iterator> reverse_iterator;
+    typedef std::reverse_iterator<const_iterator> const_reverse_iterator;
+
+public:
+    template <typename... Args>
+    std::pair<iterator, bool> emplace(Args&&... args);
+    template <typename... Args>
+    std::pair<iterator, bool> try_emplace(const Key& key, Args&&... args);
+    template <typename... Args>
+    std::pair<iterator, bool> try_emplace(Key&& key, Args&&... args);
+    iterator insert(const_iterator hint, const std::pair<const Key, Value>& keyValuePair);
+    iterator insert(const_iterator hint, std::pair<const Key, Value>&& keyValuePair);
+    iterator append(const std::pair<const Key, Value>& keyValuePair);
+    iterator append(std::pair<const Key, Value>&& keyValuePair);
+
+    iterator begin();
+    const_iterator begin() const;
+    const_iterator cbegin() const;
+    iterator end();
+    const_iterator end() const;
+    const_iterator cend() const;
+    reverse_iterator rbegin();
+    const_reverse_iterator rbegin() const;
+    reverse_iterator rend();
+    const_reverse_iterator rend() const;
+    const std::pair<const Key, Value>& min() const;
+    const std::pair<const Key, Value>& max() const;
+    std::pair<Key, Value> popMin();
+    std::pair<Key, Value> popMax();
+    iterator find(const Key& key);
+    const_iterator find(const Key& key) const;
+    iterator lower_bound(const Key& key);
+    const_iterator lower_bound(const Key& key) const;
+    iterator upper_bound(const Key& key);
+    const_iterator upper_bound(const Key& key) const;
+    std::pair<iterator, iterator> equal_range(const Key& key);
+    std::pair<const_iterator, const_iterator> equal_range(const Key& key) const;
+    template <typename Fn>
+    void forEachInRange(const Key& lo, const Key& hi, Fn fn);
+    template <typename Fn>
+    void forEachInRange(const Key& lo, const Key& hi, Fn fn) const;
+    template <typename Fn>
+    void parallelForEach(Fn fn, ThreadPool& pool = ThreadPool::shared());
+    template <typename Fn>
+    void parallelForEach(Fn fn, ThreadPool& pool = ThreadPool::shared()) const;
+    template <typename T, typename Map, typename Combine>
+    T parallelReduce(T identity, Map map, Combine combine, ThreadPool& pool = ThreadPool::shared()) const;
+
+    // Operation counters, kept when built with -DBST_STATS (see
+    // tree_stats.h), and the shape of the tree, worked out on demand.
+    const TreeStats& stats() const;
+    void resetStats();
+    TreeShape shape() const;
+    void writeStatsJson(std::ostream& out) const;
+
+    Value& operator[](const Key& key);
+    Value const & operator[](const Key& key) const;
+    Value& findOrInsert(const Key& key);
+    Value& findOrInsert(Key&& key);
+    template <typename Fn>
+    bool upsert(const Key& key, Fn fn);
+
+protected:
+    // Mandatory helper functions
+    NodeT* internalFind(const Key& k) const; // TODO
+    NodeT* lowerBoundNode(const Key& key) const;
+    NodeT* upperBoundNode(const Key& key) const;
+    NodeT* equalRangeEnd(NodeT* lower, const Key& key) const;
+    NodeT* selectNode(std::size_t k) const;
+    std::size_t indexOf(const NodeT* n) const;
+    iterator iteratorTo(NodeT* n);
+    const_iterator iteratorTo(NodeT* n) const;
+    static NodeT* nodeAt(const_iterator it);
+    void refreshPath(NodeT* n);
+    void refreshValue(NodeT* n);
+    static void refreshBelow(NodeT* n);
+    static int forksFor(unsigned threads);
+    template <typename Fn>
+    static void walkSubtree(NodeT* sub, Fn& fn);
+    template <typename Fn>
+    static void forEachBelow(NodeT* sub, Fn& fn, ThreadPool& pool, int forks, bool refresh);
+    template <typename T, typename Map, typename Combine>
+    static T reduceBelow(NodeT* sub, const T& identity, Map& map, Combine& combine, ThreadPool& pool, int forks);
+    NodeT *getSmallestNode() const;  // TODO
+    static NodeT* predecessor(NodeT* current); // TODO
+    static NodeT* successor(NodeT* current);
+    // Note:  static means these functions don't have a "this" pointer
+    //        and instead just use the input argument.
+
+    // Provided helper functions
+    void printRoot (NodeT *r) const;
+    virtual void nodeSwap( NodeT* n1, NodeT* n2) ;
+    virtual void removeNode(NodeT* n);
+    std::pair<Key, Value> popNode(NodeT* n);
+
+    // Add helper functions here
+
+    int checkBalanced(NodeT* n) const;
+    void clearHelper(NodeT* current);
+
+    NodeT* descend(const Key& key, NodeT*& parent, bool& right) const;
+    NodeT* descend(NodeT* start, const Key& key, NodeT*& parent, bool& right) const;
+    NodeT* descend(NodeT* start, const Key& key, NodeT*& parent, bool& right, BuiltinDescent) const;
+    NodeT* descend(NodeT* start, const Key& key, NodeT*& parent, bool& right, ThreeWayDescent) const;
+    NodeT* descend(NodeT* start, const Key& key, NodeT*& parent, bool& right, LessThanDescent) const;
+    NodeT* descendNear(NodeT* hint, const Key& key, NodeT*& parent, bool& right) const;
+    NodeT* climbFrom(NodeT* hint, const Key& key) const;
+    void attachNode(NodeT* parent, bool right, NodeT* n);
+    // The in-order neighbours of a node being removed, see beforeUnlink().
+    struct Gap { NodeT* farBefore; NodeT* before; NodeT* after; NodeT* farAfter; };
+    Gap beforeUnlink(NodeT* n);
+    void afterUnlink(const Gap& gap, NodeT* parent);
+    virtual void postInsert(NodeT* n);
+    virtual void postBuild(NodeT* n, int balance);
+
+    template <typename InputIt>
+    void assignSorted(InputIt first, InputIt last, std::input_iterator_tag);
+    template <typename ForwardIt>
+    void assignSorted(ForwardIt first, ForwardIt last, std::forward_iterator_tag);
+    template <typename ForwardIt>
+    NodeT* buildFromSorted(ForwardIt& it, std::size_t n, int& height, NodeT*& last);
+    void keepLastOfEachKey(std::vector<std::pair<Key, Value> >& items) const;
+
+    // What every task of one parallelBuild() shares; see buildSlots().
+    struct SlotBuild
+    {
+        std::pair<Key, Value>* items;
+        void* const* slots;
+        unsigned char* built;
+        std::size_t count;
+        std::size_t grain;
+        ThreadPool* pool;
+    };
+    template <typename RandomIt, typename Less>
+    static void parallelSort(RandomIt first, RandomIt last, Less less, ThreadPool& pool, std::size_t grain);
+    NodeT* buildSlots(const SlotBuild& job, std::size_t lo, std::size_t n, int& height);
+
+    template <typename... Args>
+    std::pair<NodeT*, bool> insertUnique(const Key& key, Args&&... args);
+    template <typename... Args>
+    std::pair<NodeT*, bool> insertUniqueNear(NodeT* hint, const Key& key, Args&&... args);
+    template <typename... Args>
+    std::pair<iterator, bool> emplaceUnique(std::true_type, Args&&... args);
+    template <typename... Args>
+    std::pair<iterator, bool> emplaceUnique(std::false_type, Args&&... args);
+
+    template <typename... Args>
+    NodeT* createNode(NodeT* parent, Args&&... args);
+    template <typename... Args>
+    NodeT* createNodeWithRoom(NodeT*& parent, Args&&... args);
+    template <typename... Args>
+    NodeT* createNodeWithRoom(std::false_type, NodeT*& parent, Args&&... args);
+    template <typename... Args>
+    NodeT* createNodeWithRoom(std::true_type, NodeT*& parent, Args&&... args);
+    void destroyNode(NodeT* n);
+    void reserveNodes(std::size_t n, NodeT*& held);
+    void reserveNodes(std::false_type, std::size_t n, NodeT*& held);
+    void reserveNodes(std::true_type, std::size_t n, NodeT*& held);
+
+    NodeT *findMinInternal(NodeT* root) const;
+    
+
+protected:
+    NodeT* root_;
+    NodeT* leftmost_;  // node with the smallest key, NULL when empty
+    NodeT* rightmost_; // node with the largest key, NULL when empty
+    Alloc alloc_;
+    Compare comp_;
+    mutable TreeStats stats_; // written by const lookups too; see tree_stats.h
+};
+
+/*
+--------------------------------------------------------------
+Begin implementations for the BinarySearchTree::iterator classes.
+---------------------------------------------------------------
+*/
+
+/**
+* Explicit constructor that initializes an iterator with a given node pointer
+* and the tree it points into. A NULL node is the end() of that tree.
+*
+* You will need to implement the unfinished functions of the iterator class.
+* Note: You do NOT need to check whether the iterator is about to dereference a NULL pointer
+* in operator*() or operator->() of the iterator. Just let it fault.
+* It is up to the user to ensure the iterator is not equal to the end() iterator.
+*/
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::const_iterator::const_iterator(NodeT *ptr,
+                                                                                    const BinarySearchTree* tree)
+{
+    // TODO DONE
+    current_ = ptr;
+    tree_ = tree;
+}
+
+/**
+* A default constructor that initializes the iterator to NULL.
+*/
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::const_iterator::const_iterator() 
+{
+    // TODO DONE
+    current_ = NULL;
+    tree_ = NULL;
+}
+
+/**
+* Provides access to the item.
+*/
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+typename BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::const_iterator::reference
+BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::const_iterator::operator*() const
+{
+    return current_->getItem();
+}
+
+/**
+* Provides access to the address of the item.
+*/
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+typename BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::const_iterator::pointer
+BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::const_iterator::operator->() const
+{
+    return &(current_->getItem());
+}
+
+/**
+* Checks if 'this' iterator's internals have the same value
+* as 'rhs'
+*/
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+bool
+BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::const_iterator::operator==(
+    const BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::const_iterator& rhs) const
+{
+    // TODO DONE
+    return current_ == rhs.current_;
+}
+
+/**
+* Checks if 'this' iterator's internals have a different value
+* as 'rhs'
+*/
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+bool
+BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::const_iterator::operator!=(
+    const BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::const_iterator& rhs) const
+{
+    // TODO DONE
+    return current_ != rhs.current_;
+}
+
+/**
+* Advances the iterator's location using an in-order sequencing
+*/
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+typename BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::const_iterator&
+BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::const_iterator::operator++()
+{
+    // TODO DONE
+    increment();
+    return *this;
+}
+
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+typename BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::const_iterator
+BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::const_iterator::operator++(int)
+{
+    const_iterator old(*this);
+    increment();
+    return old;
+}
+
+/**
+* Moves the iterator back to the previous item in key order. Decrementing
+* end() gives the largest item.
+*/
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+typename BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::const_iterator&
+BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::const_iterator::operator--()
+{
+    decrement();
+    return *this;
+}
+
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+typename BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::const_iterator
+BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::const_iterator::operator--(int)
+{
+    const_iterator old(*this);
+    decrement();
+    return old;
+}
+
+/**
+* Moves the iterator n items forward (backward for negative n), where
+* end() is one past the largest item. With subtree sizes in the nodes
+* this is O(h) whatever n is; otherwise it steps n times.
+*/
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+typename BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::const_iterator&
+BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::const_iterator::operator+=(difference_type n)
+{
+    advance(n);
+    return *this;
+}
+
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+typename BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::const_iterator&
+BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::const_iterator::operator-=(difference_type n)
+{
+    advance(-n);
+    return *this;
+}
+
+/**
+* Steps to the in-order successor. end() stays where it is.
+*/
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+void BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::const_iterator::increment()
+{
+    current_ = successor(current_);
+}
+
+/**
+* Steps to the in-order predecessor, or from end() to the largest item.
+*/
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+void BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::const_iterator::decrement()
+{
+    if (current_ == NULL) current_ = tree_->rightmost_;
+    else current_ = predecessor(current_);
+}
+
+/**
+* See operator+=(). Jumps by position when the nodes know their subtree
+* sizes.
+*/
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+void BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::const_iterator::advance(difference_type n)
+{
+    if (SubtreeSize<NodeT>::value) {
+        current_ = tree_->selectNode(tree_->indexOf(current_) + n);
+        return;
+    }
+
+    for (; n > 0; --n) increment();
+    for (; n < 0; ++n) decrement();
+}
+
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::iterator::iterator(NodeT *ptr, const BinarySearchTree* tree) :
+    const_iterator(ptr, tree)
+{
+
+}
+
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::iterator::iterator()
+{
+
+}
+
+/**
+* Provides modifiable access to the item's value.
+*/
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+typename BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::iterator::reference
+BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::iterator::operator*() const
+{
+    return this->current_->getItem();
+}
+
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+typename BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::iterator::pointer
+BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::iterator::operator->() const
+{
+    return &(this->current_->getItem());
+}
+
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+typename BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::iterator&
+BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::iterator::operator++()
+{
+    this->increment();
+    return *this;
+}
+
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+typename BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::iterator
+BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::iterator::operator++(int)
+{
+    iterator old(*this);
+    this->increment();
+    return old;
+}
+
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+typename BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::iterator&
+BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::iterator::operator--()
+{
+    this->decrement();
+    return *this;
+}
+
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+typename BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::iterator
+BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::iterator::operator--(int)
+{
+    iterator old(*this);
+    this->decrement();
+    return old;
+}
+
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+typename BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::iterator&
+BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::iterator::operator+=(typename const_iterator::difference_type n)
+{
+    this->advance(n);
+    return *this;
+}
+
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+typename BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::iterator&
+BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::iterator::operator-=(typename const_iterator::difference_type n)
+{
+    this->advance(-n);
+    return *this;
+}
+
+
+/*
+-------------------------------------------------------------
+End implementations for the BinarySearchTree::iterator classes.
+-------------------------------------------------------------
+*/
+
+/*
+-----------------------------------------------------
+Begin implementations for the BinarySearchTree class.
+-----------------------------------------------------
+*/
+
+/**
+* Default constructor for a BinarySearchTree, which sets the root to NULL.
+* comp is the ordering used for every key comparison in the tree.
+*
+* Your destructor will probably just call the clear function. The constructor should take constant time.
+*/
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::BinarySearchTree(const Compare& comp) :
+    root_(NULL), leftmost_(NULL), rightmost_(NULL), comp_(comp)
+{
+    // TODO DONE
+}
+
+/**
+* Builds the tree from the items in [first, last) with assignSorted(), so
+* sorted input takes O(n) and produces a height-balanced tree.
+*/
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+template<typename InputIt>
+BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::BinarySearchTree(InputIt first, InputIt last, const Compare& comp) :
+    root_(NULL), leftmost_(NULL), rightmost_(NULL), comp_(comp)
+{
+    assignSorted(first, last);
+}
+
+template<typename Key, typename Value, typename Compare, typename NodeT, typename Alloc>
+BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::~BinarySearchTree()
+{
+    // TODO DONE
+    clear();
+}
+
+/**
+ * Returns true if tree is empty
+*/
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+bool BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::empty() const
+{
+    return root_ == NULL;
+}
+
+/**
+ * Returns a copy of the comparator that orders the keys
+*/
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+Compare BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::key_comp() const
+{
+    return comp_;
+}
+
+template<typename Key, typename Value, typename Compare, typename NodeT, typename Alloc>
+void BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::print() const
+{
+    printRoot(root_);
+    std::cout << "\n";
+}
+
+/**
+* Returns an iterator to the "smallest" item in the tree. O(1).
+*/
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+typename BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::iterator
+BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::begin()
+{
+    BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::iterator begin(leftmost_, this);
+    return begin;
+}
+
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+typename BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::const_iterator
+BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::begin() const
+{
+    return const_iterator(leftmost_, this);
+}
+
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+typename BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::const_iterator
+BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::cbegin() const
+{
+    return const_iterator(leftmost_, this);
+}
+
+/**
+* Returns an iterator whose value means INVALID. It still knows its tree,
+* so it can be decremented to the largest item.
+*/
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+typename BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::iterator
+BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::end()
+{
+    BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::iterator end(NULL, this);
+    return end;
+}
+
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+typename BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::const_iterator
+BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::end() const
+{
+    return const_iterator(NULL, this);
+}
+
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+typename BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::const_iterator
+BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::cend() const
+{
+    return const_iterator(NULL, this);
+}
+
+/**
+* Reverse iterators, walking from the largest item down to the smallest.
+*/
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+typename BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::reverse_iterator
+BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::rbegin()
+{
+    return reverse_iterator(end());
+}
+
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+typename BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::const_reverse_iterator
+BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::rbegin() const
+{
+    return const_reverse_iterator(end());
+}
+
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+typename BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::reverse_iterator
+BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::rend()
+{
+    return reverse_iterator(begin());
+}
+
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+typename BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::const_reverse_iterator
+BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::rend() const
+{
+    return const_reverse_iterator(begin());
+}
+
+/**
+* Returns the item with the smallest key in O(1).
+* Throws std::out_of_range if the tree is empty.
+*/
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+const std::pair<const Key, Value>& BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::min() const
+{
+    if (leftmost_ == NULL) throw std::out_of_range("Empty tree");
+    return leftmost_->getItem();
+}
+
+/**
+* Returns the item with the largest key in O(1).
+* Throws std::out_of_range if the tree is empty.
+*/
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+const std::pair<const Key, Value>& BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::max() const
+{
+    if (rightmost_ == NULL) throw std::out_of_range("Empty tree");
+    return rightmost_->getItem();
+}
+
+/**
+* Removes the item with the smallest key and returns it, with the value
+* moved out. No lookup is needed, so this is O(1) plus rebalancing, which
+* makes the tree usable as an ordered work queue.
+* Throws std::out_of_range if the tree is empty.
+*/
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+std::pair<Key, Value> BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::popMin()
+{
+    if (leftmost_ == NULL) throw std::out_of_range("Empty tree");
+    BST_STATS_SCOPE(Remove);
+    return popNode(leftmost_);
+}
+
+/**
+* Same as popMin(), for the item with the largest key.
+*/
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+std::pair<Key, Value> BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::popMax()
+{
+    if (rightmost_ == NULL) throw std::out_of_range("Empty tree");
+    BST_STATS_SCOPE(Remove);
+    return popNode(rightmost_);
+}
+
+/**
+* Returns an iterator to the item with the given key, k
+* or the end iterator if k does not exist in the tree
+*/
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+typename BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::iterator
+BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::find(const Key & k)
+{
+    NodeT *curr = internalFind(k);
+    BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::iterator it(curr, this);
+    return it;
+}
+
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+typename BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::const_iterator
+BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::find(const Key & k) const
+{
+    return const_iterator(internalFind(k), this);
+}
+
+/**
+* Returns an iterator to the first item whose key is not less than key,
+* or end() if there is none. Runtime is O(h).
+*/
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+typename BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::iterator
+BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::lower_bound(const Key& key)
+{
+    return iterator(lowerBoundNode(key), this);
+}
+
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+typename BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::const_iterator
+BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::lower_bound(const Key& key) const
+{
+    return const_iterator(lowerBoundNode(key), this);
+}
+
+/**
+* Returns an iterator to the first item whose key is greater than key,
+* or end() if there is none. Runtime is O(h).
+*/
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+typename BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::iterator
+BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::upper_bound(const Key& key)
+{
+    return iterator(upperBoundNode(key), this);
+}
+
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+typename BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::const_iterator
+BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::upper_bound(const Key& key) const
+{
+    return const_iterator(upperBoundNode(key), this);
+}
+
+/**
+* Returns [lower_bound(key), upper_bound(key)), which holds the item with
+* that key if there is one and is empty otherwise. One descent.
+*/
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+std::pair<typename BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::iterator,
+          typename BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::iterator>
+BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::equal_range(const Key& key)
+{
+    NodeT *lower = lowerBoundNode(key);
+    return std::make_pair(iterator(lower, this), iterator(equalRangeEnd(lower, key), this));
+}
+
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+std::pair<typename BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::const_iterator,
+          typename BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::const_iterator>
+BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::equal_range(const Key& key) const
+{
+    NodeT *lower = lowerBoundNode(key);
+    return std::make_pair(const_iterator(lower, this), const_iterator(equalRangeEnd(lower, key), this));
+}
+
+/**
+* Calls fn(item) on every item with lo <= key < hi, in key order. fn gets
+* a std::pair<const Key, Value>& and may change the value. Runtime is
+* O(h + k) for k items visited; the tree must not be modified from fn.
+*/
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+template<typename Fn>
+void BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::forEachInRange(const Key& lo, const Key& hi, Fn fn)
+{
+    for (NodeT *n = lowerBoundNode(lo); n != NULL && comp_(n->getKey(), hi); n = successor(n)) {
+        fn(n->getItem());
+    }
+}
+
+/**
+* Same as above, with read-only items.
+*/
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+template<typename Fn>
+void BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::forEachInRange(const Key& lo, const Key& hi, Fn fn) const
+{
+    for (NodeT *n = lowerBoundNode(lo); n != NULL && comp_(n->getKey(), hi); n = successor(n)) {
+        fn(static_cast<const NodeT*>(n)->getItem());
+    }
+}
+
+/**
+* Calls fn(item) once on every item, on the calling thread and pool's
+* workers. The tree is cut into disjoint subtrees, a few per thread,
+* which are walked in place; nothing is copied out.
+*
+* fn gets a std::pair<const Key, Value>& and may change the value, but
+* runs on several items at once, in no particular order, so it must be
+* safe to call concurrently. The tree must not be modified meanwhile.
+* Cached aggregates of the values are brought up to date afterwards.
+*/
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+template<typename Fn>
+void BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::parallelForEach(Fn fn, ThreadPool& pool)
+{
+    forEachBelow(root_, fn, pool, forksFor(pool.workers() + 1), true);
+}
+
+/**
+* Same as above, with read-only items.
+*/
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+template<typename Fn>
+void BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::parallelForEach(Fn fn, ThreadPool& pool) const
+{
+    auto readOnly = [&fn](std::pair<const Key, Value>& item) {
+        fn(static_cast<const std::pair<const Key, Value>&>(item));
+    };
+    forEachBelow(root_, readOnly, pool, forksFor(pool.workers() + 1), false);
+}
+
+/**
+* Folds every item into one result, on the calling thread and pool's
+* workers: map(item) turns each item into a T, and combine(a, b) joins two
+* results, with identity as the result of no items.
+*
+* Results are always combined in key order, so combine must be
+* associative but need not be commutative. map and combine may run
+* concurrently.
+*/
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+template<typename T, typename Map, typename Combine>
+T BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::parallelReduce(T identity, Map map, Combine combine,
+                                                                      ThreadPool& pool) const
+{
+    return reduceBelow(root_, identity, map, combine, pool, forksFor(pool.workers() + 1));
+}
+
+/**
+* The operation counters so far. They only move in a build with
+* -DBST_STATS; see tree_stats.h for what is counted, and why such a
+* build must not look a tree up from several threads at once.
+*/
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+const TreeStats& BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::stats() const
+{
+    return stats_;
+}
+
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+void BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::resetStats()
+{
+    stats_.clear();
+}
+
+/**
+* Counts the nodes at every depth, in O(n) and without recursion, so a
+* degenerate tree is no problem.
+*/
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+TreeShape BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::shape() const
+{
+    TreeShape result;
+    std::vector<std::pair<const NodeT*, std::size_t> > pending;
+    if (root_ != NULL) pending.push_back(std::make_pair(root_, 0));
+
+    while (!pending.empty())
+    {
+        const NodeT *n = pending.back().first;
+        std::size_t depth = pending.back().second;
+        pending.pop_back();
+
+        if (result.depths.size() <= depth) result.depths.resize(depth + 1, 0);
+        ++result.depths[depth];
+        ++result.size;
+        if (n->getLeft() != NULL) pending.push_back(std::make_pair(n->getLeft(), depth + 1));
+        if (n->getRight() != NULL) pending.push_back(std::make_pair(n->getRight(), depth + 1));
+    }
+    return result;
+}
+
+/**
+* Writes {"counters": stats(), "shape": shape()} as one line of JSON.
+*/
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+void BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::writeStatsJson(std::ostream& out) const
+{
+    out << "{\"counters\":";
+    stats_.writeJson(out);
+    out << ",\"shape\":";
+    shape().writeJson(out);
+    out << "}" << std::endl;
+}
+
+/**
+ * @precondition The key exists in the map
+ * Returns the value associated with the key
+ */
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+Value& BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::operator[](const Key& key)
+{
+    NodeT *curr = internalFind(key);
+    if(curr == NULL) throw std::out_of_range("Invalid key");
+    return curr->getValue();
+}
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+Value const & BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::operator[](const Key& key) const
+{
+    NodeT *curr = internalFind(key);
+    if(curr == NULL) throw std::out_of_range("Invalid key");
+    return curr->getValue();
+}
+
+/**
+ * Returns the value associated with the key, inserting a
+ * value-initialized one first if the key is missing (what operator[]
+ * does on a std::map). One descent; the tree only rebalances when a
+ * node was added.
+ */
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+Value& BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::findOrInsert(const Key& key)
+{
+    return insertUnique(key, std::piecewise_construct,
+                        std::forward_as_tuple(key), std::forward_as_tuple()).first->getValue();
+}
+
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+Value& BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::findOrInsert(Key&& key)
+{
+    return insertUnique(key, std::piecewise_construct,
+                        std::forward_as_tuple(std::move(key)), std::forward_as_tuple()).first->getValue();
+}
+
+/**
+ * Updates the value for key in place: fn(Value&) is called on the
+ * existing value, or on a freshly value-initialized one if the key was
+ * missing. Replaces the find / insert / operator[] sequence with a
+ * single descent.
+ *
+ * Returns true if a node was added for key.
+ */
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+template<typename Fn>
+bool BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::upsert(const Key& key, Fn fn)
+{
+    std::pair<NodeT*, bool> result = insertUnique(key, std::piecewise_construct,
+                                                  std::forward_as_tuple(key), std::forward_as_tuple());
+    fn(result.first->getValue());
+    refreshValue(result.first);
+    return result.second;
+}
+
+/**
+* An insert method to insert into a Binary Search Tree.
+* The tree will not remain balanced when inserting.
+* Recall: If key is already in the tree, you should 
+* overwrite the current value with the updated value.
+*
+* There is no guarantee the tree is balanced before or after the insertion.
+* If key is already in the tree, you should overwrite.
+* Runtime is O(h).
+*/
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+void BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::insert(const std::pair<const Key, Value> &keyValuePair)
+{
+    // TODO DONE
+    std::pair<NodeT*, bool> result = insertUnique(keyValuePair.first, keyValuePair);
+    if (!result.second) {
+        result.first->setValue(keyValuePair.second);
+        refreshValue(result.first);
+    }
+}
+
+/**
+* Same as above, but the value is moved into the new node, or into the
+* existing one if the key is already in the tree. The key is copied
+* since it is const in the pair.
+*/
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+void BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::insert(std::pair<const Key, Value>&& keyValuePair)
+{
+    std::pair<NodeT*, bool> result = insertUnique(keyValuePair.first, std::move(keyValuePair));
+    if (!result.second) {
+        result.first->getValue() = std::move(keyValuePair.second);
+        refreshValue(result.first);
+    }
+}
+
+/**
+* Inserts an item built in place from args, as std::map::emplace does.
+* Returns an iterator to the item with that key and whether it was added;
+* an existing item is left untouched.
+*
+* When args are (key, value) or a single pair the key is looked up first
+* and nothing is constructed if it is already there. Otherwise the item
+* has to be built to learn its key, and is destroyed again on a duplicate.
+*/
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+template<typename... Args>
+std::pair<typename BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::iterator, bool>
+BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::emplace(Args&&... args)
+{
+    return emplaceUnique(std::integral_constant<bool, EmplaceKey<Key, Args...>::value>(),
+                         std::forward<Args>(args)...);
+}
+
+/**
+* Inserts key with a Value built in place from args, unless key is already
+* in the tree, in which case nothing is constructed and args are not
+* touched (so they are not moved from either).
+*/
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+template<typename... Args>
+std::pair<typename BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::iterator, bool>
+BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::try_emplace(const Key& key, Args&&... args)
+{
+    std::pair<NodeT*, bool> result = insertUnique(key, std::piecewise_construct,
+                                                  std::forward_as_tuple(key),
+                                                  std::forward_as_tuple(std::forward<Args>(args)...));
+    return std::make_pair(iterator(result.first, this), result.second);
+}
+
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+template<typename... Args>
+std::pair<typename BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::iterator, bool>
+BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::try_emplace(Key&& key, Args&&... args)
+{
+    std::pair<NodeT*, bool> result = insertUnique(key, std::piecewise_construct,
+                                                  std::forward_as_tuple(std::move(key)),
+                                                  std::forward_as_tuple(std::forward<Args>(args)...));
+    return std::make_pair(iterator(result.first, this), result.second);
+}
+
+/**
+* Inserts the pair, using hint as a guess of where it goes: the item is
+* expected to come just before hint (end() meaning after every item).
+* When the guess is right the node is linked in without a descent from
+* the root, and when it is close the search only climbs from hint as far
+* as it has to. A wrong hint costs at most an ordinary insert.
+*
+* Like insert(), overwrites the value if key is already in the tree.
+* Returns an iterator to the item. Amortized O(1) for a correct hint,
+* so feeding a sorted stream with hint = end() takes O(n) plus rebalancing.
+*/
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+typename BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::iterator
+BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::insert(const_iterator hint, const std::pair<const Key, Value>& keyValuePair)
+{
+    std::pair<NodeT*, bool> result = insertUniqueNear(hint.current_, keyValuePair.first, keyValuePair);
+    if (!result.second) {
+        result.first->setValue(keyValuePair.second);
+        refreshValue(result.first);
+    }
+    return iterator(result.first, this);
+}
+
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+typename BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::iterator
+BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::insert(const_iterator hint, std::pair<const Key, Value>&& keyValuePair)
+{
+    std::pair<NodeT*, bool> result = insertUniqueNear(hint.current_, keyValuePair.first, std::move(keyValuePair));
+    if (!result.second) {
+        result.first->getValue() = std::move(keyValuePair.second);
+        refreshValue(result.first);
+    }
+    return iterator(result.first, this);
+}
+
+/**
+* insert() for streams of mostly increasing keys, same as insert(end(), ...).
+* A key above the current maximum is attached to the cached rightmost
+* node in O(1); a slightly smaller one only climbs the right spine as far
+* as needed.
+*/
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+typename BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::iterator
+BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::append(const std::pair<const Key, Value>& keyValuePair)
+{
+    return insert(end(), keyValuePair);
+}
+
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+typename BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::iterator
+BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::append(std::pair<const Key, Value>&& keyValuePair)
+{
+    return insert(end(), std::move(keyValuePair));
+}
+
+
+/**
+* A remove method to remove a specific key from a Binary Search Tree.
+* Recall: The writeup specifies that if a node has 2 children you
+* should swap with the predecessor and then remove.
+
+* There is no guarantee the tree is balanced before or after the removal.
+* If the key is not already in the tree, this function will do nothing.
+* If the node to be removed has two children, swap with its predecessor (not its successor) in the BST removal algorithm.
+* If the node to be removed has exactly one child, you can promote the child.
+* You may NOT just swap key,value pairs.
+* You must swap the actual nodes by changing pointers,
+* but we have given you a helper function to do this in the BST class: swapNode(). Runtime of removal should be O(h).
+*/
+template<typename Key, typename Value, typename Compare, typename NodeT, typename Alloc>
+void BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::remove(const Key& key)
+{
+    // TODO DONE
+    BST_STATS_SCOPE(Remove);
+    removeNode(internalFind(key));
+}
+
+/**
+* Unlinks and destroys node n, which must be in this tree (NULL is
+* ignored). This is remove() without the lookup; balanced trees override
+* it to rebalance afterwards.
+*/
+template<typename Key, typename Value, typename Compare, typename NodeT, typename Alloc>
+void BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::removeNode(NodeT* curr)
+{
+    if (curr != NULL)
+    {
+        BST_TRACE_EVENT(Remove, curr, 0, 0);
+        Gap gap = beforeUnlink(curr);
+
+        if (curr->getLeft() != NULL && curr->getRight() != NULL) // 2 children
+        {
+            NodeT* replacement = predecessor(curr);
+
+            nodeSwap(replacement, curr);
+
+            if (curr->getParent() != nullptr) 
+            {
+                if (curr->getLeft() != nullptr) // it will be always to the left as thats how predecessor works
+                {
+                    if (curr->getParent()->getLeft() == curr) //curr is left child
+                    {
+                        curr->getParent()->setLeft(curr->getLeft());
+                        curr->getLeft()->setParent(curr->getParent());
+                    }
+                    else if (curr->getParent()->getRight() == curr) // curr is right child
+                    {
+                        curr->getParent()->setRight(curr->getLeft());
+                        curr->getLeft()->setParent(curr->getParent());
+                    }
+                }
+                else 
+                {
+                    if (curr->getParent()->getLeft() == curr) curr->getParent()->setLeft(nullptr);
+                    else if (curr->getParent()->getRight() == curr) curr->getParent()->setRight(nullptr);
+                }
+            }
+        }
+        else if (curr->getLeft() != NULL) // curr only has left Child to promote
+        {
+            if (curr->getParent() == NULL)
+            {
+                root_ = curr->getLeft();
+                curr->getLeft()->setParent(nullptr);
+            }
+            else
+            {
+                if (curr->getParent()->getRight() == curr) { // is curr a right child?
+                    curr->getParent()->setRight(curr->getLeft());
+                }
+                else if (curr->getParent()->getLeft() == curr) { // or left
+                    curr->getParent()->setLeft(curr->getLeft());
+                }
+
+                curr->getLeft()->setParent(curr->getParent());
+            }
+        }
+        else if (curr->getRight() != NULL) // curr only has right child to promote
+        {
+            if (curr->getParent() == NULL)
+            {
+                root_ = curr->getRight();
+                curr->getRight()->setParent(nullptr);
+            }
+            else
+            {
+                if (curr->getParent()->getRight() == curr) { // is curr a right child?
+                    curr->getParent()->setRight(curr->getRight());
+                }
+                else if (curr->getParent()->getLeft() == curr) { // or left
+                    curr->getParent()->setLeft(curr->getRight());
+                }
+
+                curr->getRight()->setParent(curr->getParent());
+            }
+        }
+        else {
+            if (curr->getParent() == nullptr) {
+                root_ = nullptr;
+            }
+            else if (curr == curr->getParent()->getLeft()) {
+                curr->getParent()->setLeft(NULL);
+            } else {
+                curr->getParent()->setRight(NULL);
+            }
+        }
+        
+        afterUnlink(gap, curr->getParent());
+        destroyNode(curr);
+    }
+}
+
+/**
+* Removes node n like removeNode() and returns its item, with the value
+* moved out first. The key is copied since it is const in the node.
+*/
+template<typename Key, typename Value, typename Compare, typename NodeT, typename Alloc>
+std::pair<Key, Value> BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::popNode(NodeT* n)
+{
+    std::pair<Key, Value> item(n->getKey(), std::move(n->getValue()));
+    removeNode(n);
+    return item;
+}
+
+
+
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+NodeT*
+BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::predecessor(NodeT* current)
+{
+    // TODO DONE
+    if (current == NULL) return NULL;
+
+    if (current->getLeft() != NULL) {
+
+        NodeT* temp = current->getLeft();
+        while (temp->getRight() != nullptr) {
+            temp = temp->getRight();
+        }
+
+        return temp;
+    }
+    else 
+    {
+        if (Threads<NodeT>::value) return Threads<NodeT>::thread(current, false);
+
+        NodeT* temp = current;
+        NodeT* parent = temp->getParent();
+        while (temp != nullptr && parent != nullptr && temp == parent->getLeft()) {
+            temp = parent;
+            parent = temp->getParent();
+        }
+        return parent;
+    }
+    
+    return NULL;
+}
+
+/**
+* Mirror of predecessor(): the node with the next larger key, or NULL.
+*/
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+NodeT*
+BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::successor(NodeT* current)
+{
+    if (current == NULL) return NULL;
+
+    if (current->getRight() != NULL) {
+        NodeT* temp = current->getRight();
+        while (temp->getLeft() != NULL) temp = temp->getLeft();
+        return temp;
+    }
+    if (Threads<NodeT>::value) return Threads<NodeT>::thread(current, true);
+
+    NodeT* temp = current;
+    NodeT* parent = temp->getParent();
+    while (parent != NULL && temp == parent->getRight()) {
+        temp = parent;
+        parent = temp->getParent();
+    }
+    return parent;
+}
+
+template<class Key, class Value, class Compare, class NodeT, class Alloc>
+NodeT*
+BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::findMinInternal(NodeT* root) const
+{
+    if (root == nullptr) return nullptr;
+
+    NodeT *min = root;
+
+    while (min->getLeft() != NULL)
+    {
+        min = min->getLeft();
+    }
+
+    return min;
+}
+
+/**
+* A method to remove all contents of the tree and
+* reset the values in the tree for use again.
+*
+* Deletes all nodes inside the tree, resetting it to the empty tree.
+* When the allocator can drop its chunks wholesale and the items need no
+* destructor, the nodes are never visited and the runtime is O(chunks).
+* Otherwise it is O(n).
+*/
+template<typename Key, typename Value, typename Compare, typename NodeT, typename Alloc>
+void BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::clear()
+{
+    const bool trivialItems = std::is_trivially_destructible<Key>::value &&
+                              std::is_trivially_destructible<Value>::value;
+
+    if (!Alloc::bulk_release || !trivialItems) clearHelper(root_);
+    root_ = nullptr;
+    leftmost_ = nullptr;
+    rightmost_ = nullptr;
+    alloc_.release();
+}
+
+/**
+* Preallocates room for n more nodes so the next n inserts do not
+* touch the system allocator.
+*/
+template<typename Key, typename Value, typename Compare, typename NodeT, typename Alloc>
+void BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::reserve(std::size_t n)
+{
+    NodeT* none = NULL;
+    reserveNodes(n, none);
+}
+
+/**
+* Replaces the contents of the tree with the (key, value) pairs in
+* [first, last), which must not point into this tree.
+*
+* Input sorted by strictly increasing key is built directly in O(n): the
+* middle item becomes the root, no comparisons are needed beyond the
+* check that the input is sorted, and nothing is rotated. Anything else
+* (unsorted, repeated keys, or single-pass iterators) is first copied and
+* sorted, and for repeated keys the last one wins, as with insert().
+*/
+template<typename Key, typename Value, typename Compare, typename NodeT, typename Alloc>
+template<typename InputIt>
+void BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::assignSorted(InputIt first, InputIt last)
+{
+    assignSorted(first, last, typename std::iterator_traits<InputIt>::iterator_category());
+}
+
+/**
+* assignSorted() fallback: sort a copy of the items by key, keep the last
+* of each run of equal keys, and build from that.
+*/
+template<typename Key, typename Value, typename Compare, typename NodeT, typename Alloc>
+template<typename InputIt>
+void BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::assignSorted(InputIt first, InputIt last,
+                                                                       std::input_iterator_tag)
+{
+    typedef std::pair<Key, Value> Item;
+    std::vector<Item> items(first, last);
+
+    const Compare& comp = comp_;
+    std::stable_sort(items.begin(), items.end(),
+                     [&comp](const Item& a, const Item& b) { return comp(a.first, b.first); });
+
+    keepLastOfEachKey(items);
+
+    assignSorted(std::make_move_iterator(items.begin()), std::make_move_iterator(items.end()),
+                 std::forward_iterator_tag());
+}
+
+/**
+* assignSorted() for multi-pass iterators: one pass checks the order,
+* and if the keys are strictly increasing the tree is built straight
+* from the range.
+*/
+template<typename Key, typename Value, typename Compare, typename NodeT, typename Alloc>
+template<typename ForwardIt>
+void BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::assignSorted(ForwardIt first, ForwardIt last,
+                                                                       std::forward_iterator_tag)
+{
+    std::size_t n = 0;
+    for (ForwardIt prev = first, it = first; it != last; prev = it++, ++n)
+    {
+        if (n > 0 && !comp_((*prev).first, (*it).first)) {
+            assignSorted(first, last, std::input_iterator_tag());
+            return;
+        }
+    }
+
+    clear();
+    reserve(n);
+    int height;
+    NodeT *previous = NULL;
+    root_ = buildFromSorted(first, n, height, previous);
+
+    leftmost_ = findMinInternal(root_);
+    rightmost_ = root_;
+    while (rightmost_ != NULL && rightmost_->getRight() != NULL) rightmost_ = rightmost_->getRight();
+}
+
+/**
+* Builds a height-balanced subtree from the next n items of it, which
+* it is advanced past, and returns its root (with no parent set).
+*
+* The left subtree gets n / 2 items and the right one the rest, so the
+* sides differ by at most one item and their heights by at most one;
+* postBuild() is told the resulting balance of every node. height is
+* set to the height of the subtree.
+*
+* Nodes are created in key order; last is the one created most recently,
+* so threaded nodes can be joined to it as they go.
+*/
+template<typename Key, typename Value, typename Compare, typename NodeT, typename Alloc>
+template<typename ForwardIt>
+NodeT* BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::buildFromSorted(ForwardIt& it, std::size_t n, int& height,
+                                                                            NodeT*& last)
+{
+    height = 0;
+    if (n == 0) return NULL;
+
+    int leftHeight, rightHeight;
+    NodeT *left = buildFromSorted(it, n / 2, leftHeight, last);
+
+    NodeT *node;
+    try {
+        node = createNode(NULL, *it);
+    }
+    catch (...) {
+        clearHelper(left);
+        throw;
+    }
+    ++it;
+
+    node->setLeft(left);
+    if (left != NULL) left->setParent(node);
+    Threads<NodeT>::join(last, node);
+    last = node;
+
+    NodeT *right;
+    try {
+        right = buildFromSorted(it, n - n / 2 - 1, rightHeight, last);
+    }
+    catch (...) {
+        clearHelper(node);
+        throw;
+    }
+
+    node->setRight(right);
+    if (right != NULL) right->setParent(node);
+    Augmented<NodeT>::update(node);
+
+    postBuild(node, rightHeight - leftHeight);
+    height = 1 + std::max(leftHeight, rightHeight);
+    return node;
+}
+
+/**
+* Squeezes items, which is sorted by key, down to one item per key: of
+* each run of equal keys only the last survives, as if the items had been
+* insert()ed in order.
+*/
+template<typename Key, typename Value, typename Compare, typename NodeT, typename Alloc>
+void BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::keepLastOfEachKey(
+    std::vector<std::pair<Key, Value> >& items) const
+{
+    std::size_t kept = 0;
+    for (std::size_t i = 0; i < items.size(); ++i)
+    {
+        if (kept > 0 && !comp_(items[kept - 1].first, items[i].first)) {
+            items[kept - 1] = std::move(items[i]); // same key as the last kept item
+        }
+        else {
+            if (kept != i) items[kept] = std::move(items[i]);
+            ++kept;
+        }
+    }
+    items.erase(items.begin() + kept, items.end());
+}
+
+/**
+* Replaces the contents of the tree with the (key, value) pairs in
+* [first, last), in any order, on the calling thread and pool's workers.
+* Of repeated keys the last one wins, as with insert() and assignSorted().
+*
+* The items are copied and merge sorted with the halves sorted in
+* parallel, then the nodes are all allocated up front, one slot per
+* item. Since item i is going into slot i, every node already knows
+* where its children and in-order neighbours will be, so the balanced
+* subtrees are built concurrently and need no stitching afterwards.
+* The shape, and so every balance factor, is the one assignSorted()
+* builds.
+*
+* Allocation is serial; the allocator is never touched from two threads.
+*/
+template<typename Key, typename Value, typename Compare, typename NodeT, typename Alloc>
+template<typename InputIt>
+void BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::parallelBuild(InputIt first, InputIt last,
+                                                                        ThreadPool& pool)
+{
+    typedef std::pair<Key, Value> Item;
+    std::vector<Item> items(first, last);
+    const std::size_t threads = pool.workers() + 1;
+
+    // a few tasks per thread so an uneven split does not leave threads idle
+    const std::size_t grain = std::max<std::size_t>(items.size() / (4 * threads), 4096);
+
+    const Compare& comp = comp_;
+    parallelSort(items.begin(), items.end(),
+                 [&comp](const Item& a, const Item& b) { return comp(a.first, b.first); }, pool, grain);
+    keepLastOfEachKey(items);
+
+    clear();
+    const std::size_t n = items.size();
+    reserve(n);
+    std::vector<void*> slots;
+    slots.reserve(n);
+    std::vector<unsigned char> built(n, 0);
+    try {
+        while (slots.size() < n) slots.push_back(alloc_.allocate());
+        BST_STATS_COUNT(allocations, n);
+
+        SlotBuild job = { items.data(), slots.data(), built.data(), n, grain, &pool };
+        int height;
+        root_ = buildSlots(job, 0, n, height);
+    }
+    catch (...) {
+        for (std::size_t i = 0; i < slots.size(); ++i)
+        {
+            if (built[i]) static_cast<NodeT*>(slots[i])->~NodeT();
+            alloc_.deallocate(slots[i]);
+        }
+        root_ = NULL;
+        throw;
+    }
+
+    leftmost_ = n > 0 ? static_cast<NodeT*>(slots[0]) : NULL;
+    rightmost_ = n > 0 ? static_cast<NodeT*>(slots[n - 1]) : NULL;
+}
+
+/**
+* A stable merge sort of [first, last) whose halves are sorted in
+* parallel on pool; below grain items it is just std::stable_sort().
+*/
+template<typename Key, typename Value, typename Compare, typename NodeT, typename Alloc>
+template<typename RandomIt, typename Less>
+void BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::parallelSort(RandomIt first, RandomIt last, Less less,
+                                                                       ThreadPool& pool, std::size_t grain)
+{
+    if (static_cast<std::size_t>(last - first) <= grain) {
+        std::stable_sort(first, last, less);
+        return;
+    }
+    RandomIt middle = first + (last - first) / 2;
+    pool.invoke([&]() { parallelSort(first, middle, less, pool, grain); },
+                [&]() { parallelSort(middle, last, less, pool, grain); });
+    std::inplace_merge(first, middle, last, less);
+}
+
+/**
+* parallelBuild() helper: builds the nodes for items [lo, lo + n) in
+* their slots, shaped as buildFromSorted() would, and returns the root
+* of the subtree (with no parent set). Subtrees of at least job.grain
+* items build their two halves in parallel.
+*
+* A node only ever writes to its own slot, and reaches its neighbours
+* through the addresses of theirs, so concurrent tasks never share a
+* node. job.built records which slots hold a node, for cleanup should a
+* constructor throw.
+*/
+template<typename Key, typename Value, typename Compare, typename NodeT, typename Alloc>
+NodeT* BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::buildSlots(const SlotBuild& job, std::size_t lo,
+                                                                       std::size_t n, int& height)
+{
+    height = 0;
+    if (n == 0) return NULL;
+
+    const std::size_t mid = lo + n / 2;
+    int leftHeight, rightHeight;
+    NodeT *left, *right;
+    if (n >= job.grain) {
+        job.pool->invoke([&]() { left = buildSlots(job, lo, n / 2, leftHeight); },
+                         [&]() { right = buildSlots(job, mid + 1, n - n / 2 - 1, rightHeight); });
+    }
+    else {
+        left = buildSlots(job, lo, n / 2, leftHeight);
+        right = buildSlots(job, mid + 1, n - n / 2 - 1, rightHeight);
+    }
+
+    NodeT *node = new (job.slots[mid]) NodeT(NULL, std::move(job.items[mid]));
+    job.built[mid] = 1;
+
+    node->setLeft(left);
+    if (left != NULL) left->setParent(node);
+    node->setRight(right);
+    if (right != NULL) right->setParent(node);
+    Threads<NodeT>::point(node, false, mid > 0 ? static_cast<NodeT*>(job.slots[mid - 1]) : NULL);
+    Threads<NodeT>::point(node, true, mid + 1 < job.count ? static_cast<NodeT*>(job.slots[mid + 1]) : NULL);
+    Augmented<NodeT>::update(node);
+
+    postBuild(node, rightHeight - leftHeight);
+    height = 1 + std::max(leftHeight, rightHeight);
+    return node;
+}
+
+//TODO clear recursively
+
+template<typename Key, typename Value, typename Compare, typename NodeT, typename Alloc>
+void BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::clearHelper(NodeT* current) 
+{
+    if (current == nullptr) return;
+
+    if (current->getLeft() != nullptr) clearHelper(current->getLeft());
+    if (current->getRight() != nullptr) clearHelper(current->getRight());
+    destroyNode(current);
+}
+
+/**
+* The one place new nodes are added. Looks key up and, if it is missing,
+* constructs a node from args (the arguments of the item's pair
+* constructor), links it in and lets the tree rebalance.
+*
+* Returns the node holding key and whether it was just created. Nothing
+* is constructed when key is already in the tree.
+*/
+template<typename Key, typename Value, typename Compare, typename NodeT, typename Alloc>
+template<typename... Args>
+std::pair<NodeT*, bool> BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::insertUnique(const Key& key, Args&&... args)
+{
+    BST_STATS_SCOPE(Insert);
+
+    NodeT *parent;
+    bool right;
+    NodeT *found = descend(key, parent, right);
+    if (found != NULL) return std::make_pair(found, false);
+
+    NodeT *n = createNodeWithRoom(parent, std::forward<Args>(args)...);
+    attachNode(parent, right, n);
+    postInsert(n);
+    return std::make_pair(n, true);
+}
+
+/**
+* insertUnique() starting from a node near key instead of the root (see
+* descendNear()). hint may be NULL, meaning key is expected to be larger
+* than everything in the tree.
+*/
+template<typename Key, typename Value, typename Compare, typename NodeT, typename Alloc>
+template<typename... Args>
+std::pair<NodeT*, bool> BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::insertUniqueNear(NodeT* hint, const Key& key,
+                                                                                               Args&&... args)
+{
+    BST_STATS_SCOPE(Insert);
+
+    NodeT *parent;
+    bool right;
+    NodeT *found = descendNear(hint, key, parent, right);
+    if (found != NULL) return std::make_pair(found, false);
+
+    NodeT *n = createNodeWithRoom(parent, std::forward<Args>(args)...);
+    attachNode(parent, right, n);
+    postInsert(n);
+    return std::make_pair(n, true);
+}
+
+/**
+* emplace() when the key can be read from args without building anything.
+*/
+template<typename Key, typename Value, typename Compare, typename NodeT, typename Alloc>
+template<typename... Args>
+std::pair<typename BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::iterator, bool>
+BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::emplaceUnique(std::true_type, Args&&... args)
+{
+    std::pair<NodeT*, bool> result = insertUnique(EmplaceKey<Key, Args...>::get(args...), std::forward<Args>(args)...);
+    return std::make_pair(iterator(result.first, this), result.second);
+}
+
+/**
+* emplace() for any other args: the node is built first to get its key,
+* and destroyed again if the key is already in the tree.
+*/
+template<typename Key, typename Value, typename Compare, typename NodeT, typename Alloc>
+template<typename... Args>
+std::pair<typename BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::iterator, bool>
+BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::emplaceUnique(std::false_type, Args&&... args)
+{
+    BST_STATS_SCOPE(Insert);
+
+    NodeT *parent = NULL;
+    NodeT *n = createNodeWithRoom(parent, std::forward<Args>(args)...);
+    bool right;
+    NodeT *found = descend(n->getKey(), parent, right);
+    if (found != NULL) {
+        destroyNode(n);
+        return std::make_pair(iterator(found, this), false);
+    }
+
+    n->setParent(parent);
+    attachNode(parent, right, n);
+    postInsert(n);
+    return std::make_pair(iterator(n, this), true);
+}
+
+/**
+* Constructs a node in storage from the allocator, passing args on to
+* the node's emplacing constructor.
+*/
+template<typename Key, typename Value, typename Compare, typename NodeT, typename Alloc>
+template<typename... Args>
+NodeT* BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::createNode(NodeT* parent, Args&&... args)
+{
+    void* mem = alloc_.allocate();
+    BST_STATS_COUNT(allocations, 1);
+    try {
+        return new (mem) NodeT(parent, std::forward<Args>(args)...);
+    }
+    catch (...) {
+        alloc_.deallocate(mem);
+        throw;
+    }
+}
+
+/**
+* createNode() for a node that is to go under parent, which a descent
+* just found. Allocators that keep nodes in one growable array may have
+* to move them all to make room, and parent is then updated to where
+* it moved. For every other allocator this is createNode().
+*/
+template<typename Key, typename Value, typename Compare, typename NodeT, typename Alloc>
+template<typename... Args>
+NodeT* BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::createNodeWithRoom(NodeT*& parent, Args&&... args)
+{
+    return createNodeWithRoom(std::integral_constant<bool, Alloc::relocatable>(), parent, std::forward<Args>(args)...);
+}
+
+template<typename Key, typename Value, typename Compare, typename NodeT, typename Alloc>
+template<typename... Args>
+NodeT* BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::createNodeWithRoom(std::false_type, NodeT*& parent,
+                                                                               Args&&... args)
+{
+    return createNode(parent, std::forward<Args>(args)...);
+}
+
+/**
+* args may refer into a node of this tree, as in insert(*begin()) or
+* t[t.max().first + 1], and moving the nodes would leave them dangling.
+* So when the array is full the item is built from args first, and the
+* node from the item once the nodes have moved.
+*/
+template<typename Key, typename Value, typename Compare, typename NodeT, typename Alloc>
+template<typename... Args>
+NodeT* BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::createNodeWithRoom(std::true_type, NodeT*& parent,
+                                                                               Args&&... args)
+{
+    if (alloc_.available() > 0) return createNode(parent, std::forward<Args>(args)...);
+
+    std::pair<const Key, Value> item(std::forward<Args>(args)...);
+    reserveNodes(1, parent);
+    return createNode(parent, std::move(item));
+}
+
+/**
+* Makes room for n more nodes. An allocator that keeps the nodes in one
+* array may move them all to do it; the pointers the tree holds, and held,
+* then follow the nodes to where they went.
+*/
+template<typename Key, typename Value, typename Compare, typename NodeT, typename Alloc>
+void BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::reserveNodes(std::size_t n, NodeT*& held)
+{
+    reserveNodes(std::integral_constant<bool, Alloc::relocatable>(), n, held);
+}
+
+template<typename Key, typename Value, typename Compare, typename NodeT, typename Alloc>
+void BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::reserveNodes(std::false_type, std::size_t n, NodeT*&)
+{
+    alloc_.reserve(n);
+}
+
+/**
+* Links between nodes are relative and need no fixing. The tree's own
+* pointers are turned into slot indices while they still point into the
+* old array, and back into pointers from the new one, so no address is
+* ever carried across the two allocations.
+*/
+template<typename Key, typename Value, typename Compare, typename NodeT, typename Alloc>
+void BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::reserveNodes(std::true_type, std::size_t n, NodeT*& held)
+{
+    NodeT** pointers[] = { &root_, &leftmost_, &rightmost_, &held };
+    const std::size_t count = sizeof(pointers) / sizeof(pointers[0]);
+    std::uint32_t slots[count];
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        if (*pointers[i] != NULL) slots[i] = alloc_.indexOf(*pointers[i]);
+    }
+
+    if (!alloc_.reserve(n)) return;
+
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        if (*pointers[i] != NULL) *pointers[i] = alloc_.data() + slots[i];
+    }
+}
+
+/**
+* Destroys a node and hands its storage back to the allocator.
+*/
+template<typename Key, typename Value, typename Compare, typename NodeT, typename Alloc>
+void BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::destroyNode(NodeT* n)
+{
+    n->~NodeT();
+    alloc_.deallocate(n);
+}
+
+/**
+* A helper function to find the smallest node in the tree.
+*
+* Returns a pointer to the node with the smallest key.
+* This function is used by the iterator.
+* Runtime is O(1): the node is kept in leftmost_.
+*/
+template<typename Key, typename Value, typename Compare, typename NodeT, typename Alloc>
+NodeT*
+BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::getSmallestNode() const
+{
+    // TODO DONE
+    return leftmost_;
+}
+
+/**
+* Helper function to find a node with given key, k and
+* return a pointer to it or NULL if no item with that key
+* exists
+*
+* Returns a pointer to the node with the specified key. Runtime is O(h).
+*/
+template<typename Key, typename Value, typename Compare, typename NodeT, typename Alloc>
+NodeT* BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::internalFind(const Key& key) const
+{
+    // TODO DONE
+    BST_STATS_SCOPE(Find);
+    NodeT *parent;
+    bool right;
+    return descend(key, parent, right);
+}
+
+/**
+* The node at position k in key order, or NULL (end) if k is past the
+* last item. Subtree sizes tell at each level which side k is on.
+*/
+template<typename Key, typename Value, typename Compare, typename NodeT, typename Alloc>
+NodeT* BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::selectNode(std::size_t k) const
+{
+    NodeT *curr = root_;
+    while (curr != NULL)
+    {
+        std::size_t left = SubtreeSize<NodeT>::of(curr->getLeft());
+        if (k == left) return curr;
+        bool right = k > left;
+        if (right) k -= left + 1;
+        curr = curr->getChild(right);
+    }
+    return NULL;
+}
+
+/**
+* The position of n in key order, counting from 0; NULL (end) is the
+* number of items. Climbs from n to the root adding up what lies to its
+* left.
+*/
+template<typename Key, typename Value, typename Compare, typename NodeT, typename Alloc>
+std::size_t BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::indexOf(const NodeT* n) const
+{
+    if (n == NULL) return SubtreeSize<NodeT>::of(root_);
+
+    std::size_t index = SubtreeSize<NodeT>::of(n->getLeft());
+    for (const NodeT *p = n->getParent(); p != NULL; n = p, p = p->getParent())
+    {
+        if (p->getRight() == n) index += SubtreeSize<NodeT>::of(p->getLeft()) + 1;
+    }
+    return index;
+}
+
+/**
+* An iterator to n, which may be NULL for end(). For the derived trees,
+* which cannot reach the iterators' constructors.
+*/
+template<typename Key, typename Value, typename Compare, typename NodeT, typename Alloc>
+typename BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::iterator
+BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::iteratorTo(NodeT* n)
+{
+    return iterator(n, this);
+}
 
+template<typename Key, typename Value, typename Compare, typename NodeT, typename Alloc>
+typename BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::const_iterator
+BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::iteratorTo(NodeT* n) const
+{
+    return const_iterator(n, this);
+}
 
 /**
-* A remove method to remove a specific key from a Binary Search Tree.
-* Recall: The writeup specifies that if a node has 2 children you
-* should swap with the predecessor and then remove.
+* The node it points at, NULL for end().
+*/
+template<typename Key, typename Value, typename Compare, typename NodeT, typename Alloc>
+NodeT* BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::nodeAt(const_iterator it)
+{
+    return it.current_;
+}
 
-* There is no guarantee the tree is balanced before or after the removal.
-* If the key is not already in the tree, this function will do nothing.
-* If the node to be removed has two children, swap with its predecessor (not its successor) in the BST removal algorithm.
-* If the node to be removed has exactly one child, you can promote the child.
-* You may NOT just swap key,value pairs.
-* You must swap the actual nodes by changing pointers,
-* but we have given you a helper function to do this in the BST class: swapNode(). Runtime of removal should be O(h).
+/**
+* Recomputes the cached subtree data of n and of every ancestor of n,
+* after the subtree below n changed. Nothing to do for plain nodes.
 */
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::remove(const Key& key)
+template<typename Key, typename Value, typename Compare, typename NodeT, typename Alloc>
+void BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::refreshPath(NodeT* n)
 {
-    // TODO DONE
+    if (!Augmented<NodeT>::value) return;
 
-    Node<Key, Value> *curr = internalFind(key);
+    for (; n != NULL; n = n->getParent()) Augmented<NodeT>::update(n);
+}
 
-    if (curr != NULL)
-    {
-        if (curr->getLeft() != NULL && curr->getRight() != NULL) // 2 children
-        {
-            Node<Key, Value>* replacement = predecessor(curr);
+/**
+* Same as refreshPath(n), after the value in n changed rather than the
+* shape below it. Only aggregates depend on values, so this skips the
+* walk for every other node type, sized ones included.
+*/
+template<typename Key, typename Value, typename Compare, typename NodeT, typename Alloc>
+void BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::refreshValue(NodeT* n)
+{
+    if (SubtreeAggregate<NodeT>::value) refreshPath(n);
+}
 
-            //std::cout << replacement->getItem().second << std::endl;
-            
-            nodeSwap(replacement, curr);
+/**
+* Recomputes the cached aggregates in the whole subtree rooted at n,
+* children first, after the values in it changed. Nothing to do for
+* node types without aggregates.
+*/
+template<typename Key, typename Value, typename Compare, typename NodeT, typename Alloc>
+void BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::refreshBelow(NodeT* n)
+{
+    if (!SubtreeAggregate<NodeT>::value || n == NULL) return;
 
-            if (curr->getParent() != nullptr) 
-            {
-                if (curr->getLeft() != nullptr) // it will be always to the left as thats how predecessor works
-                {
-                    if (curr->getParent()->getLeft() == curr) //curr is left child
-                    {
-                        curr->getParent()->setLeft(curr->getLeft());
-                        curr->getLeft()->setParent(curr->getParent());
-                    }
-                    else if (curr->getParent()->getRight() == curr) // curr is right child
-                    {
-                        curr->getParent()->setRight(curr->getLeft());
-                        curr->getLeft()->setParent(curr->getParent());
-                    }
-                }
-                else 
-                {
-                    if (curr->getParent()->getLeft() == curr) curr->getParent()->setLeft(nullptr);
-                    else if (curr->getParent()->getRight() == curr) curr->getParent()->setRight(nullptr);
-                }
-            }
+    refreshBelow(n->getLeft());
+    refreshBelow(n->getRight());
+    Augmented<NodeT>::update(n);
+}
 
-            //std::cout << "node swapped root is " << root_->getKey() << std::endl;
+/**
+* How many levels from the root the parallel walks keep forking: enough
+* for about eight subtrees per thread, so that threads which finish
+* early can take over the rest. None for a single thread.
+*/
+template<typename Key, typename Value, typename Compare, typename NodeT, typename Alloc>
+int BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::forksFor(unsigned threads)
+{
+    if (threads <= 1) return 0;
 
-            
-        }
-        else if (curr->getLeft() != NULL) // curr only has left Child to promote
-        {
-            if (curr->getParent() == NULL)
-            {
-                root_ = curr->getLeft();
-                curr->getLeft()->setParent(nullptr);
-            }
-            else
-            {
-                if (curr->getParent()->getRight() == curr) { // is curr a right child?
-                    curr->getParent()->setRight(curr->getLeft());
-                }
-                else if (curr->getParent()->getLeft() == curr) { // or left
-                    curr->getParent()->setLeft(curr->getLeft());
-                }
+    int forks = 3;
+    for (unsigned covered = 1; covered < threads; covered *= 2) ++forks;
+    return forks;
+}
 
-                curr->getLeft()->setParent(curr->getParent());
-            }
-        }
-        else if (curr->getRight() != NULL) // curr only has right child to promote
-        {
-            if (curr->getParent() == NULL)
-            {
-                //std::cout << " curr: " << curr->getKey() << std::endl;
-                //std::cout << " root: " << root_->getKey() << std::endl;
-                root_ = curr->getRight();
-                curr->getRight()->setParent(nullptr);
-            }
-            else
-            {
-                if (curr->getParent()->getRight() == curr) { // is curr a right child?
-                    curr->getParent()->setRight(curr->getRight());
-                }
-                else if (curr->getParent()->getLeft() == curr) { // or left
-                    curr->getParent()->setLeft(curr->getRight());
-                }
+/**
+* Calls fn(item) on every item in the subtree rooted at sub, in key
+* order, without leaving the subtree.
+*/
+template<typename Key, typename Value, typename Compare, typename NodeT, typename Alloc>
+template<typename Fn>
+void BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::walkSubtree(NodeT* sub, Fn& fn)
+{
+    NodeT *first = sub, *last = sub;
+    while (first->getLeft() != NULL) first = first->getLeft();
+    while (last->getRight() != NULL) last = last->getRight();
 
-                curr->getRight()->setParent(curr->getParent());
-            }
-        }
-        else {
-            if (curr->getParent() == nullptr) {
-                root_ = nullptr;
-            }
-            else if (curr == curr->getParent()->getLeft()) {
-                curr->getParent()->setLeft(NULL);
-            } else {
-                curr->getParent()->setRight(NULL);
-            }
-        }
-        
-        delete curr;
+    for (NodeT *n = first; ; n = successor(n))
+    {
+        fn(n->getItem());
+        if (n == last) return;
     }
 }
 
+/**
+* parallelForEach() helper: for the first forks levels below sub, the
+* left subtree runs alongside the node and its right subtree; below that
+* each subtree is walked serially. With refresh set, the aggregates of
+* every node are recomputed once its subtree is done.
+*/
+template<typename Key, typename Value, typename Compare, typename NodeT, typename Alloc>
+template<typename Fn>
+void BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::forEachBelow(NodeT* sub, Fn& fn, ThreadPool& pool,
+                                                                       int forks, bool refresh)
+{
+    if (sub == NULL) return;
 
+    if (forks == 0) {
+        walkSubtree(sub, fn);
+        if (refresh) refreshBelow(sub);
+        return;
+    }
+    pool.invoke([&]() { forEachBelow(sub->getLeft(), fn, pool, forks - 1, refresh); },
+                [&]() {
+                    fn(sub->getItem());
+                    forEachBelow(sub->getRight(), fn, pool, forks - 1, refresh);
+                });
+    if (refresh && SubtreeAggregate<NodeT>::value) Augmented<NodeT>::update(sub);
+}
 
-template<class Key, class Value>
-Node<Key, Value>*
-BinarySearchTree<Key, Value>::predecessor(Node<Key, Value>* current)
+/**
+* parallelReduce() helper: the result for the subtree rooted at sub,
+* forking the same way as forEachBelow().
+*/
+template<typename Key, typename Value, typename Compare, typename NodeT, typename Alloc>
+template<typename T, typename Map, typename Combine>
+T BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::reduceBelow(NodeT* sub, const T& identity, Map& map,
+                                                                   Combine& combine, ThreadPool& pool, int forks)
 {
-    // TODO DONE
-    if (current == NULL) return NULL;
+    if (sub == NULL) return identity;
 
-    if (current->getLeft() != NULL) {
+    if (forks == 0) {
+        T result = identity;
+        auto fold = [&](const std::pair<const Key, Value>& item) { result = combine(result, map(item)); };
+        walkSubtree(sub, fold);
+        return result;
+    }
+    T left = identity, right = identity;
+    pool.invoke([&]() { left = reduceBelow(sub->getLeft(), identity, map, combine, pool, forks - 1); },
+                [&]() {
+                    right = combine(map(static_cast<const NodeT*>(sub)->getItem()),
+                                    reduceBelow(sub->getRight(), identity, map, combine, pool, forks - 1));
+                });
+    return combine(left, right);
+}
 
-        Node<Key, Value>* temp = current->getLeft();
-        while (temp->getRight() != nullptr) {
-            temp = temp->getRight();
-        }
+/**
+* The node with the smallest key not less than key, or NULL. Same walk
+* as the less-than descend(): one comparison per level, remembering the
+* last node that was not less than key.
+*/
+template<typename Key, typename Value, typename Compare, typename NodeT, typename Alloc>
+NodeT* BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::lowerBoundNode(const Key& key) const
+{
+    NodeT *curr = root_;
+    NodeT *bound = NULL;
 
-        return temp;
-    }
-    else 
+    while (curr != NULL)
     {
-        Node<Key, Value>* temp = current;
-        Node<Key, Value>* parent = temp->getParent();
-        while (temp != nullptr && parent != nullptr && temp == parent->getLeft()) {
-            temp = parent;
-            parent = temp->getParent();
-        }
-        return parent;
+        bool right = comp_(curr->getKey(), key);
+        if (!right) bound = curr;
+        curr = curr->getChild(right);
     }
-    
-    return NULL;
+
+    return bound;
 }
 
-template<class Key, class Value>
-Node<Key, Value>*
-BinarySearchTree<Key, Value>::findMinInternal(Node<Key, Value>* root) const
+/**
+* The node with the smallest key greater than key, or NULL.
+*/
+template<typename Key, typename Value, typename Compare, typename NodeT, typename Alloc>
+NodeT* BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::upperBoundNode(const Key& key) const
 {
-    if (root == nullptr) return nullptr;
-
-    Node<Key, Value> *min = root;
+    NodeT *curr = root_;
+    NodeT *bound = NULL;
 
-    while (min->getLeft() != NULL)
+    while (curr != NULL)
     {
-        min = min->getLeft();
+        bool right = !comp_(key, curr->getKey());
+        if (!right) bound = curr;
+        curr = curr->getChild(right);
     }
 
-    return min;
+    return bound;
 }
 
 /**
-* A method to remove all contents of the tree and
-* reset the values in the tree for use again.
+* Given lower = lowerBoundNode(key), the end of the range of items equal
+* to key: the node after lower if it holds key, lower itself otherwise.
+*/
+template<typename Key, typename Value, typename Compare, typename NodeT, typename Alloc>
+NodeT* BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::equalRangeEnd(NodeT* lower, const Key& key) const
+{
+    if (lower != NULL && !comp_(key, lower->getKey())) return successor(lower);
+    return lower;
+}
+
+/**
+* Walks down from the root towards key, one comparison per level.
 *
-* Deletes all nodes inside the tree, resetting it to the empty tree. Runtime is O(n).
+* Returns the node holding key, or NULL if there is none; in that case
+* parent/right say where a node for key has to be attached (parent is
+* NULL for an empty tree). Runtime is O(h).
 */
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::clear()
+template<typename Key, typename Value, typename Compare, typename NodeT, typename Alloc>
+NodeT* BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::descend(const Key& key, NodeT*& parent, bool& right) const
 {
-    clearHelper(root_);
-    root_ = nullptr;
+    return descend(root_, key, parent, right);
 }
 
-//TODO clear recursively
+/**
+* Same as above, but walks down from start, which must be the root of a
+* subtree whose range of keys key falls in (see climbFrom()).
+*/
+template<typename Key, typename Value, typename Compare, typename NodeT, typename Alloc>
+NodeT* BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::descend(NodeT* start, const Key& key,
+                                                                   NodeT*& parent, bool& right) const
+{
+    return descend(start, key, parent, right, typename DescentFor<Compare, Key>::type());
+}
 
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::clearHelper(Node<Key, Value>* current) 
+/**
+* descend() for std::less on an arithmetic key: the == and < below
+* compile to a single compare, so stats count one comparison per level,
+* the same as the three-way descent.
+*/
+template<typename Key, typename Value, typename Compare, typename NodeT, typename Alloc>
+NodeT* BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::descend(NodeT* start, const Key& key, NodeT*& parent,
+                                                                   bool& right, BuiltinDescent) const
 {
-    if (current == nullptr) return;
+    NodeT *curr = start;
+    parent = NULL;
+    right = false;
 
-    if (current->getLeft() != nullptr) clearHelper(current->getLeft());
-    if (current->getRight() != nullptr) clearHelper(current->getRight());
-    delete current;
+    while (curr != NULL)
+    {
+        BST_STATS_COUNT(visits, 1);
+        BST_STATS_COUNT(comparisons, 1);
+        if (curr->getKey() == key) return curr;
+        parent = curr;
+        right = curr->getKey() < key;
+        curr = curr->getChild(right);
+    }
+
+    return NULL;
 }
 
 /**
-* A helper function to find the smallest node in the tree.
-*
-* Returns a pointer to the node with the smallest key.
-* This function is used by the iterator.
-* Runtime is O(h).
+* descend() when Compare has a three-way form: stops at the first equal key.
 */
-template<typename Key, typename Value>
-Node<Key, Value>*
-BinarySearchTree<Key, Value>::getSmallestNode() const
+template<typename Key, typename Value, typename Compare, typename NodeT, typename Alloc>
+NodeT* BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::descend(NodeT* start, const Key& key, NodeT*& parent,
+                                                                   bool& right, ThreeWayDescent) const
 {
-    // TODO DONE
-    if (root_ == NULL) return NULL;
+    NodeT *curr = start;
+    parent = NULL;
+    right = false;
 
-    Node<Key, Value> *min = root_;
-
-    while (min->getLeft() != NULL)
+    while (curr != NULL)
     {
-        min = min->getLeft();
+        BST_STATS_COUNT(visits, 1);
+        BST_STATS_COUNT(comparisons, 1);
+        int c = ThreeWayCompare<Compare, Key>::compare(comp_, key, curr->getKey());
+        if (c == 0) return curr;
+        parent = curr;
+        right = c > 0;
+        curr = curr->getChild(right);
     }
 
-    return min;
+    return NULL;
 }
 
 /**
-* Helper function to find a node with given key, k and
-* return a pointer to it or NULL if no item with that key
-* exists
+* descend() for a Compare that only provides the less-than ordering.
 *
-* Returns a pointer to the node with the specified key. Runtime is O(h).
+* Each level only asks "is this key less than key?", remembering the last
+* node where the answer was no (the lower bound). The walk always reaches
+* the bottom, and a single extra comparison against the lower bound then
+* tells whether key is in the tree.
 */
-template<typename Key, typename Value>
-Node<Key, Value>* BinarySearchTree<Key, Value>::internalFind(const Key& key) const
+template<typename Key, typename Value, typename Compare, typename NodeT, typename Alloc>
+NodeT* BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::descend(NodeT* start, const Key& key, NodeT*& parent,
+                                                                   bool& right, LessThanDescent) const
 {
-    // TODO DONE
-    Node<Key, Value> *curr = root_;
+    NodeT *curr = start;
+    NodeT *bound = NULL;
+    parent = NULL;
+    right = false;
 
     while (curr != NULL)
     {
-        if (curr->getKey() == key) {
-            //std::cout << "found: " << curr->getItem().second << std::endl;
-            return curr;
-        }
-        else if (key < curr->getKey()) curr = curr->getLeft();
-        else if (key > curr->getKey()) curr = curr->getRight();
+        BST_STATS_COUNT(visits, 1);
+        BST_STATS_COUNT(comparisons, 1);
+        parent = curr;
+        right = comp_(curr->getKey(), key);
+        if (!right) bound = curr;
+        curr = curr->getChild(right);
     }
 
-    //std::cout << "found failed" << std::endl;
+    BST_STATS_COUNT(comparisons, bound != NULL ? 1 : 0);
+    if (bound != NULL && !comp_(key, bound->getKey())) return bound;
     return NULL;
 }
 
+/**
+* Links the new node n in as the right or left child of parent, or as
+* the root when parent is NULL.
+*/
+template<typename Key, typename Value, typename Compare, typename NodeT, typename Alloc>
+void BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::attachNode(NodeT* parent, bool right, NodeT* n)
+{
+    // With threads, parent's thread on that side is n's other neighbour.
+    NodeT *far = parent != NULL ? Threads<NodeT>::thread(parent, right) : NULL;
+    Threads<NodeT>::join(right ? parent : far, n);
+    Threads<NodeT>::join(n, right ? far : parent);
+
+    if (parent == NULL) root_ = n;
+    else if (right) parent->setRight(n);
+    else parent->setLeft(n);
+
+    if (parent == leftmost_ && (!right || parent == NULL)) leftmost_ = n;
+    if (parent == rightmost_ && (right || parent == NULL)) rightmost_ = n;
+
+    refreshPath(n);
+    BST_TRACE_EVENT(Insert, n, 0, 0);
+}
+
+/**
+* Must be called while n is still linked into the tree, before it is
+* taken out for good, so the cached leftmost and rightmost nodes can
+* move to n's neighbours. Rotations and nodeSwap() do not change the
+* order of the nodes, so they leave both caches valid as they are.
+*
+* For threaded nodes it also records the two nodes on either side of n,
+* which afterUnlink() needs once n is out.
+*/
+template<typename Key, typename Value, typename Compare, typename NodeT, typename Alloc>
+typename BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::Gap
+BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::beforeUnlink(NodeT* n)
+{
+    Gap gap = { NULL, NULL, NULL, NULL };
+    if (Threads<NodeT>::value) {
+        gap.before = predecessor(n);
+        gap.after = successor(n);
+        gap.farBefore = predecessor(gap.before);
+        gap.farAfter = successor(gap.after);
+    }
+
+    if (n == leftmost_) leftmost_ = successor(n);
+    if (n == rightmost_) rightmost_ = predecessor(n);
+    return gap;
+}
+
+/**
+* Called once the node beforeUnlink() was told about is unlinked (and
+* before the tree rebalances); parent is the node it was last attached
+* to, after any nodeSwap().
+*
+* Removal only empties links next to the gap it leaves, and the only
+* threads that pointed at the removed node are its neighbours', so
+* re-joining the nodes around the gap restores every thread. Every
+* subtree that lost the node lies on the path up from parent, which
+* also passes the node swapped into its place, so refreshing that path
+* restores cached subtree data.
+*/
+template<typename Key, typename Value, typename Compare, typename NodeT, typename Alloc>
+void BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::afterUnlink(const Gap& gap, NodeT* parent)
+{
+    Threads<NodeT>::join(gap.farBefore, gap.before);
+    Threads<NodeT>::join(gap.before, gap.after);
+    Threads<NodeT>::join(gap.after, gap.farAfter);
+    refreshPath(parent);
+}
+
+/**
+* Finds where key belongs starting from hint, a node the caller expects
+* key to come just before (NULL: after the largest key). Reports the
+* result like descend().
+*
+* If key fits between hint's neighbours the attach position is known
+* without a search: it is the empty child slot on that side of hint, or
+* else the matching slot of the neighbour. Otherwise climbFrom() finds the
+* closest subtree that must hold key and the search continues from there.
+*/
+template<typename Key, typename Value, typename Compare, typename NodeT, typename Alloc>
+NodeT* BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::descendNear(NodeT* hint, const Key& key,
+                                                                       NodeT*& parent, bool& right) const
+{
+    if (hint == NULL) {
+        if (rightmost_ != NULL && comp_(rightmost_->getKey(), key)) {
+            parent = rightmost_;
+            right = true;
+            return NULL;
+        }
+        hint = rightmost_;
+    }
+    else if (comp_(key, hint->getKey())) {
+        NodeT *before = predecessor(hint);
+        if (before == NULL || comp_(before->getKey(), key)) {
+            right = hint->getLeft() != NULL;
+            parent = right ? before : hint;
+            return NULL;
+        }
+    }
+    else if (comp_(hint->getKey(), key)) {
+        NodeT *after = successor(hint);
+        if (after == NULL || comp_(key, after->getKey())) {
+            right = hint->getRight() == NULL;
+            parent = right ? hint : after;
+            return NULL;
+        }
+    }
+    else {
+        return hint;
+    }
+
+    return descend(climbFrom(hint, key), key, parent, right);
+}
+
+/**
+* Climbs from hint to the lowest subtree whose range of keys must contain
+* key, so a descent from the returned node finds key or its attach
+* position. Only ancestors that bound the subtree on key's side are
+* compared, so the climb stops as soon as the subtree is wide enough.
+* An ancestor equal to key is returned as is. Returns root_ when hint is
+* NULL.
+*/
+template<typename Key, typename Value, typename Compare, typename NodeT, typename Alloc>
+NodeT* BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::climbFrom(NodeT* hint, const Key& key) const
+{
+    if (hint == NULL) return root_;
+
+    const bool above = comp_(hint->getKey(), key);
+    NodeT *curr = hint;
+
+    for (NodeT *p = curr->getParent(); p != NULL; curr = p, p = p->getParent())
+    {
+        const bool fromLeft = p->getLeft() == curr;
+        if (above && fromLeft && !comp_(p->getKey(), key)) {
+            return comp_(key, p->getKey()) ? curr : p; // key <= p, everything under curr < p
+        }
+        if (!above && !fromLeft && !comp_(key, p->getKey())) {
+            return comp_(p->getKey(), key) ? curr : p; // key >= p, everything under curr > p
+        }
+    }
+
+    return curr;
+}
+
+/**
+* Called by insert() after a new node has been attached. A plain BST
+* has nothing to fix; balanced trees override it to rebalance.
+*/
+template<typename Key, typename Value, typename Compare, typename NodeT, typename Alloc>
+void BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::postInsert(NodeT*)
+{
+}
+
+/**
+* Called by buildFromSorted() for every node once both of its subtrees
+* are in place, with height(right) - height(left). Nothing to do here;
+* balanced trees record the balance.
+*/
+template<typename Key, typename Value, typename Compare, typename NodeT, typename Alloc>
+void BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::postBuild(NodeT*, int)
+{
+}
+
 /**
  * Return true iff the BST is balanced.
  *
@@ -781,13 +3359,13 @@ Node<Key, Value>* BinarySearchTree<Key, Value>::internalFind(const Key& key) con
  * but it is mainly given as practice of writing recursive tree traversal algorithms.
  * Think about how a pre- or post-order traversal can help.
  */
-template<typename Key, typename Value>
-bool BinarySearchTree<Key, Value>::isBalanced() const
+template<typename Key, typename Value, typename Compare, typename NodeT, typename Alloc>
+bool BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::isBalanced() const
 {
     return checkBalanced(root_) != -1;
 }
-template<typename Key, typename Value>
-int BinarySearchTree<Key, Value>::checkBalanced(Node<Key, Value>* n) const
+template<typename Key, typename Value, typename Compare, typename NodeT, typename Alloc>
+int BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::checkBalanced(NodeT* n) const
 {
     if (n == nullptr) return 0;
 
@@ -801,25 +3379,26 @@ int BinarySearchTree<Key, Value>::checkBalanced(Node<Key, Value>* n) const
     return std::max(leftBalance, rightBalance) + 1;
 }
 
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::nodeSwap( Node<Key,Value>* n1, Node<Key,Value>* n2)
+template<typename Key, typename Value, typename Compare, typename NodeT, typename Alloc>
+void BinarySearchTree<Key, Value, Compare, NodeT, Alloc>::nodeSwap( NodeT* n1, NodeT* n2)
 {
     if((n1 == n2) || (n1 == NULL) || (n2 == NULL) ) {
         return;
     }
-    Node<Key, Value>* n1p = n1->getParent();
-    Node<Key, Value>* n1r = n1->getRight();
-    Node<Key, Value>* n1lt = n1->getLeft();
+    BST_STATS_COUNT(nodeSwaps, 1);
+    NodeT* n1p = n1->getParent();
+    NodeT* n1r = n1->getRight();
+    NodeT* n1lt = n1->getLeft();
     bool n1isLeft = false;
     if(n1p != NULL && (n1 == n1p->getLeft())) n1isLeft = true;
-    Node<Key, Value>* n2p = n2->getParent();
-    Node<Key, Value>* n2r = n2->getRight();
-    Node<Key, Value>* n2lt = n2->getLeft();
+    NodeT* n2p = n2->getParent();
+    NodeT* n2r = n2->getRight();
+    NodeT* n2lt = n2->getLeft();
     bool n2isLeft = false;
     if(n2p != NULL && (n2 == n2p->getLeft())) n2isLeft = true;
 
 
-    Node<Key, Value>* temp;
+    NodeT* temp;
     temp = n1->getParent();
     n1->setParent(n2->getParent());
     n2->setParent(temp);
@@ -0,0 +1,607 @@
+#ifndef NODE_POOL_H
+#define NODE_POOL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/**
+* A slab allocator for the nodes of a search tree.
+*
+* Nodes are carved out of large preallocated chunks instead of being
+* allocated one at a time with new. Freed nodes go onto an intrusive
+* free list and are handed out again by the next allocate(), so a tree
+* that keeps inserting and removing stays inside the same few chunks.
+*
+* The pool is typed on the node it hands out, so every block has the
+* size and alignment of T.
+*
+* Any class with the same interface can be plugged into the trees:
+*   allocate()            storage for one node
+*   deallocate(p)         give back the storage of one node
+*   reserve(n)            make sure n more allocate() calls need no system allocation;
+*                         returns true if that moved the existing nodes
+*   release()             drop all storage at once
+*   bulk_release          true if release() frees every node without the tree
+*                         having to deallocate them one at a time
+*   relocatable           true if reserve() may move the existing nodes, in which
+*                         case the tree must call it before every allocate(), and
+*                         the allocator must also offer available(): how many
+*                         nodes fit before reserve() moves them; and indexOf(p)
+*                         and data(), so that a node's slot, data() + indexOf(p),
+*                         can be looked up again once it has moved
+*   share(other)          let this allocator and other each deallocate nodes the
+*                         other allocated, so AVLTree::split() and join() can move
+*                         nodes between trees; optional, relocatable allocators
+*                         cannot offer it
+*/
+template <typename T>
+class NodePool
+{
+public:
+    static const bool bulk_release = true;
+    static const bool relocatable = false;
+
+    explicit NodePool(std::size_t chunkBlocks = 64);
+    ~NodePool();
+
+    void* allocate();
+    void deallocate(void* p);
+    bool reserve(std::size_t n);
+    void release();
+    void share(NodePool& other);
+
+    std::size_t blockSize() const;
+    std::size_t chunkCount() const;
+    std::size_t available() const;
+
+private:
+    NodePool(const NodePool&);
+    NodePool& operator=(const NodePool&);
+
+    struct Chunk
+    {
+        Chunk* next;
+    };
+
+    struct FreeBlock
+    {
+        FreeBlock* next;
+    };
+
+    // The chunks, owned jointly by every pool that has shared with this
+    // one. Merging two storages moves the chunks of one into the other
+    // and leaves it pointing there, so pools still holding it find the
+    // surviving storage and keep it alive.
+    struct Storage
+    {
+        Storage() : chunks(NULL) { }
+        ~Storage();
+
+        Chunk* chunks;
+        std::shared_ptr<Storage> mergedInto;
+    };
+
+    void addChunk(std::size_t blocks);
+    static std::size_t headerSize();
+    static std::shared_ptr<Storage> survivor(std::shared_ptr<Storage> storage);
+    static std::mutex& storageMutex();
+
+    std::size_t blockSize_;
+    std::size_t chunkBlocks_;   // size of the next chunk, grows geometrically
+    std::shared_ptr<Storage> storage_;
+    char* cursor_;              // bump region at the end of the newest chunk
+    char* limit_;
+    FreeBlock* freeList_;
+    std::size_t freeCount_;
+    std::size_t chunkCount_;
+};
+
+/**
+* A node allocator that simply forwards to the global operator new/delete.
+* It is mostly useful as a baseline to measure the pool against.
+*/
+template <typename T>
+class HeapNodeAllocator
+{
+public:
+    static const bool bulk_release = false;
+    static const bool relocatable = false;
+
+    void* allocate() { return ::operator new(sizeof(T)); }
+    void deallocate(void* p) { ::operator delete(p); }
+    bool reserve(std::size_t) { return false; }
+    void release() { }
+    void share(HeapNodeAllocator&) { }
+};
+
+/**
+* A node allocator that keeps every node of a tree in one contiguous
+* array, the way a std::vector would.
+*
+* It is meant for node types whose links are 32-bit offsets within the
+* array (IndexedNode, IndexedAVLNode) rather than pointers, so moving the
+* whole array keeps every link valid. When the array is full, reserve()
+* moves it to a bigger buffer and says so; a node keeps its slot, so the
+* tree finds its own root pointer again as data() + the root's old
+* indexOf(). As with a vector, that invalidates iterators and pointers
+* into the tree.
+*
+* Because the links are relative, data()[0, slots()) together with the
+* root's index is a position independent image of the tree.
+*/
+template <typename T>
+class NodeArena
+{
+public:
+    static const bool bulk_release = true;
+    static const bool relocatable = true;
+
+    explicit NodeArena(std::size_t initialCapacity = 64);
+    ~NodeArena();
+
+    void* allocate();
+    void deallocate(void* p);
+    bool reserve(std::size_t n);
+    void release();
+
+    std::size_t available() const;
+    T* data() const;
+    std::size_t slots() const;
+    std::size_t capacity() const;
+    std::uint32_t indexOf(const T* node) const;
+
+private:
+    NodeArena(const NodeArena&);
+    NodeArena& operator=(const NodeArena&);
+
+    static const std::uint32_t NO_SLOT = 0xffffffffu;
+    static const std::size_t MAX_SLOTS = 0x7fffffffu;  // offsets are signed 32-bit
+
+    void grow(std::size_t minCapacity);
+
+    T* nodes_;
+    std::size_t slots_;         // high-water mark; slots below it are live or free
+    std::size_t capacity_;
+    std::size_t initialCapacity_;
+    std::uint32_t freeHead_;    // free slots are chained by index through their storage
+    std::size_t freeCount_;
+    std::vector<bool> live_;    // which slots hold a node, needed to move them
+};
+
+/*
+  -----------------------------------------
+  Begin implementations for the NodePool class.
+  -----------------------------------------
+*/
+
+/**
+* Blocks are rounded up so that every node in a chunk is suitably aligned
+* and can hold a free list link once it has been deallocated.
+*/
+template<typename T>
+NodePool<T>::NodePool(std::size_t chunkBlocks) :
+    blockSize_(0),
+    chunkBlocks_(chunkBlocks == 0 ? 1 : chunkBlocks),
+    cursor_(NULL),
+    limit_(NULL),
+    freeList_(NULL),
+    freeCount_(0),
+    chunkCount_(0)
+{
+    const std::size_t align = alignof(T) > alignof(FreeBlock) ? alignof(T) : alignof(FreeBlock);
+    std::size_t size = sizeof(T) < sizeof(FreeBlock) ? sizeof(FreeBlock) : sizeof(T);
+    blockSize_ = (size + align - 1) / align * align;
+}
+
+template<typename T>
+NodePool<T>::~NodePool()
+{
+    release();
+}
+
+/**
+* The chunk header is padded so the first block keeps max alignment.
+*/
+template<typename T>
+std::size_t NodePool<T>::headerSize()
+{
+    const std::size_t align = alignof(std::max_align_t);
+    return (sizeof(Chunk) + align - 1) / align * align;
+}
+
+/**
+* Returns storage for one node. Reuses a freed block if there is one,
+* otherwise bumps through the newest chunk, and only goes to the system
+* when the chunk is used up.
+*/
+template<typename T>
+void* NodePool<T>::allocate()
+{
+    if (freeList_ != NULL)
+    {
+        FreeBlock* block = freeList_;
+        freeList_ = block->next;
+        --freeCount_;
+        return block;
+    }
+
+    if (cursor_ == limit_) addChunk(chunkBlocks_);
+
+    void* p = cursor_;
+    cursor_ += blockSize_;
+    return p;
+}
+
+/**
+* Puts a block back on the free list. The node must already be destroyed.
+*/
+template<typename T>
+void NodePool<T>::deallocate(void* p)
+{
+    if (p == NULL) return;
+
+    FreeBlock* block = static_cast<FreeBlock*>(p);
+    block->next = freeList_;
+    freeList_ = block;
+    ++freeCount_;
+}
+
+/**
+* Makes sure the next n allocations can be served without going to the
+* system allocator. Any shortfall is covered by a single chunk.
+*/
+template<typename T>
+bool NodePool<T>::reserve(std::size_t n)
+{
+    std::size_t have = available();
+    if (have >= n) return false;
+
+    // addChunk() moves the rest of the bump region onto the free list,
+    // so only the difference has to come from the new chunk
+    addChunk(n - have);
+    return false;  // chunks never move, so existing nodes stay put
+}
+
+/**
+* Frees every chunk at once. Runtime is O(number of chunks); the nodes
+* inside are not visited, so they must be trivially destructible or
+* already destroyed.
+*
+* After share() the chunks belong to all the pools involved, and only
+* the last of them to be released or destroyed frees them.
+*/
+template<typename T>
+void NodePool<T>::release()
+{
+    {
+        std::lock_guard<std::mutex> lock(storageMutex());
+        storage_.reset();
+    }
+
+    cursor_ = NULL;
+    limit_ = NULL;
+    freeList_ = NULL;
+    freeCount_ = 0;
+    chunkCount_ = 0;
+}
+
+template<typename T>
+std::size_t NodePool<T>::blockSize() const
+{
+    return blockSize_;
+}
+
+template<typename T>
+std::size_t NodePool<T>::chunkCount() const
+{
+    return chunkCount_;
+}
+
+/**
+* Number of allocations that can be served without a new chunk.
+*/
+template<typename T>
+std::size_t NodePool<T>::available() const
+{
+    return freeCount_ + static_cast<std::size_t>(limit_ - cursor_) / blockSize_;
+}
+
+/**
+* Lets this pool and other each deallocate blocks the other handed out,
+* by putting their chunks in one storage that lives until both pools (and
+* any they shared with before) are released. Each pool keeps its own
+* free list and bump region, so trees using them can still run on
+* different threads.
+*/
+template<typename T>
+void NodePool<T>::share(NodePool& other)
+{
+    std::lock_guard<std::mutex> lock(storageMutex());
+
+    if (!storage_) storage_ = std::make_shared<Storage>();
+    std::shared_ptr<Storage> kept = survivor(storage_);
+
+    if (other.storage_)
+    {
+        std::shared_ptr<Storage> merged = survivor(other.storage_);
+        if (merged != kept)
+        {
+            Chunk* last = merged->chunks;
+            if (last != NULL)
+            {
+                while (last->next != NULL) last = last->next;
+                last->next = kept->chunks;
+                kept->chunks = merged->chunks;
+                merged->chunks = NULL;
+            }
+            merged->mergedInto = kept;
+        }
+    }
+
+    storage_ = kept;
+    other.storage_ = kept;
+}
+
+/**
+* The storage that now holds the chunks of storage, following merges.
+* Caller holds storageMutex().
+*/
+template<typename T>
+std::shared_ptr<typename NodePool<T>::Storage> NodePool<T>::survivor(std::shared_ptr<Storage> storage)
+{
+    while (storage->mergedInto) storage = storage->mergedInto;
+    return storage;
+}
+
+/**
+* Guards chunk lists and merges. Only share(), release() and addChunk()
+* take it, never allocate() or deallocate().
+*/
+template<typename T>
+std::mutex& NodePool<T>::storageMutex()
+{
+    static std::mutex mutex;
+    return mutex;
+}
+
+template<typename T>
+NodePool<T>::Storage::~Storage()
+{
+    while (chunks != NULL)
+    {
+        Chunk* next = chunks->next;
+        ::operator delete(chunks);
+        chunks = next;
+    }
+}
+
+/**
+* Allocates a chunk of the given number of blocks and makes it the bump
+* region. Whatever was left of the previous bump region goes onto the
+* free list so it is not lost.
+*/
+template<typename T>
+void NodePool<T>::addChunk(std::size_t blocks)
+{
+    while (cursor_ != limit_)
+    {
+        deallocate(cursor_);
+        cursor_ += blockSize_;
+    }
+
+    char* raw = static_cast<char*>(::operator new(headerSize() + blocks * blockSize_));
+    Chunk* chunk = reinterpret_cast<Chunk*>(raw);
+    {
+        std::lock_guard<std::mutex> lock(storageMutex());
+        if (!storage_) storage_ = std::make_shared<Storage>();
+        Storage* storage = survivor(storage_).get();
+        chunk->next = storage->chunks;
+        storage->chunks = chunk;
+    }
+    ++chunkCount_;
+
+    cursor_ = raw + headerSize();
+    limit_ = cursor_ + blocks * blockSize_;
+
+    // the next chunk doubles, up to a cap, so a growing tree needs O(log n) chunks
+    if (blocks >= chunkBlocks_ && chunkBlocks_ < 65536) chunkBlocks_ *= 2;
+}
+
+/*
+  ---------------------------------------
+  End implementations for the NodePool class.
+  ---------------------------------------
+*/
+
+/*
+  -----------------------------------------
+  Begin implementations for the NodeArena class.
+  -----------------------------------------
+*/
+
+template<typename T>
+NodeArena<T>::NodeArena(std::size_t initialCapacity) :
+    nodes_(NULL),
+    slots_(0),
+    capacity_(0),
+    initialCapacity_(initialCapacity == 0 ? 1 : initialCapacity),
+    freeHead_(NO_SLOT),
+    freeCount_(0)
+{
+    static_assert(sizeof(T) >= sizeof(std::uint32_t), "a free slot must hold its free list link");
+}
+
+template<typename T>
+NodeArena<T>::~NodeArena()
+{
+    release();
+}
+
+/**
+* Hands out a freed slot if there is one, otherwise the next unused one.
+* The caller must have made room with reserve() first, since growing
+* here would move nodes the tree is still holding pointers to.
+*/
+template<typename T>
+void* NodeArena<T>::allocate()
+{
+    std::size_t slot;
+    if (freeHead_ != NO_SLOT)
+    {
+        slot = freeHead_;
+        std::memcpy(&freeHead_, static_cast<void*>(nodes_ + slot), sizeof(freeHead_));
+        --freeCount_;
+    }
+    else
+    {
+        if (slots_ == capacity_) throw std::logic_error("NodeArena: allocate() without reserve()");
+        slot = slots_++;
+    }
+
+    live_[slot] = true;
+    return nodes_ + slot;
+}
+
+/**
+* Chains a destroyed node's slot onto the free list.
+*/
+template<typename T>
+void NodeArena<T>::deallocate(void* p)
+{
+    if (p == NULL) return;
+
+    std::uint32_t slot = indexOf(static_cast<T*>(p));
+    std::memcpy(p, &freeHead_, sizeof(freeHead_));
+    freeHead_ = slot;
+    live_[slot] = false;
+    ++freeCount_;
+}
+
+/**
+* Makes sure n more nodes fit without growing. Returns true if the
+* existing nodes had to move to a new array, each to the same slot.
+*/
+template<typename T>
+bool NodeArena<T>::reserve(std::size_t n)
+{
+    std::size_t room = available();
+    if (room >= n) return false;
+
+    bool moving = slots_ > 0;
+    grow(capacity_ + (n - room));
+    return moving;
+}
+
+/**
+* Frees the whole array at once. The nodes are not visited, so they must
+* be trivially destructible or already destroyed.
+*/
+template<typename T>
+void NodeArena<T>::release()
+{
+    ::operator delete(nodes_);
+    nodes_ = NULL;
+    slots_ = 0;
+    capacity_ = 0;
+    freeHead_ = NO_SLOT;
+    freeCount_ = 0;
+    live_.clear();
+}
+
+/**
+* How many more nodes fit before reserve() has to move the array.
+*/
+template<typename T>
+std::size_t NodeArena<T>::available() const
+{
+    return capacity_ - slots_ + freeCount_;
+}
+
+template<typename T>
+T* NodeArena<T>::data() const
+{
+    return nodes_;
+}
+
+template<typename T>
+std::size_t NodeArena<T>::slots() const
+{
+    return slots_;
+}
+
+template<typename T>
+std::size_t NodeArena<T>::capacity() const
+{
+    return capacity_;
+}
+
+template<typename T>
+std::uint32_t NodeArena<T>::indexOf(const T* node) const
+{
+    return static_cast<std::uint32_t>(node - nodes_);
+}
+
+/**
+* Moves every node, in order, into a buffer with room for at least
+* minCapacity nodes. Links are relative, so they survive the move.
+* Capacity at least doubles, keeping growth amortized O(1) per node.
+*
+* Nodes are moved if that cannot throw and copied otherwise, and the old
+* ones are only destroyed once all are across. So if a copy throws, the
+* new buffer is dropped and the arena is left as it was.
+*/
+template<typename T>
+void NodeArena<T>::grow(std::size_t minCapacity)
+{
+    static_assert(std::is_nothrow_move_constructible<T>::value || std::is_copy_constructible<T>::value,
+                  "NodeArena needs nodes that can be moved without throwing, or copied");
+
+    std::size_t newCapacity = capacity_ == 0 ? initialCapacity_ : capacity_ * 2;
+    if (newCapacity < minCapacity) newCapacity = minCapacity;
+    if (newCapacity > MAX_SLOTS) newCapacity = MAX_SLOTS;
+    if (newCapacity < minCapacity) throw std::length_error("NodeArena: more than 2^31 - 1 nodes");
+    live_.resize(newCapacity, false); // first, so nothing after the move can throw
+
+    T* moved = static_cast<T*>(::operator new(newCapacity * sizeof(T)));
+    std::size_t i = 0;
+    try {
+        for (; i < slots_; ++i)
+        {
+            if (live_[i]) new (moved + i) T(std::move_if_noexcept(nodes_[i]));
+            // a free slot only holds the free list link
+            else std::memcpy(static_cast<void*>(moved + i), static_cast<void*>(nodes_ + i), sizeof(std::uint32_t));
+        }
+    }
+    catch (...) {
+        while (i-- > 0)
+        {
+            if (live_[i]) moved[i].~T();
+        }
+        ::operator delete(moved);
+        throw;
+    }
+
+    for (i = 0; i < slots_; ++i)
+    {
+        if (live_[i]) nodes_[i].~T();
+    }
+    ::operator delete(nodes_);
+    nodes_ = moved;
+    capacity_ = newCapacity;
+}
+
+/*
+  ---------------------------------------
+  End implementations for the NodeArena class.
+  ---------------------------------------
+*/
+
+#endif
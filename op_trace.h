@@ -0,0 +1,476 @@
+#ifndef OP_TRACE_H
+#define OP_TRACE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <iterator>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+/**
+* Operation traces: the insert, remove, find and iteration calls made on
+* a tree, in a compact binary file that tree-replay can play back against
+* any tree.
+*
+* A trace starts with the 8 bytes "BSTOPS\r\n", a version byte and the key
+* kind ('i' for integers, 's' for std::string). Then each operation is a
+* kind byte followed by its arguments, as LEB128 varints:
+*
+*   Insert, Remove, Find   the key
+*   Scan                   the key, then how many items were stepped over
+*                          from lower_bound(key)
+*   Iterate                how many items were stepped over from begin()
+*
+* Integer keys are stored as the zigzagged difference from the previous
+* key, so runs of nearby keys take a byte or two. String keys store how
+* many leading characters they share with the previous key, then the
+* rest, length first. Values are not recorded.
+*/
+struct OpTrace
+{
+    enum Kind { Insert, Remove, Find, Scan, Iterate, KindCount };
+
+    static const unsigned char version = 1;
+
+    static const char* name(Kind kind);
+    static void writeHeader(std::ostream& out, char keyKind);
+    static char readHeader(std::istream& in);
+    static void writeVarint(std::ostream& out, std::uint64_t v);
+    static bool readVarint(std::istream& in, std::uint64_t& v);
+};
+
+/**
+* One operation read back from a trace. key is unused by Iterate, items
+* by everything but Scan and Iterate.
+*/
+template<typename Key>
+struct OpRecord
+{
+    OpTrace::Kind kind;
+    Key key;
+    std::size_t items;
+
+    OpRecord() : kind(OpTrace::Find), key(), items(0) { }
+};
+
+/**
+* How keys of a given type go into a trace: kind is the header's key kind,
+* and write()/read() code a key against the previous one, which they then
+* replace.
+*/
+template<typename Key, bool = std::is_integral<Key>::value>
+struct OpTraceKey
+{
+};
+
+template<typename Key>
+struct OpTraceKey<Key, true>
+{
+    static const char kind = 'i';
+
+    static void write(std::ostream& out, const Key& key, Key& previous)
+    {
+        std::uint64_t delta = static_cast<std::uint64_t>(key) - static_cast<std::uint64_t>(previous);
+        OpTrace::writeVarint(out, (delta << 1) ^ (0 - (delta >> 63)));
+        previous = key;
+    }
+
+    static bool read(std::istream& in, Key& key, Key& previous)
+    {
+        std::uint64_t zigzag;
+        if (!OpTrace::readVarint(in, zigzag)) return false;
+        std::uint64_t delta = (zigzag >> 1) ^ (0 - (zigzag & 1));
+        key = previous = static_cast<Key>(static_cast<std::uint64_t>(previous) + delta);
+        return true;
+    }
+};
+
+template<>
+struct OpTraceKey<std::string, false>
+{
+    static const char kind = 's';
+
+    static void write(std::ostream& out, const std::string& key, std::string& previous)
+    {
+        std::size_t shared = 0;
+        while (shared < key.size() && shared < previous.size() && key[shared] == previous[shared]) ++shared;
+        OpTrace::writeVarint(out, shared);
+        OpTrace::writeVarint(out, key.size() - shared);
+        out.write(key.data() + shared, static_cast<std::streamsize>(key.size() - shared));
+        previous = key;
+    }
+
+    static bool read(std::istream& in, std::string& key, std::string& previous)
+    {
+        std::uint64_t shared, rest;
+        if (!OpTrace::readVarint(in, shared) || !OpTrace::readVarint(in, rest)) return false;
+        if (shared > previous.size()) return false;
+
+        // rest comes from the file, so the key only grows as its bytes
+        // arrive; a corrupt length runs out of input, not out of memory
+        previous.resize(static_cast<std::size_t>(shared));
+        char buffer[4096];
+        while (rest > 0) {
+            std::size_t chunk = rest < sizeof buffer ? static_cast<std::size_t>(rest) : sizeof buffer;
+            if (!in.read(buffer, static_cast<std::streamsize>(chunk))) return false;
+            previous.append(buffer, chunk);
+            rest -= chunk;
+        }
+        key = previous;
+        return true;
+    }
+};
+
+template<typename Key>
+class OpTraceWriter
+{
+public:
+    explicit OpTraceWriter(std::ostream& out);
+
+    void record(OpTrace::Kind kind, const Key& key);
+    void scan(const Key& key, std::size_t items);
+    void iterate(std::size_t items);
+    std::size_t recorded() const;
+
+private:
+    std::ostream& out_;
+    Key previous_;
+    std::size_t recorded_;
+};
+
+template<typename Key>
+class OpTraceReader
+{
+public:
+    explicit OpTraceReader(std::istream& in);
+
+    bool next(OpRecord<Key>& op);
+
+private:
+    std::istream& in_;
+    Key previous_;
+};
+
+/**
+* Forwards calls to a tree and records each of them to a trace, for
+* capturing the operations a real program makes. Works with any tree that
+* has the std::map style find() and lower_bound() plus insert(pair) and
+* remove(key), which is to say BinarySearchTree and AVLTree.
+*
+* Only calls made through the wrapper are recorded; iterating tree()
+* directly goes unseen, so loops should go through forEach() or scan(),
+* or report what they stepped over with recordIterate().
+*/
+template<class Tree>
+class RecordingTree
+{
+public:
+    typedef typename Tree::iterator iterator;
+    typedef typename std::iterator_traits<iterator>::value_type value_type;
+    typedef typename std::remove_const<typename value_type::first_type>::type key_type;
+
+    RecordingTree(Tree& tree, std::ostream& out);
+
+    void insert(const value_type& keyValuePair);
+    void remove(const key_type& key);
+    iterator find(const key_type& key);
+    template<typename Fn>
+    std::size_t scan(const key_type& key, std::size_t limit, Fn fn);
+    template<typename Fn>
+    std::size_t forEach(Fn fn);
+    void recordIterate(std::size_t items);
+
+    Tree& tree();
+    std::size_t recorded() const;
+
+private:
+    Tree& tree_;
+    OpTraceWriter<key_type> writer_;
+};
+
+/*
+  -----------------------------------------
+  Begin implementations for the OpTrace class.
+  -----------------------------------------
+*/
+
+inline const char* OpTrace::name(Kind kind)
+{
+    switch (kind)
+    {
+        case Insert:    return "insert";
+        case Remove:    return "remove";
+        case Find:      return "find";
+        case Scan:      return "scan";
+        case Iterate:   return "iterate";
+        case KindCount: break;
+    }
+    return "?";
+}
+
+inline void OpTrace::writeHeader(std::ostream& out, char keyKind)
+{
+    out.write("BSTOPS\r\n", 8);
+    out.put(static_cast<char>(version));
+    out.put(keyKind);
+}
+
+/**
+* Reads a trace header and returns its key kind. Throws
+* std::runtime_error if in does not hold a trace this code can read.
+*/
+inline char OpTrace::readHeader(std::istream& in)
+{
+    char header[10];
+    if (!in.read(header, sizeof(header)) || std::string(header, 8) != "BSTOPS\r\n") {
+        throw std::runtime_error("Not an operation trace");
+    }
+    if (static_cast<unsigned char>(header[8]) != version) {
+        throw std::runtime_error("Unsupported operation trace version");
+    }
+    return header[9];
+}
+
+inline void OpTrace::writeVarint(std::ostream& out, std::uint64_t v)
+{
+    while (v >= 0x80)
+    {
+        out.put(static_cast<char>((v & 0x7f) | 0x80));
+        v >>= 7;
+    }
+    out.put(static_cast<char>(v));
+}
+
+/**
+* Returns false if in ends, or goes bad, before the varint does.
+*/
+inline bool OpTrace::readVarint(std::istream& in, std::uint64_t& v)
+{
+    v = 0;
+    for (unsigned shift = 0; shift < 64; shift += 7)
+    {
+        int c = in.get();
+        if (c == std::char_traits<char>::eof()) return false;
+        v |= static_cast<std::uint64_t>(c & 0x7f) << shift;
+        if ((c & 0x80) == 0) return true;
+    }
+    return false;
+}
+
+/*
+  ---------------------------------------
+  End implementations for the OpTrace class.
+  ---------------------------------------
+*/
+
+/*
+  -----------------------------------------
+  Begin implementations for the OpTraceWriter class.
+  -----------------------------------------
+*/
+
+/**
+* Writes the trace header straight away, so even a trace of no
+* operations can be replayed.
+*/
+template<typename Key>
+OpTraceWriter<Key>::OpTraceWriter(std::ostream& out) :
+    out_(out), previous_(), recorded_(0)
+{
+    OpTrace::writeHeader(out_, OpTraceKey<Key>::kind);
+}
+
+/**
+* Records an Insert, Remove or Find of key.
+*/
+template<typename Key>
+void OpTraceWriter<Key>::record(OpTrace::Kind kind, const Key& key)
+{
+    out_.put(static_cast<char>(kind));
+    OpTraceKey<Key>::write(out_, key, previous_);
+    ++recorded_;
+}
+
+template<typename Key>
+void OpTraceWriter<Key>::scan(const Key& key, std::size_t items)
+{
+    out_.put(static_cast<char>(OpTrace::Scan));
+    OpTraceKey<Key>::write(out_, key, previous_);
+    OpTrace::writeVarint(out_, items);
+    ++recorded_;
+}
+
+template<typename Key>
+void OpTraceWriter<Key>::iterate(std::size_t items)
+{
+    out_.put(static_cast<char>(OpTrace::Iterate));
+    OpTrace::writeVarint(out_, items);
+    ++recorded_;
+}
+
+template<typename Key>
+std::size_t OpTraceWriter<Key>::recorded() const
+{
+    return recorded_;
+}
+
+/*
+  ---------------------------------------
+  End implementations for the OpTraceWriter class.
+  ---------------------------------------
+*/
+
+/*
+  -----------------------------------------
+  Begin implementations for the OpTraceReader class.
+  -----------------------------------------
+*/
+
+/**
+* Reads the trace header, throwing std::runtime_error if it is not a
+* trace or its keys are not of type Key.
+*/
+template<typename Key>
+OpTraceReader<Key>::OpTraceReader(std::istream& in) :
+    in_(in), previous_()
+{
+    if (OpTrace::readHeader(in_) != OpTraceKey<Key>::kind) {
+        throw std::runtime_error("Operation trace has a different key type");
+    }
+}
+
+/**
+* Reads the next operation into op. Returns false at the end of the
+* trace, and throws std::runtime_error if the trace is cut short or
+* corrupt.
+*/
+template<typename Key>
+bool OpTraceReader<Key>::next(OpRecord<Key>& op)
+{
+    int kind = in_.get();
+    if (kind == std::char_traits<char>::eof()) return false;
+    if (kind >= OpTrace::KindCount) throw std::runtime_error("Corrupt operation trace");
+
+    op.kind = static_cast<OpTrace::Kind>(kind);
+    op.items = 0;
+    bool ok = true;
+    if (op.kind != OpTrace::Iterate) {
+        ok = OpTraceKey<Key>::read(in_, op.key, previous_);
+    }
+    if (ok && (op.kind == OpTrace::Scan || op.kind == OpTrace::Iterate)) {
+        std::uint64_t items;
+        ok = OpTrace::readVarint(in_, items);
+        op.items = static_cast<std::size_t>(items);
+    }
+    if (!ok) throw std::runtime_error("Truncated operation trace");
+    return true;
+}
+
+/*
+  ---------------------------------------
+  End implementations for the OpTraceReader class.
+  ---------------------------------------
+*/
+
+/*
+  -----------------------------------------
+  Begin implementations for the RecordingTree class.
+  -----------------------------------------
+*/
+
+template<class Tree>
+RecordingTree<Tree>::RecordingTree(Tree& tree, std::ostream& out) :
+    tree_(tree), writer_(out)
+{
+
+}
+
+template<class Tree>
+void RecordingTree<Tree>::insert(const value_type& keyValuePair)
+{
+    writer_.record(OpTrace::Insert, keyValuePair.first);
+    tree_.insert(keyValuePair);
+}
+
+template<class Tree>
+void RecordingTree<Tree>::remove(const key_type& key)
+{
+    writer_.record(OpTrace::Remove, key);
+    tree_.remove(key);
+}
+
+template<class Tree>
+typename RecordingTree<Tree>::iterator RecordingTree<Tree>::find(const key_type& key)
+{
+    writer_.record(OpTrace::Find, key);
+    return tree_.find(key);
+}
+
+/**
+* Calls fn on at most limit items, starting from lower_bound(key), and
+* returns how many it was called on; fn may stop the scan early by
+* returning false.
+*/
+template<class Tree>
+template<typename Fn>
+std::size_t RecordingTree<Tree>::scan(const key_type& key, std::size_t limit, Fn fn)
+{
+    std::size_t items = 0;
+    for (iterator it = tree_.lower_bound(key); it != tree_.end() && items < limit; ++it)
+    {
+        ++items;
+        if (!fn(*it)) break;
+    }
+    writer_.scan(key, items);
+    return items;
+}
+
+/**
+* Calls fn on every item in order, and returns how many there were.
+*/
+template<class Tree>
+template<typename Fn>
+std::size_t RecordingTree<Tree>::forEach(Fn fn)
+{
+    std::size_t items = 0;
+    for (iterator it = tree_.begin(); it != tree_.end(); ++it)
+    {
+        fn(*it);
+        ++items;
+    }
+    writer_.iterate(items);
+    return items;
+}
+
+/**
+* Records an iteration made on tree() directly: items steps from begin().
+*/
+template<class Tree>
+void RecordingTree<Tree>::recordIterate(std::size_t items)
+{
+    writer_.iterate(items);
+}
+
+template<class Tree>
+Tree& RecordingTree<Tree>::tree()
+{
+    return tree_;
+}
+
+template<class Tree>
+std::size_t RecordingTree<Tree>::recorded() const
+{
+    return writer_.recorded();
+}
+
+/*
+  ---------------------------------------
+  End implementations for the RecordingTree class.
+  ---------------------------------------
+*/
+
+#endif
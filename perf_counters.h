@@ -0,0 +1,189 @@
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+/**
+* Hardware event counts for a stretch of the calling thread's user-space
+* code, read through Linux perf_event_open(2).
+*
+* Every event is opened on its own, so a CPU or kernel that lacks one
+* (virtual machines often expose none, and perf_event_paranoid may
+* forbid them all) only loses that event; available() tells which made
+* it. When the PMU has fewer counters than events the kernel time-slices
+* them, and count() scales each by the share of time it was running.
+* Elsewhere than Linux nothing is ever available.
+*
+* Counts accumulate over start()/stop() windows until clear().
+*/
+class PerfCounters
+{
+public:
+    enum Event { Cycles, Instructions, L1dMisses, LlcMisses, BranchMisses, DtlbMisses, EventCount };
+
+    PerfCounters();
+    ~PerfCounters();
+
+    bool available(Event e) const;
+    bool anyAvailable() const;
+    void start();
+    void stop();
+    void clear();
+    double count(Event e) const;
+
+    static const char* name(Event e);
+
+private:
+    PerfCounters(const PerfCounters&);
+    PerfCounters& operator=(const PerfCounters&);
+
+    int fds_[EventCount];
+    double counts_[EventCount];
+};
+
+/*
+  -----------------------------------------
+  Begin implementations for the PerfCounters class.
+  -----------------------------------------
+*/
+
+inline PerfCounters::PerfCounters()
+{
+    for (int e = 0; e < EventCount; ++e)
+    {
+        fds_[e] = -1;
+        counts_[e] = 0;
+    }
+
+#ifdef __linux__
+    const uint64_t readMiss = (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    const struct { uint32_t type; uint64_t config; } events[EventCount] = {
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+        { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | readMiss },
+        { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_LL | readMiss },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+        { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB | readMiss },
+    };
+
+    for (int e = 0; e < EventCount; ++e)
+    {
+        struct perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = events[e].type;
+        attr.config = events[e].config;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        fds_[e] = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+    }
+#endif
+}
+
+inline PerfCounters::~PerfCounters()
+{
+#ifdef __linux__
+    for (int e = 0; e < EventCount; ++e)
+    {
+        if (fds_[e] >= 0) close(fds_[e]);
+    }
+#endif
+}
+
+inline bool PerfCounters::available(Event e) const
+{
+    return fds_[e] >= 0;
+}
+
+inline bool PerfCounters::anyAvailable() const
+{
+    for (int e = 0; e < EventCount; ++e)
+    {
+        if (fds_[e] >= 0) return true;
+    }
+    return false;
+}
+
+/**
+* Starts counting from zero; stop() then adds what was counted.
+*/
+inline void PerfCounters::start()
+{
+#ifdef __linux__
+    for (int e = 0; e < EventCount; ++e)
+    {
+        if (fds_[e] < 0) continue;
+        ioctl(fds_[e], PERF_EVENT_IOC_RESET, 0);
+        ioctl(fds_[e], PERF_EVENT_IOC_ENABLE, 0);
+    }
+#endif
+}
+
+inline void PerfCounters::stop()
+{
+#ifdef __linux__
+    for (int e = 0; e < EventCount; ++e)
+    {
+        if (fds_[e] >= 0) ioctl(fds_[e], PERF_EVENT_IOC_DISABLE, 0);
+    }
+    for (int e = 0; e < EventCount; ++e)
+    {
+        if (fds_[e] < 0) continue;
+
+        uint64_t values[3]; // value, time enabled, time running
+        if (read(fds_[e], values, sizeof(values)) != static_cast<ssize_t>(sizeof(values))) continue;
+        if (values[2] > 0) counts_[e] += static_cast<double>(values[0]) * values[1] / values[2];
+    }
+#endif
+}
+
+inline void PerfCounters::clear()
+{
+    for (int e = 0; e < EventCount; ++e) counts_[e] = 0;
+}
+
+/**
+* What was counted for e over the windows since clear(), or 0 if e is
+* not available.
+*/
+inline double PerfCounters::count(Event e) const
+{
+    return counts_[e];
+}
+
+/**
+* A name for e that is fit for a CSV column or a JSON key.
+*/
+inline const char* PerfCounters::name(Event e)
+{
+    switch (e)
+    {
+        case Cycles:       return "cycles";
+        case Instructions: return "instructions";
+        case L1dMisses:    return "l1d_misses";
+        case LlcMisses:    return "llc_misses";
+        case BranchMisses: return "branch_misses";
+        case DtlbMisses:   return "dtlb_misses";
+        case EventCount:   break;
+    }
+    return "?";
+}
+
+/*
+  ---------------------------------------
+  End implementations for the PerfCounters class.
+  ---------------------------------------
+*/
+
+#endif
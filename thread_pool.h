@@ -0,0 +1,321 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+* A small work-stealing fork-join pool for the divide-and-conquer tree
+* algorithms.
+*
+* Every worker has its own deque of tasks, and threads from outside the
+* pool share one more. invoke(first, second) pushes second onto the back
+* of the calling thread's deque, runs first, then takes second back if
+* nobody stole it. Idle threads steal from the front of the other
+* deques, so they take the oldest task, which near the root of a
+* recursion is also the biggest. A caller whose task was stolen runs its
+* own tasks, or steals, while it waits. Waiting never blocks a thread
+* that could make progress, so tasks may invoke() recursively to any
+* depth without deadlocking, even with a single worker.
+*
+* The deques are guarded by one mutex each rather than being lock-free.
+* The tree algorithms fork only the top few levels, so a task is far
+* bigger than a lock.
+*
+* A pool with no workers runs everything on the calling thread.
+*/
+class ThreadPool
+{
+public:
+    explicit ThreadPool(unsigned workers);
+    ~ThreadPool();
+
+    template <typename First, typename Second>
+    void invoke(First first, Second second);
+
+    unsigned workers() const;
+
+    static ThreadPool& shared();
+
+private:
+    ThreadPool(const ThreadPool&);
+    ThreadPool& operator=(const ThreadPool&);
+
+    struct Task
+    {
+        std::function<void()> run;
+        std::exception_ptr error;
+        bool done; // guarded by sleepMutex_
+    };
+
+    struct Deque
+    {
+        std::mutex mutex;
+        std::deque<Task*> tasks;
+    };
+
+    // Which pool, if any, the calling thread works for, and its deque
+    struct Worker
+    {
+        const ThreadPool* pool;
+        std::size_t index;
+    };
+    static Worker& current();
+
+    std::size_t ownIndex() const;
+    void push(Deque& deque, Task* task);
+    bool takeBack(Deque& deque, Task* task);
+    Task* popOwn(Deque& deque);
+    Task* steal(std::size_t thief);
+    bool anyQueued();
+    void work(std::size_t index);
+    void execute(Task* task);
+
+    std::vector<std::unique_ptr<Deque> > deques_; // one per worker, then one for outside threads
+    std::vector<std::thread> threads_;
+    std::mutex sleepMutex_;
+    std::condition_variable wake_;      // idle threads wait here for tasks and finished tasks
+    bool stopping_;
+};
+
+/*
+  -----------------------------------------
+  Begin implementations for the ThreadPool class.
+  -----------------------------------------
+*/
+
+inline ThreadPool::ThreadPool(unsigned workers) :
+    stopping_(false)
+{
+    for (unsigned i = 0; i <= workers; ++i) deques_.push_back(std::unique_ptr<Deque>(new Deque));
+    threads_.reserve(workers);
+    for (unsigned i = 0; i < workers; ++i) threads_.push_back(std::thread(&ThreadPool::work, this, i));
+}
+
+/**
+* Lets the workers finish whatever is queued, then joins them.
+*/
+inline ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex_);
+        stopping_ = true;
+    }
+    wake_.notify_all();
+    for (std::size_t i = 0; i < threads_.size(); ++i) threads_[i].join();
+}
+
+/**
+* Runs first() and second(), possibly in parallel, and returns once both
+* have. If either throws, the exception is rethrown here after both are
+* done; when both throw, first's wins.
+*/
+template <typename First, typename Second>
+void ThreadPool::invoke(First first, Second second)
+{
+    if (threads_.empty())
+    {
+        first();
+        second();
+        return;
+    }
+
+    Task task;
+    task.run = second;
+    task.done = false;
+    std::size_t me = ownIndex();
+    Deque& deque = *deques_[me];
+    push(deque, &task);
+
+    std::exception_ptr error;
+    try {
+        first();
+    }
+    catch (...) {
+        error = std::current_exception();
+    }
+
+    if (takeBack(deque, &task)) {
+        execute(&task);
+    }
+    for (;;)
+    {
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex_);
+            if (task.done) break;
+        }
+
+        Task* other = popOwn(deque);
+        if (other == NULL) other = steal(me);
+        if (other != NULL) {
+            execute(other);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(sleepMutex_);
+        while (!task.done && !anyQueued()) wake_.wait(lock);
+    }
+
+    if (error) std::rethrow_exception(error);
+    if (task.error) std::rethrow_exception(task.error);
+}
+
+inline unsigned ThreadPool::workers() const
+{
+    return static_cast<unsigned>(threads_.size());
+}
+
+/**
+* The process-wide pool: one worker per hardware thread besides the
+* caller's own, none on a single core.
+*/
+inline ThreadPool& ThreadPool::shared()
+{
+    static ThreadPool pool(std::thread::hardware_concurrency() > 1 ? std::thread::hardware_concurrency() - 1 : 0);
+    return pool;
+}
+
+inline ThreadPool::Worker& ThreadPool::current()
+{
+    static thread_local Worker worker = { NULL, 0 };
+    return worker;
+}
+
+/**
+* The index of the calling thread's deque: its own if it is one of the
+* workers, the shared one of outside threads otherwise.
+*/
+inline std::size_t ThreadPool::ownIndex() const
+{
+    const Worker& me = current();
+    return me.pool == this ? me.index : threads_.size();
+}
+
+inline void ThreadPool::push(Deque& deque, Task* task)
+{
+    {
+        std::lock_guard<std::mutex> lock(deque.mutex);
+        deque.tasks.push_back(task);
+    }
+    // taking sleepMutex_ orders the push before any sleeper's last look
+    { std::lock_guard<std::mutex> lock(sleepMutex_); }
+    wake_.notify_all();
+}
+
+/**
+* Removes task from deque if nobody took it yet. Nested invoke()s take
+* their own tasks back before returning, so on a worker's deque it is
+* at the back; outside threads share a deque and may find it anywhere.
+*/
+inline bool ThreadPool::takeBack(Deque& deque, Task* task)
+{
+    std::lock_guard<std::mutex> lock(deque.mutex);
+    std::deque<Task*>::reverse_iterator mine = std::find(deque.tasks.rbegin(), deque.tasks.rend(), task);
+    if (mine == deque.tasks.rend()) return false;
+
+    deque.tasks.erase(std::next(mine).base());
+    return true;
+}
+
+/**
+* The newest task on the thread's own deque, or NULL.
+*/
+inline ThreadPool::Task* ThreadPool::popOwn(Deque& deque)
+{
+    std::lock_guard<std::mutex> lock(deque.mutex);
+    if (deque.tasks.empty()) return NULL;
+
+    Task* task = deque.tasks.back();
+    deque.tasks.pop_back();
+    return task;
+}
+
+/**
+* The oldest task on some other deque, or NULL if all are empty. The
+* search starts past the thief's own deque, so thieves spread out.
+*/
+inline ThreadPool::Task* ThreadPool::steal(std::size_t thief)
+{
+    for (std::size_t i = 1; i <= deques_.size(); ++i)
+    {
+        Deque& victim = *deques_[(thief + i) % deques_.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (victim.tasks.empty()) continue;
+
+        Task* task = victim.tasks.front();
+        victim.tasks.pop_front();
+        return task;
+    }
+    return NULL;
+}
+
+/**
+* Whether any deque holds a task. Called with sleepMutex_ held, which
+* push() takes after queueing, so a sleeper cannot miss a push.
+*/
+inline bool ThreadPool::anyQueued()
+{
+    for (std::size_t i = 0; i < deques_.size(); ++i)
+    {
+        std::lock_guard<std::mutex> lock(deques_[i]->mutex);
+        if (!deques_[i]->tasks.empty()) return true;
+    }
+    return false;
+}
+
+inline void ThreadPool::work(std::size_t index)
+{
+    current().pool = this;
+    current().index = index;
+
+    for (;;)
+    {
+        Task* task = popOwn(*deques_[index]);
+        if (task == NULL) task = steal(index);
+        if (task != NULL) {
+            execute(task);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(sleepMutex_);
+        while (!stopping_ && !anyQueued()) wake_.wait(lock);
+        if (stopping_ && !anyQueued()) return;
+    }
+}
+
+/**
+* Runs a task that was just taken off a deque and marks it done. Once
+* done is set the task's owner may return and destroy it, so it is not
+* touched afterwards.
+*/
+inline void ThreadPool::execute(Task* task)
+{
+    try {
+        task->run();
+    }
+    catch (...) {
+        task->error = std::current_exception();
+    }
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex_);
+        task->done = true;
+    }
+    wake_.notify_all();
+}
+
+/*
+  ---------------------------------------
+  End implementations for the ThreadPool class.
+  ---------------------------------------
+*/
+
+#endif
@@ -0,0 +1,266 @@
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <cstdlib>
+#include <string>
+#include <map>
+#include <algorithm>
+#include <stdexcept>
+#include "bst.h"
+#include "avlbst.h"
+#include "op_trace.h"
+
+using namespace std;
+
+/*
+ * Plays an operation trace (see op_trace.h) back against std::map,
+ * AVLTree and BinarySearchTree, and reports each tree's throughput and
+ * the latency of every kind of operation, as percentiles and as a log2
+ * histogram.
+ *
+ *   tree-replay <trace> [map] [avl] [bst]
+ *   tree-replay --sample <trace> [ops]
+ *
+ * Without tree names all three are replayed; a plain BinarySearchTree can
+ * take O(n^2) on traces that insert in key order, so leave bst out for
+ * those. --sample writes a trace of its own through a RecordingTree, an
+ * AVLTree under a queue-like load whose removes of the oldest keys keep
+ * removeFix() busy.
+ *
+ * The trace is decoded, and room for every latency reserved, before the
+ * clock starts. Every operation is timed on its own, so each latency
+ * includes one steady_clock read. Inserted values are the operation's
+ * position in the trace, as traces carry no values.
+ *
+ * The trees replay the same operations, so they must agree on how many
+ * finds hit and how many items scans and iterations step over; the exit
+ * status is 1 if they do not, or if the trace cannot be read.
+ */
+
+static const size_t histogramBuckets = 24; // [0,32ns), [32,64ns), ... up to about 0.3s
+
+template<typename Tree, typename K>
+static void put(Tree& tree, const K& key, int value) { tree.insert(make_pair(key, value)); }
+
+template<typename K>
+static void put(map<K, int>& tree, const K& key, int value) { tree[key] = value; }
+
+template<typename Tree, typename K>
+static void drop(Tree& tree, const K& key) { tree.remove(key); }
+
+template<typename K>
+static void drop(map<K, int>& tree, const K& key) { tree.erase(key); }
+
+template<typename It>
+static size_t step(It it, It end, size_t items)
+{
+    size_t stepped = 0;
+    for (; it != end && stepped < items; ++it) ++stepped;
+    return stepped;
+}
+
+static size_t bucketOf(uint64_t ns)
+{
+    size_t bucket = 0;
+    for (ns >>= 5; ns > 0 && bucket + 1 < histogramBuckets; ns >>= 1) ++bucket;
+    return bucket;
+}
+
+static uint64_t percentile(const vector<uint64_t>& sorted, double p)
+{
+    return sorted[static_cast<size_t>(p * (sorted.size() - 1))];
+}
+
+static void report(const char* treeName, size_t ops, double ns, vector<uint64_t> (&latencies)[OpTrace::KindCount])
+{
+    cout << treeName << ": " << ops << " ops in " << fixed << setprecision(1) << ns / 1e6 << " ms, "
+         << setprecision(2) << (ns > 0 ? ops / ns * 1000.0 : 0.0) << " Mops/s" << endl;
+
+    cout << "  " << left << setw(8) << "op" << right << setw(10) << "count" << setw(10) << "ns/op"
+         << setw(8) << "p50" << setw(8) << "p90" << setw(8) << "p99" << setw(9) << "p99.9" << setw(10) << "max" << endl;
+    size_t highest = 0;
+    for (int k = 0; k < OpTrace::KindCount; ++k)
+    {
+        vector<uint64_t>& l = latencies[k];
+        if (l.empty()) continue;
+
+        uint64_t total = 0;
+        for (size_t i = 0; i < l.size(); ++i) total += l[i];
+        sort(l.begin(), l.end());
+        highest = max(highest, bucketOf(l.back()));
+
+        cout << "  " << left << setw(8) << OpTrace::name(static_cast<OpTrace::Kind>(k)) << right << setw(10) << l.size()
+             << setw(10) << setprecision(1) << static_cast<double>(total) / l.size()
+             << setw(8) << percentile(l, 0.5) << setw(8) << percentile(l, 0.9) << setw(8) << percentile(l, 0.99)
+             << setw(9) << percentile(l, 0.999) << setw(10) << l.back() << endl;
+    }
+
+    cout << "  " << left << setw(18) << "latency (ns)" << right;
+    for (int k = 0; k < OpTrace::KindCount; ++k)
+    {
+        if (!latencies[k].empty()) cout << setw(10) << OpTrace::name(static_cast<OpTrace::Kind>(k));
+    }
+    cout << endl;
+    for (size_t b = 0; b <= highest; ++b)
+    {
+        uint64_t low = b == 0 ? 0 : uint64_t(32) << (b - 1);
+        string range = "[" + to_string(low) + ", " + to_string(uint64_t(32) << b) + ")";
+        cout << "  " << left << setw(18) << range << right;
+        for (int k = 0; k < OpTrace::KindCount; ++k)
+        {
+            const vector<uint64_t>& l = latencies[k];
+            if (l.empty()) continue;
+            // l is sorted, so the bucket is the run of latencies in [low, high)
+            size_t count = lower_bound(l.begin(), l.end(), uint64_t(32) << b) - lower_bound(l.begin(), l.end(), low);
+            if (b + 1 == histogramBuckets) count = l.end() - lower_bound(l.begin(), l.end(), low);
+            cout << setw(10) << count;
+        }
+        cout << endl;
+    }
+    cout << endl;
+}
+
+// Replays ops on a fresh Tree, reports it, and returns a checksum that
+// must come out the same for every tree.
+template<typename Tree, typename K>
+static size_t replay(const char* treeName, const vector<OpRecord<K> >& ops)
+{
+    Tree tree;
+    vector<uint64_t> latencies[OpTrace::KindCount];
+    size_t checksum = 0;
+
+    // Sized up front so no push_back reallocates inside the timed loop
+    size_t counts[OpTrace::KindCount] = { };
+    for (size_t i = 0; i < ops.size(); ++i) ++counts[ops[i].kind];
+    for (int k = 0; k < OpTrace::KindCount; ++k) latencies[k].reserve(counts[k]);
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    chrono::steady_clock::time_point previous = start;
+    for (size_t i = 0; i < ops.size(); ++i)
+    {
+        const OpRecord<K>& op = ops[i];
+        switch (op.kind)
+        {
+            case OpTrace::Insert:  put(tree, op.key, static_cast<int>(i)); break;
+            case OpTrace::Remove:  drop(tree, op.key); break;
+            case OpTrace::Find:    checksum += tree.find(op.key) != tree.end(); break;
+            case OpTrace::Scan:    checksum += step(tree.lower_bound(op.key), tree.end(), op.items); break;
+            case OpTrace::Iterate: checksum += step(tree.begin(), tree.end(), op.items); break;
+            case OpTrace::KindCount: break;
+        }
+        chrono::steady_clock::time_point now = chrono::steady_clock::now();
+        latencies[op.kind].push_back(chrono::duration_cast<chrono::nanoseconds>(now - previous).count());
+        previous = now;
+    }
+    report(treeName, ops.size(), chrono::duration<double, nano>(previous - start).count(), latencies);
+    return checksum;
+}
+
+template<typename K>
+static bool replayAll(istream& in, const vector<string>& trees)
+{
+    vector<OpRecord<K> > ops;
+    OpTraceReader<K> reader(in);
+    OpRecord<K> op;
+    while (reader.next(op)) ops.push_back(op);
+
+    bool agreed = true;
+    bool first = true;
+    size_t expected = 0;
+    for (size_t i = 0; i < trees.size(); ++i)
+    {
+        size_t checksum;
+        if (trees[i] == "map") checksum = replay<map<K, int> >("std::map", ops);
+        else if (trees[i] == "avl") checksum = replay<AVLTree<K, int> >("AVLTree", ops);
+        else checksum = replay<BinarySearchTree<K, int> >("BinarySearchTree", ops);
+
+        if (!first && checksum != expected) {
+            cerr << trees[i] << " disagrees with " << trees[0] << endl;
+            agreed = false;
+        }
+        expected = checksum;
+        first = false;
+    }
+    return agreed;
+}
+
+// Records ops operations on an AVLTree: keys arrive in increasing order
+// and expire oldest first, with lookups of live keys, short range scans
+// and now and then a full pass.
+static void writeSample(ostream& out, size_t ops)
+{
+    AVLTree<int, int> tree;
+    RecordingTree<AVLTree<int, int> > recorder(tree, out);
+    mt19937 rng(2024);
+    int oldest = 0, next = 0;
+
+    for (size_t i = 0; i < ops; ++i)
+    {
+        unsigned roll = rng() % 1000;
+        int live = next - oldest;
+        if (roll < 260 || live == 0) recorder.insert(make_pair(next++, static_cast<int>(i)));
+        else if (roll < 500) recorder.remove(oldest++);
+        else if (roll < 990) recorder.find(oldest + static_cast<int>(rng() % (2 * live)));
+        else if (roll < 999) recorder.scan(oldest + static_cast<int>(rng() % live), 64, [](const pair<const int, int>&) { return true; });
+        else recorder.forEach([](const pair<const int, int>&) { });
+    }
+}
+
+static int usage()
+{
+    cerr << "usage: tree-replay <trace> [map] [avl] [bst]" << endl
+         << "       tree-replay --sample <trace> [ops]" << endl;
+    return 1;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2) return usage();
+
+    if (string(argv[1]) == "--sample")
+    {
+        if (argc < 3) return usage();
+        ofstream out(argv[2], ios::binary);
+        writeSample(out, argc > 3 ? strtoul(argv[3], NULL, 10) : 1000000);
+        if (!out) {
+            cerr << "cannot write " << argv[2] << endl;
+            return 1;
+        }
+        return 0;
+    }
+
+    vector<string> trees;
+    for (int i = 2; i < argc; ++i)
+    {
+        string name = argv[i];
+        if (name != "map" && name != "avl" && name != "bst") return usage();
+        trees.push_back(name);
+    }
+    if (trees.empty()) {
+        trees.push_back("map");
+        trees.push_back("avl");
+        trees.push_back("bst");
+    }
+
+    ifstream in(argv[1], ios::binary);
+    if (!in) {
+        cerr << "cannot open " << argv[1] << endl;
+        return 1;
+    }
+    try
+    {
+        char keyKind = OpTrace::readHeader(in);
+        in.seekg(0);
+        if (keyKind == OpTraceKey<long long>::kind) return replayAll<long long>(in, trees) ? 0 : 1;
+        if (keyKind == OpTraceKey<string>::kind) return replayAll<string>(in, trees) ? 0 : 1;
+        cerr << argv[1] << ": unknown key kind '" << keyKind << "'" << endl;
+    }
+    catch (const exception& e)
+    {
+        cerr << argv[1] << ": " << e.what() << endl;
+    }
+    return 1;
+}
@@ -0,0 +1,205 @@
+#ifndef TREE_STATS_H
+#define TREE_STATS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+/**
+* Operation counters for one tree.
+*
+* Build with -DBST_STATS (see DEFS in the Makefile) and the trees count
+* as they go; without it the BST_STATS_* hooks expand to nothing and
+* every counter stays 0. Only the single-threaded paths count: lookups,
+* inserts and removes, their rebalancing, and node allocation. Bulk and
+* parallel operations show up in the allocation counts only.
+*
+* The counters are plain fields, which even const lookups such as find()
+* and lower_bound() write to. Under BST_STATS a tree must therefore not be
+* read from two threads at once: concurrent lookups, which are otherwise
+* safe, become a data race on the counters. Builds without BST_STATS are
+* unaffected.
+*
+* Visits and comparisons are made while descending the tree. Each find,
+* insert or remove also adds the nodes it visited to its own total, so
+* the visits per operation of each kind can be told apart.
+*/
+struct TreeStats
+{
+    enum Op { None, Find, Insert, Remove };
+
+    uint64_t comparisons;
+    uint64_t visits;
+    uint64_t finds, findVisits;
+    uint64_t inserts, insertVisits;
+    uint64_t removes, removeVisits;
+    uint64_t singleRotations, doubleRotations; // done by insertFix() and removeFix()
+    uint64_t nodeSwaps;
+    uint64_t allocations;
+
+    TreeStats();
+    void clear();
+    void writeJson(std::ostream& out) const;
+
+    // Counts one op and the visits made while it is alive. A scope opened
+    // inside another (remove()'s lookup, say) counts for the outer one.
+    class Scope
+    {
+    public:
+        Scope(TreeStats& stats, Op op);
+        ~Scope();
+
+    private:
+        TreeStats* stats_;
+        uint64_t start_;
+    };
+
+private:
+    Op active_;
+};
+
+/**
+* The shape of a tree, computed on demand by shape(): how many nodes sit
+* at each depth, the root being at depth 0.
+*/
+struct TreeShape
+{
+    std::size_t size;
+    std::vector<std::size_t> depths;
+
+    TreeShape();
+    std::size_t height() const;
+    double averageDepth() const;
+    void writeJson(std::ostream& out) const;
+};
+
+/*
+  -----------------------------------------
+  Begin implementations for the TreeStats class.
+  -----------------------------------------
+*/
+
+inline TreeStats::TreeStats()
+{
+    clear();
+}
+
+inline void TreeStats::clear()
+{
+    comparisons = visits = 0;
+    finds = findVisits = 0;
+    inserts = insertVisits = 0;
+    removes = removeVisits = 0;
+    singleRotations = doubleRotations = 0;
+    nodeSwaps = 0;
+    allocations = 0;
+    active_ = None;
+}
+
+/**
+* Writes the counters as one JSON object, with the average visits of
+* each kind of operation worked out.
+*/
+inline void TreeStats::writeJson(std::ostream& out) const
+{
+    auto perOp = [&out](const char* name, uint64_t count, uint64_t visits) {
+        out << '"' << name << "\":{\"count\":" << count << ",\"visits\":" << visits
+            << ",\"visitsPerOp\":" << (count > 0 ? static_cast<double>(visits) / count : 0.0) << '}';
+    };
+
+    out << "{\"comparisons\":" << comparisons << ",\"visits\":" << visits << ',';
+    perOp("find", finds, findVisits);
+    out << ',';
+    perOp("insert", inserts, insertVisits);
+    out << ',';
+    perOp("remove", removes, removeVisits);
+    out << ",\"rotations\":{\"single\":" << singleRotations << ",\"double\":" << doubleRotations << '}'
+        << ",\"nodeSwaps\":" << nodeSwaps
+        << ",\"allocations\":" << allocations << '}';
+}
+
+inline TreeStats::Scope::Scope(TreeStats& stats, Op op) :
+    stats_(stats.active_ == None ? &stats : NULL), start_(stats.visits)
+{
+    if (stats_ != NULL) stats_->active_ = op;
+}
+
+inline TreeStats::Scope::~Scope()
+{
+    if (stats_ == NULL) return;
+
+    uint64_t visits = stats_->visits - start_;
+    switch (stats_->active_)
+    {
+        case Find:   ++stats_->finds;   stats_->findVisits += visits;   break;
+        case Insert: ++stats_->inserts; stats_->insertVisits += visits; break;
+        case Remove: ++stats_->removes; stats_->removeVisits += visits; break;
+        case None:   break;
+    }
+    stats_->active_ = None;
+}
+
+/*
+  ---------------------------------------
+  End implementations for the TreeStats class.
+  ---------------------------------------
+*/
+
+/*
+  -----------------------------------------
+  Begin implementations for the TreeShape class.
+  -----------------------------------------
+*/
+
+inline TreeShape::TreeShape() :
+    size(0)
+{
+
+}
+
+/**
+* The number of levels; 0 for an empty tree.
+*/
+inline std::size_t TreeShape::height() const
+{
+    return depths.size();
+}
+
+/**
+* The mean number of nodes a successful find visits, counting the one it
+* stops at: about log2(size) when balanced, up to size / 2 when the tree
+* has degenerated into a list.
+*/
+inline double TreeShape::averageDepth() const
+{
+    if (size == 0) return 0.0;
+
+    double total = 0;
+    for (std::size_t d = 0; d < depths.size(); ++d) total += static_cast<double>(d + 1) * depths[d];
+    return total / size;
+}
+
+inline void TreeShape::writeJson(std::ostream& out) const
+{
+    out << "{\"size\":" << size << ",\"height\":" << height() << ",\"averageDepth\":" << averageDepth()
+        << ",\"depthHistogram\":[";
+    for (std::size_t d = 0; d < depths.size(); ++d) out << (d > 0 ? "," : "") << depths[d];
+    out << "]}";
+}
+
+/*
+  ---------------------------------------
+  End implementations for the TreeShape class.
+  ---------------------------------------
+*/
+
+#ifdef BST_STATS
+#define BST_STATS_COUNT(counter, n) (this->stats_.counter += (n))
+#define BST_STATS_SCOPE(op) TreeStats::Scope statsScope(this->stats_, TreeStats::op)
+#else
+#define BST_STATS_COUNT(counter, n) ((void)0)
+#define BST_STATS_SCOPE(op) ((void)0)
+#endif
+
+#endif
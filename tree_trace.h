@@ -0,0 +1,170 @@
+#ifndef TREE_TRACE_H
+#define TREE_TRACE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+
+/**
+* Compile-time tracing of structural changes to the trees.
+*
+* Build with -DBST_TRACE (see DEFS in the Makefile) and every insert,
+* remove, rotation and balance update is recorded as a TraceEvent in the
+* calling thread's TraceRing, overwriting the oldest events once it is
+* full. Without it BST_TRACE_EVENT expands to nothing and its arguments
+* are never evaluated, so the trees pay nothing for the hooks.
+*
+* The ring is per thread: events from parallel set operations land in
+* the ring of whichever thread made them.
+*/
+struct TraceEvent
+{
+    enum Kind
+    {
+        Insert,      // a node was linked in as a new leaf; before/after: 0
+        Remove,      // a node is about to be unlinked; before/after: its balance, 0 if it has none
+        RotateLeft,  // node moved down to the left; before/after: its balance and its right child's
+        RotateRight, // node moved down to the right; before/after: its balance and its left child's
+        Rebalance    // an insert, remove or rotation changed node's balance from before to after
+    };
+
+    Kind kind;
+    const void* node;
+    int8_t before;
+    int8_t after;
+
+    static const char* name(Kind kind);
+};
+
+class TraceRing
+{
+public:
+    static const std::size_t capacity = 4096;
+
+    TraceRing();
+
+    void record(TraceEvent::Kind kind, const void* node, int before, int after);
+    std::size_t size() const;
+    std::size_t recorded() const;
+    const TraceEvent& operator[](std::size_t i) const;
+    void clear();
+    void dump(std::ostream& out) const;
+
+private:
+    TraceEvent events_[capacity];
+    std::size_t recorded_;
+};
+
+/*
+  -----------------------------------------
+  Begin implementations for the TraceEvent class.
+  -----------------------------------------
+*/
+
+inline const char* TraceEvent::name(Kind kind)
+{
+    switch (kind)
+    {
+        case Insert:      return "insert";
+        case Remove:      return "remove";
+        case RotateLeft:  return "rotate-left";
+        case RotateRight: return "rotate-right";
+        case Rebalance:   return "rebalance";
+    }
+    return "?";
+}
+
+/*
+  ---------------------------------------
+  End implementations for the TraceEvent class.
+  ---------------------------------------
+*/
+
+/*
+  -----------------------------------------
+  Begin implementations for the TraceRing class.
+  -----------------------------------------
+*/
+
+inline TraceRing::TraceRing() :
+    recorded_(0)
+{
+
+}
+
+inline void TraceRing::record(TraceEvent::Kind kind, const void* node, int before, int after)
+{
+    TraceEvent& event = events_[recorded_ % capacity];
+    event.kind = kind;
+    event.node = node;
+    event.before = static_cast<int8_t>(before);
+    event.after = static_cast<int8_t>(after);
+    ++recorded_;
+}
+
+/**
+* How many events are held: everything recorded, up to capacity.
+*/
+inline std::size_t TraceRing::size() const
+{
+    return recorded_ < capacity ? recorded_ : capacity;
+}
+
+/**
+* How many events were recorded since the last clear(), including the
+* ones already overwritten.
+*/
+inline std::size_t TraceRing::recorded() const
+{
+    return recorded_;
+}
+
+/**
+* The i-th event held, oldest first.
+*/
+inline const TraceEvent& TraceRing::operator[](std::size_t i) const
+{
+    return events_[(recorded_ - size() + i) % capacity];
+}
+
+inline void TraceRing::clear()
+{
+    recorded_ = 0;
+}
+
+/**
+* Writes the events held, oldest first, one per line.
+*/
+inline void TraceRing::dump(std::ostream& out) const
+{
+    for (std::size_t i = 0; i < size(); ++i)
+    {
+        const TraceEvent& event = (*this)[i];
+        out << TraceEvent::name(event.kind) << ' ' << event.node << ' '
+            << static_cast<int>(event.before) << " -> " << static_cast<int>(event.after) << '\n';
+    }
+}
+
+/*
+  ---------------------------------------
+  End implementations for the TraceRing class.
+  ---------------------------------------
+*/
+
+/**
+* The calling thread's trace ring.
+*/
+inline TraceRing& traceRing()
+{
+    static thread_local TraceRing ring;
+    return ring;
+}
+
+#ifdef BST_TRACE
+#define BST_TRACE_EVENT(kind, node, before, after) \
+    traceRing().record(TraceEvent::kind, (node), (before), (after))
+#else
+#define BST_TRACE_EVENT(kind, node, before, after) ((void)0)
+#endif
+
+#endif